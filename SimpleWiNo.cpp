@@ -18,6 +18,10 @@ int macDebug;
 #include "kernel/utils.c"
 #include "kernel/phy.c"
 #include "kernel/mac.c"
+#include "kernel/frag.c"
+#include "kernel/sync.c"
+#include "kernel/route.c"
+#include "kernel/chan.c"
 
 
 SimpleWiNo::SimpleWiNo(void) {
@@ -57,6 +61,10 @@ void SimpleWiNo::init() {
 
   phyInit();
   macInit();
+  fragInit();
+  syncInit();
+  routeInit();
+  chanInit();
 }
 
 
@@ -71,6 +79,11 @@ void SimpleWiNo::process() {
 
   phyEngine();
   macEngine();
+  neighbEngine();
+  fragEngine();
+  syncEngine();
+  routeEngine();
+  chanEngine();
 }
 
 
@@ -106,14 +119,16 @@ int SimpleWiNo::set(uint8_t param, uint16_t value) {
     case NODE_TXPOWER:
       if ( (value>7) || (value<0) ) return false;
       nodeTxPower = value;
+      phyLockRadio();
       rf22.setTxPower(value);
+      phyUnlockRadio();
       return true;
       break;
     
     case NODE_CHANNEL:
-      if ( (value>17) || (value<0) ) return false;
+      if ( value >= PHY_CHANNELS ) return false;
       nodeChannel = value;
-      rf22.setFrequency(433.0 + value*0.1, 0.05);
+      chanSetHome(value);
       return true;
       break;
 
@@ -127,6 +142,79 @@ int SimpleWiNo::set(uint8_t param, uint16_t value) {
       return true;
       break;
 
+    case MAC_ADAPTIVE_CSMA:
+      macSetAdaptiveCsma(value);
+      return true;
+      break;
+
+    case MAC_BLOCK_ACK:
+      macBlockAck = value;
+      return true;
+      break;
+
+    case PHY_MODEM_PROFILE:
+      if ( value >= PHY_MODEM_PROFILES ) return false;
+      phySetModemProfile(value);
+      return true;
+      break;
+
+    case MAC_RATE_ADAPTATION:
+      macRateAdaptation = value;
+      return true;
+      break;
+
+    case MAC_BEACON_INTERVAL:
+      macSetBeaconInterval(value);
+      return true;
+      break;
+
+    case MAC_LPL_INTERVAL:
+      macSetLplInterval(value);
+      return true;
+      break;
+
+    case MAC_LPL_HOLD:
+      macLplHold = value;
+      return true;
+      break;
+
+    case SYNC_INTERVAL:
+      return syncSetInterval(value);
+      break;
+
+    case ROUTE_INTERVAL:
+      routeSetInterval(value);
+      return true;
+      break;
+
+    case ROUTE_SINK:
+      routeSetSink(value);
+      return true;
+      break;
+
+    case CHANNEL_SCAN_INTERVAL:
+      chanSetScanInterval(value);
+      return true;
+      break;
+
+    case CHANNEL_HOPPING:
+      return chanSetHopping(value);
+      break;
+
+    case MAC_GTS_REQUEST:
+      if ( value > MAC_SUPERFRAME_SLOTS-MAC_MIN_CAP_SLOTS ) return false;
+      macGtsRequested = value;
+      // Sent once the coordinator is known
+      macGtsRequestPending = true;
+      return true;
+      break;
+
+    case MAC_AGGREGATION_HOLD:
+      macAggregationHold = value;
+      if ( value == 0 ) macAggregateOpen = false;
+      return true;
+      break;
+
     default:
       break;
   }
@@ -175,6 +263,118 @@ uint16_t SimpleWiNo::get(uint8_t param) {
       return macDebug;
       break;
 
+    case PHY_RX_QUEUE_COUNT:
+      return phyRxQueueCount();
+      break;
+
+    case PHY_RX_QUEUE_OVERFLOWS:
+      return phyStats.rxQueueOverflows + phyRxOverruns;
+      break;
+
+    case MAC_TX_QUEUE_COUNT:
+      return macTxQueueCount();
+      break;
+
+    case MAC_ADAPTIVE_CSMA:
+      return macAdaptiveCsma;
+      break;
+
+    case MAC_MIN_BE_CURRENT:
+      return macMinBe;
+      break;
+
+    case MAC_CCA_THRESHOLD:
+      return macCcaThreshold;
+      break;
+
+    case PHY_NOISE_FLOOR:
+      return macNoiseFloor >> 8;
+      break;
+
+    case MAC_AGGREGATION_HOLD:
+      return macAggregationHold;
+      break;
+
+    case MAC_BLOCK_ACK:
+      return macBlockAck;
+      break;
+
+    case PHY_MODEM_PROFILE:
+      return phyModemProfile;
+      break;
+
+    case MAC_RATE_ADAPTATION:
+      return macRateAdaptation;
+      break;
+
+    case MAC_BEACON_INTERVAL:
+      return macBeaconInterval;
+      break;
+
+    case MAC_GTS_REQUEST:
+      return macGtsRequested;
+      break;
+
+    case MAC_GTS_SLOTS:
+      return macGtsSlots;
+      break;
+
+    case MAC_LPL_INTERVAL:
+      return macLplInterval;
+      break;
+
+    case MAC_LPL_HOLD:
+      return macLplHold;
+      break;
+
+    case SYNC_INTERVAL:
+      return syncInterval;
+      break;
+
+    case SYNC_ROOT:
+      return syncIsSynchronized() ? syncRootAddress : SYNC_ROOT_NONE;
+      break;
+
+    case ROUTE_INTERVAL:
+      return routeInterval;
+      break;
+
+    case ROUTE_SINK:
+      return routeSink;
+      break;
+
+    case ROUTE_PARENT:
+      return routeParent;
+      break;
+
+    case ROUTE_PATH_ETX:
+      return routePathMetric;
+      break;
+
+    case ROUTE_QUEUE_COUNT:
+      return routeQueueCount();
+      break;
+
+    case CHANNEL_SCAN_INTERVAL:
+      return chanScanInterval;
+      break;
+
+    case CHANNEL_HOPPING:
+      return chanHopping;
+      break;
+
+    case CHANNEL_CURRENT:
+      return phyChannel;
+      break;
+
+    case CHANNEL_BEST:
+      return chanBestChannel();
+      break;
+
+    case CHANNEL_HOP_COUNT:
+      return chanMapCount(chanMap);
+      break;
+
     default:
       break;
   }
@@ -183,32 +383,191 @@ uint16_t SimpleWiNo::get(uint8_t param) {
 }
 
 
-void SimpleWiNo::send ( uint16_t destAddress, uint8_t* payload, uint8_t len ) {
+int SimpleWiNo::send ( uint16_t destAddress, uint8_t* payload, uint8_t len ) {
+
+  uint8_t handle, result;
+
+  // Routing on: the destination may be several hops away
+  if ( routeInterval && ( destAddress != BROADCAST_ADDRESS ) ) result = routeDataRequest ( destAddress, payload, len, &handle );
+  else result = MCPS_data_request ( true, true, nodePanId, destAddress, payload, len, &handle );
+  if ( result != MCPS_DATA_REQUEST_SUCCESS ) {
+
+    if ( macDebug ) {
+      Serial.printf("MAC_DEBUG cannot send data\n");
+    }
+    return -1;
+  }
+  return handle;
+}
+
+
+uint8_t* SimpleWiNo::beginFrame ( uint16_t destAddress, uint8_t* maxLen ) {
+
+  return macBeginDataFrame ( true, true, nodePanId, destAddress, maxLen, 0 );
+}
+
+
+int SimpleWiNo::commitFrame ( uint8_t len ) {
+
+  uint8_t handle;
 
-  if ( MCPS_data_request ( true, true, nodePanId, destAddress, payload, len ) != MCPS_DATA_REQUEST_SUCCESS ) {
+  if ( macCommitDataFrame ( len, &handle ) != MCPS_DATA_REQUEST_SUCCESS ) {
 
-    Serial.printf("MAC_DEBUG cannot send data\n");
+    if ( macDebug ) {
+      Serial.printf("MAC_DEBUG cannot send data\n");
+    }
+    return -1;
   }
+  return handle;
+}
+
+
+uint8_t SimpleWiNo::sendStatus ( uint8_t handle ) {
+
+  return macGetTxStatus(handle);
+}
+
+
+int SimpleWiNo::sendMessage ( uint16_t destAddress, uint8_t* data, uint16_t len ) {
+
+  int handle;
+
+  handle = fragSendMessage ( destAddress, data, len );
+  if ( ( handle < 0 ) && macDebug ) {
+    Serial.printf("FRAG_DEBUG cannot send message\n");
+  }
+  return handle;
+}
+
+
+uint8_t SimpleWiNo::messageStatus ( uint8_t handle ) {
+
+  return fragGetTxStatus(handle);
+}
+
+
+uint8_t SimpleWiNo::recvMessage ( uint16_t* sourceAddress, uint8_t* data, uint16_t* len ) {
+
+  return fragReceiveMessage(sourceAddress, data, len);
+}
+
+
+uint8_t SimpleWiNo::neighbors ( uint16_t* list ) {
+
+  return neighbGetNeighbors(list);
+}
+
+
+uint8_t SimpleWiNo::linkQuality ( uint16_t address, struct linkQuality_t* quality ) {
+
+  uint8_t i;
+
+  i = neighbGetNeighborIndex(address);
+  if ( i == NEIGHB_NEIGHBOR_NOT_FOUND ) return false;
+  quality->rssi = ( ::neighbors[i].rssiAverage + 128 ) >> 8;
+  quality->prr = ::neighbors[i].prr >> 8;
+  quality->etx = ::neighbors[i].etx;
+  quality->lastUpdate = ::neighbors[i].lastUpdate;
+  quality->profile = macLinkProfile(address);
+#ifdef PHY_TIMESTAMPS_AT_TX
+  quality->clockOffset = neighbClockOffset(i, micros());
+  quality->clockSkew = ::neighbors[i].clockSkew * 1e6;
+#endif
+  return true;
+}
+
+
+uint8_t SimpleWiNo::channelQuality ( uint8_t channel, struct channelQuality_t* quality ) {
+
+  if ( channel >= PHY_CHANNELS ) return false;
+  quality->energy = ( chanTable[channel].energy + 128 ) >> 8;
+  quality->busy = chanTable[channel].busy >> 8;
+  quality->samples = chanTable[channel].samples;
+  quality->lastSample = chanTable[channel].lastSample;
+  quality->hopped = ( chanMap >> channel ) & 1;
+  return true;
+}
+
+
+uint32_t SimpleWiNo::globalMicros ( void ) {
+
+  return syncGlobalTime(micros());
+}
+
+
+void SimpleWiNo::stats ( struct winoStats_t* stats ) {
+
+  phyUpdateRadioOnTime();
+  stats->phy = phyStats;
+  stats->phy.rxOverruns = phyRxOverruns;
+  stats->mac = macStats;
+  stats->route = routeStats;
+  stats->chan = chanStats;
+}
+
+
+void SimpleWiNo::clearStats ( void ) {
+
+  phyUpdateRadioOnTime();
+  memset(&phyStats, 0, sizeof(phyStats));
+  phyRadioOnMicros = 0;
+  phyRxOverruns = 0;
+  memset(&macStats, 0, sizeof(macStats));
+  memset(&routeStats, 0, sizeof(routeStats));
+  memset(&chanStats, 0, sizeof(chanStats));
+}
+
+
+uint16_t SimpleWiNo::trace ( struct macTraceEvent_t* events, uint16_t maxCount ) {
+
+  return macTraceGet(events, maxCount);
+}
+
+
+void SimpleWiNo::traceDump ( void ) {
+
+  macTraceDump();
 }
 
 
 uint8_t SimpleWiNo::recv ( uint16_t* sourceAddress, uint8_t* payload, uint8_t* len ) {
 
-  if ( macFrameReceived ) {
+  struct rxView_t view;
 
-    for ( uint8_t i=0; i<macLastPayloadLen; i++) {
-      // copy payload
-      payload[i] = macLastPayload[i];
-    } 
-    *sourceAddress = macLastSourceAddressReceived;
-    *len = macLastPayloadLen;
-    macFrameReceived = false;
+  if ( recvView ( &view ) ) {
+
+    memcpy(payload, view.payload, view.length);
+    *sourceAddress = view.sourceAddress;
+    *len = view.length;
+    release();
     return true;
 
   } else return false;
 }
 
 
+uint8_t SimpleWiNo::recvView ( struct rxView_t* view ) {
+
+  struct rxFrame_t *rxFrame;
+
+  // The payload stays in the reception queue until release(): no copy
+  rxFrame = macGetReceivedPayload ( &view->sourceAddress, &view->payload, &view->length );
+  if ( rxFrame == NULL ) return false;
+  view->rssi = rxFrame->rssi;
+  view->timestamp = rxFrame->timestamp;
+#ifdef PHY_TIMESTAMPS_AT_TX
+  view->txTimestamp = rxFrame->txTimestamp;
+#endif
+  return true;
+}
+
+
+void SimpleWiNo::release ( void ) {
+
+  macFreeReceivedPayload();
+}
+
+
 void SimpleWiNo::rgb(uint8_t red, uint8_t green, uint8_t blue) {
 
   analogWrite(rgbRed, red);
@@ -243,12 +602,12 @@ void SimpleWiNo::encodeUi32 ( uint32_t from, uint8_t *to ) {
 
 float SimpleWiNo::decodeFloat ( uint8_t *data ) {
 
-  return decodeFloat(data);
+  return ::decodeFloat(data);
 }
 
 
 void SimpleWiNo::encodeFloat ( float from, uint8_t *to ) {
 
-  encodeFloat(from,to);
+  ::encodeFloat(from,to);
 }
 
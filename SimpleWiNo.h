@@ -13,23 +13,142 @@
 #define MAX_FRAME_LENGTH 64
 #define BROADCAST_ADDRESS 0xFFFF
 
+#ifdef PHY_TIMESTAMPS_AT_TX
+#define PHY_TRAILER_LENGTH 4 // TX timestamp appended by PD_data_request
+#else
+#define PHY_TRAILER_LENGTH 0
+#endif
+
 #include <RH_RF22.h>
 
 struct txFrame_t {
   uint8_t length;
-  uint8_t data[MAX_FRAME_LENGTH];
+  uint8_t data[MAX_FRAME_LENGTH+PHY_TRAILER_LENGTH];
 };
 
 struct rxFrame_t {
   uint8_t length;
-  uint8_t data[MAX_FRAME_LENGTH];
+  uint8_t data[MAX_FRAME_LENGTH+PHY_TRAILER_LENGTH];
   uint8_t rssi;
-  uint32_t timestamp; // 1 timestamp is 1us
+  uint32_t timestamp; // 1 timestamp is 1us, taken when the packet is read from the driver
 #ifdef PHY_TIMESTAMPS_AT_TX
   uint32_t txTimestamp;
 #endif
 };
 
+// Received payload lent by recvView() until release()
+struct rxView_t {
+  uint16_t sourceAddress;
+  uint8_t* payload;
+  uint8_t length;
+  uint8_t rssi;
+  uint32_t timestamp; // us
+#ifdef PHY_TIMESTAMPS_AT_TX
+  uint32_t txTimestamp; // us, sender's clock
+#endif
+};
+
+// Counters given by stats(), since init() or the last clearStats()
+struct phyStats_t {
+  uint32_t txFrames; // frames given to the radio, ACKs and retries included
+  uint32_t rxFrames; // frames read from the radio
+  uint32_t rxOverruns; // packets dropped because no reception frame was free
+  uint32_t rxQueueOverflows; // payloads dropped because the reception queue was full (not ACKed)
+  uint32_t radioOnTime; // ms the radio was not sleeping (MAC_LPL_INTERVAL)
+};
+
+struct macStats_t {
+  uint32_t txDataFrames; // data frame transmissions, retries included
+  uint32_t retries; // data frames sent again after an ACK timeout
+  uint32_t txQueueFull; // data requests rejected because the TX queue was full
+  uint32_t txFrameOpen; // data requests and commands rejected because a frame begun with beginFrame() was not committed yet
+  uint32_t confirmSuccess;
+  uint32_t confirmNoAck;
+  uint32_t confirmChannelAccessFailure;
+  uint32_t ccaBusy; // CCA that found the medium busy
+  uint32_t acksSent;
+  uint32_t acksLate; // scheduled ACKs dropped because the source was not waiting for them anymore
+  uint32_t acksReceived;
+  uint32_t rxDataFrames; // data frames for this node (or broadcast), duplicates included
+  uint32_t aggregatedPayloads; // payloads appended to a data frame already queued (MAC_AGGREGATION_HOLD)
+  uint32_t malformedFrames; // aggregated frames whose payload lengths don't match the frame length, dropped
+  uint32_t duplicates; // duplicated data frames dropped
+  uint32_t foreignPan; // frames from another PAN dropped
+  uint32_t neighborTableFull; // frames whose source could not be added to the neighbor table
+  uint32_t neighborsExpired; // neighbors removed after NEIGHB_NEIGHBOR_TIMEOUT
+  uint32_t neighborsReplaced; // least recently heard neighbors replaced by a new one (table full)
+  uint32_t rateSwitches; // exchanges sent with a faster modem profile than PHY_MODEM_PROFILE (MAC_RATE_ADAPTATION)
+  uint32_t rateDowngrades; // links moved to a slower modem profile after a loss or a weaker RSSI
+  uint32_t beaconsSent; // coordinator (MAC_BEACON_INTERVAL)
+  uint32_t beaconsMissed; // beacons of its coordinator a device did not receive on time
+  uint32_t gtsAccesses; // exchanges sent in the GTS of this device, retries included
+  uint32_t gtsDenied; // GTS requests a coordinator could not satisfy
+  uint32_t lplStrobes; // copies of a frame sent again to cover the wake-up interval of the destination (MAC_LPL_INTERVAL)
+  uint32_t lplWakeUps; // wake-ups that found energy on the channel and kept the radio on
+  uint32_t cbrGenerated;
+  uint32_t cbrRejected;
+};
+
+struct routeStats_t {
+  uint32_t forwarded; // frames of other nodes ACKed by their next hop (ROUTE_INTERVAL)
+  uint32_t forwardFailures; // frames of other nodes dropped after ROUTE_MAX_ATTEMPTS transmissions not ACKed
+  uint32_t queued; // frames of other nodes taken in the forwarding queue
+  uint32_t queueFull; // frames of other nodes not ACKed because the forwarding queue was full
+  uint32_t queueOccupancyTotal; // frames found in the forwarding queue by each frame taken: queueOccupancyTotal/queued is the mean occupancy
+  uint32_t queueMax; // largest occupancy of the forwarding queue
+  uint32_t hopLatencyTotal; // us from the reception of a forwarded frame to its ACK by the next hop: hopLatencyTotal/forwarded is the mean per-hop latency
+  uint32_t hopLatencyMax; // us
+  uint32_t noRoute; // sends rejected, and frames of other nodes dropped, without a next hop
+  uint32_t loops; // frames dropped after ROUTE_MAX_HOPS hops or back at their origin
+  uint32_t parentChanges; // parents replaced by a better one, or lost
+  uint32_t discoveries; // route requests flooded by this node
+  uint32_t duplicates; // frames with a network header received again (same origin and sequence number) and dropped
+};
+
+struct chanStats_t {
+  uint32_t scanSamples; // energy samples of the background scan (CHANNEL_SCAN_INTERVAL)
+  uint32_t hops; // listening channel changes (CHANNEL_HOPPING)
+  uint32_t deferrals; // exchanges deferred to a later slot: broadcast slot, busy channel or end of the slot
+  uint32_t mapChanges; // channels left out of the hop sequence or back in it
+};
+
+struct winoStats_t {
+  struct phyStats_t phy;
+  struct macStats_t mac;
+  struct routeStats_t route;
+  struct chanStats_t chan;
+};
+
+// Link quality of a neighbor given by linkQuality()
+struct linkQuality_t {
+  uint8_t rssi; // average RSSI (register units, as rssi in rxView_t)
+  uint8_t prr; // packet reception ratio from this neighbor, 255 is 100%
+  uint16_t etx; // expected transmissions to this neighbor (ACKed frames), 1/16 units, 16 is 1 transmission. 0 if never sent to
+  uint32_t lastUpdate; // us, last frame heard from it or ACK received
+  uint8_t profile; // modem profile of the data frames to this neighbor (MODEM_PROFILE_*, see MAC_RATE_ADAPTATION)
+#ifdef PHY_TIMESTAMPS_AT_TX
+  int32_t clockOffset; // us, clock of this neighbor minus the local clock now, 0 if not known yet
+  float clockSkew; // ppm, rate of the clock of this neighbor over the local one, minus 1
+#endif
+};
+
+// Quality of a channel given by channelQuality(), from the background scan (CHANNEL_SCAN_INTERVAL)
+struct channelQuality_t {
+  uint8_t energy; // average energy (register units, as rssi in rxView_t)
+  uint8_t busy; // ratio of the samples over the CCA threshold, 255 is 100%
+  uint16_t samples; // 0 if never sampled
+  uint32_t lastSample; // us
+  uint8_t hopped; // in the hop sequence of this node (CHANNEL_HOPPING)
+};
+
+// MAC trace event given by trace(), see MAC_TRACE_* in kernel/mac.h
+struct macTraceEvent_t {
+  uint32_t timestamp; // micros()
+  uint8_t event;
+  uint8_t value;
+  uint16_t arg;
+};
+
 enum {
   NODE_SHORT_ADDRESS,
   NODE_PANID,
@@ -39,7 +158,52 @@ enum {
   RGB_PIN_GREEN,
   RGB_PIN_BLUE,
   PHY_DEBUG,
-  MAC_DEBUG
+  MAC_DEBUG,
+  PHY_RX_QUEUE_COUNT,
+  PHY_RX_QUEUE_OVERFLOWS,
+  MAC_TX_QUEUE_COUNT,
+  MAC_ADAPTIVE_CSMA,
+  MAC_MIN_BE_CURRENT,
+  MAC_CCA_THRESHOLD,
+  PHY_NOISE_FLOOR,
+  MAC_AGGREGATION_HOLD,
+  MAC_BLOCK_ACK,
+  PHY_MODEM_PROFILE,
+  MAC_RATE_ADAPTATION,
+  MAC_BEACON_INTERVAL,
+  MAC_GTS_REQUEST,
+  MAC_GTS_SLOTS,
+  MAC_LPL_INTERVAL,
+  MAC_LPL_HOLD,
+  SYNC_INTERVAL,
+  SYNC_ROOT,
+  ROUTE_INTERVAL,
+  ROUTE_SINK,
+  ROUTE_PARENT,
+  ROUTE_PATH_ETX,
+  ROUTE_QUEUE_COUNT,
+  CHANNEL_SCAN_INTERVAL,
+  CHANNEL_HOPPING,
+  CHANNEL_CURRENT,
+  CHANNEL_BEST,
+  CHANNEL_HOP_COUNT
+};
+
+// Modem profiles (PHY_MODEM_PROFILE), fastest first
+enum {
+  MODEM_PROFILE_125K = 0, // GFSK 125kbps, the default
+  MODEM_PROFILE_57K6 = 1, // GFSK 57.6kbps
+  MODEM_PROFILE_19K2 = 2, // GFSK 19.2kbps
+  MODEM_PROFILE_4K8 = 3 // GFSK 4.8kbps
+};
+
+// Status of a frame given by sendStatus() (same values as MCPS_data_confirm)
+enum {
+  SEND_SUCCESS = 0,
+  SEND_NO_ACK = 1,
+  SEND_CHANNEL_ACCESS_FAILURE = 2,
+  SEND_PENDING = 3,
+  SEND_UNKNOWN = 4
 };
 
 #include "Arduino.h"
@@ -52,8 +216,24 @@ class SimpleWiNo {
     void process();
     int set(uint8_t param, uint16_t value);
     uint16_t get(uint8_t param);
-    void send(uint16_t destAddress, uint8_t* payload, uint8_t len);
+    int send(uint16_t destAddress, uint8_t* payload, uint8_t len);
+    uint8_t sendStatus(uint8_t handle);
+    uint8_t* beginFrame(uint16_t destAddress, uint8_t* maxLen);
+    int commitFrame(uint8_t len);
+    int sendMessage(uint16_t destAddress, uint8_t* data, uint16_t len);
+    uint8_t messageStatus(uint8_t handle);
+    uint8_t recvMessage(uint16_t* sourceAddress, uint8_t* data, uint16_t* len);
     uint8_t recv(uint16_t* sourceAddress, uint8_t* payload, uint8_t* len);
+    uint8_t recvView(struct rxView_t* view);
+    void release();
+    uint8_t neighbors(uint16_t* list);
+    uint8_t linkQuality(uint16_t address, struct linkQuality_t* quality);
+    uint8_t channelQuality(uint8_t channel, struct channelQuality_t* quality);
+    uint32_t globalMicros();
+    void stats(struct winoStats_t* stats);
+    void clearStats();
+    uint16_t trace(struct macTraceEvent_t* events, uint16_t maxCount);
+    void traceDump();
     void rgb(uint8_t red, uint8_t green, uint8_t blue);
     uint16_t decodeUi16 ( uint8_t *data );
     void encodeUi16 ( uint16_t from, uint8_t *to );
@@ -0,0 +1,62 @@
+/**
+ * @file Arduino.h
+ * @brief Host simulation: subset of the Arduino/Teensyduino API used by SimpleWiNo
+ */
+
+#ifndef ARDUINO_H
+#define ARDUINO_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <stdlib.h>
+
+#define LOW 0
+#define HIGH 1
+#define INPUT 0
+#define OUTPUT 1
+#define DEC 10
+#define HEX 16
+#define SS 10
+#define A13 13
+
+uint32_t micros ( void );
+uint32_t millis ( void );
+void delay ( uint32_t ms );
+void delayMicroseconds ( uint32_t us );
+long random ( long howbig );
+long random ( long howsmall, long howbig );
+void randomSeed ( unsigned long seed );
+int analogRead ( uint8_t pin );
+void analogWrite ( uint8_t pin, int value );
+void pinMode ( uint8_t pin, uint8_t mode );
+void digitalWrite ( uint8_t pin, uint8_t value );
+void noInterrupts ( void );
+void interrupts ( void );
+
+class SerialClass {
+
+  public:
+    void begin ( long baud ) { (void)baud; }
+    int available ( void ) { return 0; }
+    int read ( void ) { return -1; }
+    int printf ( const char* format, ... ) __attribute__((format(printf, 2, 3)));
+    void print ( const char* str );
+    void print ( long value, int base = DEC );
+    void println ( const char* str );
+    void println ( long value, int base = DEC );
+};
+
+extern SerialClass Serial;
+
+// Teensyduino periodic timer interrupt, run by the simulator clock
+class IntervalTimer {
+
+  public:
+    bool begin ( void (*isr)(void), uint32_t period );
+    void end ( void );
+};
+
+#include "SPI.h"
+
+#endif
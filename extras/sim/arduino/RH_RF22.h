@@ -0,0 +1,76 @@
+/**
+ * @file RH_RF22.h
+ * @brief Host simulation: RadioHead RH_RF22 stand-in, backed by the simulated radio medium
+ */
+
+#ifndef RH_RF22_h
+#define RH_RF22_h
+
+#include "Arduino.h"
+#include "../sim.h"
+
+#define RH_RF22_MAX_MESSAGE_LEN 255
+
+class RHGenericDriver {
+
+  public:
+    typedef enum {
+      RHModeInitialising = SIM_MODE_INITIALISING,
+      RHModeSleep = SIM_MODE_SLEEP,
+      RHModeIdle = SIM_MODE_IDLE,
+      RHModeTx = SIM_MODE_TX,
+      RHModeRx = SIM_MODE_RX
+    } RHMode;
+};
+
+class RH_RF22 : public RHGenericDriver {
+
+  public:
+    typedef enum {
+      UnmodulatedCarrier = 0,
+      FSK_PN9_Rb2Fd5,
+      FSK_Rb2Fd5,
+      FSK_Rb2_4Fd36,
+      FSK_Rb4_8Fd45,
+      FSK_Rb9_6Fd45,
+      FSK_Rb19_2Fd9_6,
+      FSK_Rb38_4Fd19_6,
+      FSK_Rb57_6Fd28_8,
+      FSK_Rb125Fd125,
+      FSK_Rb_512Fd2_5,
+      FSK_Rb_512Fd4_5,
+      GFSK_Rb2Fd5,
+      GFSK_Rb2_4Fd36,
+      GFSK_Rb4_8Fd45,
+      GFSK_Rb9_6Fd45,
+      GFSK_Rb19_2Fd9_6,
+      GFSK_Rb38_4Fd19_6,
+      GFSK_Rb57_6Fd28_8,
+      GFSK_Rb125Fd125,
+      OOK_Rb1_2Bw75,
+      OOK_Rb2_4Bw335,
+      OOK_Rb4_8Bw335,
+      OOK_Rb9_6Bw335,
+      OOK_Rb19_2Bw335,
+      OOK_Rb38_4Bw335,
+      OOK_Rb40Bw335
+    } ModemConfigChoice;
+
+    RH_RF22 ( uint8_t slaveSelectPin = SS, uint8_t interruptPin = 2 ) { (void)slaveSelectPin; (void)interruptPin; }
+    bool init ( void ) { setModeIdle(); return true; }
+    bool setModemConfig ( ModemConfigChoice index ) { simRadioSetModemConfig(index); return true; }
+    bool setFrequency ( float centre, float afcPullInRange = 0.05 ) { (void)afcPullInRange; simRadioSetFrequency(centre); return true; }
+    void setTxPower ( uint8_t power ) { simRadioSetTxPower(power); }
+    bool available ( void ) { return simRadioAvailable(); }
+    bool recv ( uint8_t* buf, uint8_t* len ) { return simRadioRecv(buf, len); }
+    bool send ( const uint8_t* data, uint8_t len ) { return simRadioSend(data, len); }
+    bool waitPacketSent ( void ) { simRadioWaitPacketSent(); return true; }
+    void setModeIdle ( void ) { simRadioSetMode(RHModeIdle); }
+    void setModeRx ( void ) { simRadioSetMode(RHModeRx); }
+    bool sleep ( void ) { simRadioSetMode(RHModeSleep); return true; }
+    uint8_t rssiRead ( void ) { return simRadioRssiRead(); }
+    int16_t lastRssi ( void ) { return simRadioLastRssi(); }
+    RHMode mode ( void ) { return (RHMode)simRadioMode(); }
+};
+
+#endif
@@ -0,0 +1,18 @@
+/**
+ * @file SPI.h
+ * @brief Host simulation: SPI stand-in (the simulated radio is not on a bus)
+ */
+
+#ifndef SPI_H
+#define SPI_H
+
+class SPIClass {
+
+  public:
+    void setSCK ( uint8_t pin ) { (void)pin; }
+    void begin ( void ) {}
+};
+
+extern SPIClass SPI;
+
+#endif
@@ -0,0 +1,31 @@
+#!/bin/sh
+# MAC throughput/latency benchmark: sweeps the MAC CBR generators over offered load, payload size,
+# node count and ACK request, and appends one JSON line per run to $BENCH_OUTPUT.
+# Results of two versions of the library are compared by their "label" (git describe by default).
+
+cd "$(dirname "$0")"
+
+BENCH_OUTPUT=${BENCH_OUTPUT:-bench.jsonl}
+BENCH_LABEL=${BENCH_LABEL:-$(git describe --always --dirty 2>/dev/null || echo unknown)}
+BENCH_DURATION=${BENCH_DURATION:-10}
+BENCH_SEEDS=${BENCH_SEEDS:-"1 2 3"}
+BENCH_NODES=${BENCH_NODES:-"2 5 10 20"}
+BENCH_PERIODS=${BENCH_PERIODS:-"1000000 200000 100000 50000 20000"}
+BENCH_SIZES=${BENCH_SIZES:-"16 32 55"} # 55: the largest MAC payload
+BENCH_ACKS=${BENCH_ACKS:-"ack no-ack"}
+BENCH_OPTIONS=${BENCH_OPTIONS:-} # more wino-sim options, e.g. --adaptive-csma
+
+for nodes in $BENCH_NODES; do
+  for period in $BENCH_PERIODS; do
+    for size in $BENCH_SIZES; do
+      for ack in $BENCH_ACKS; do
+        for seed in $BENCH_SEEDS; do
+          if [ "$ack" = "no-ack" ]; then ackOption=--no-ack; else ackOption=; fi
+          ./wino-sim --library ./libwinonode-bench.so --cbr $ackOption $BENCH_OPTIONS --nodes "$nodes" --period "$period" \
+            --size "$size" --duration "$BENCH_DURATION" --seed "$seed" --json "$BENCH_LABEL" >> "$BENCH_OUTPUT" || exit 1
+        done
+      done
+    done
+  done
+done
+echo "results appended to $BENCH_OUTPUT ($BENCH_LABEL)"
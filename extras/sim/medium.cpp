@@ -0,0 +1,683 @@
+/**
+ * @file medium.cpp
+ * @brief Host simulation: virtual clock, nodes and shared radio medium (simulator side)
+ *
+ * Time advances by config.tick. At each tick, ended transmissions are delivered, then every node
+ * that is not blocked runs its loop(). A blocking call (delayMicroseconds, waitPacketSent) moves the
+ * node's own clock forward and the node is skipped until the simulator clock catches up.
+ *
+ * Radio model: log-distance path loss, SINR-based capture, half-duplex radios that must listen
+ * during the whole packet, RadioHead-like driver behavior (one packet buffer, idle after a valid
+ * packet or after a transmission). An optional continuous jammer adds its power on one channel.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <dlfcn.h>
+#include <unistd.h>
+#include <random>
+#include <vector>
+
+#include "sim.h"
+#include "medium.h"
+
+#define SIM_RF22_PACKET_OVERHEAD 13 // bytes: preamble 4, sync 2, RadioHead header 4, length 1, CRC 2
+#define SIM_TX_STARTUP 100 // us, from send() to the first bit on air
+#define SIM_SPEED_OF_LIGHT 299.792458 // m/us
+#define SIM_KEEP_ENDED_TRANSMISSIONS 200000 // us, ended transmissions kept for interference computation
+
+struct simTransmission_t {
+
+  int source;
+  uint64_t start;
+  uint64_t end;
+  float frequency;
+  int config;
+  double power; // dBm at 1m
+  uint8_t length;
+  uint8_t data[255];
+  uint8_t delivered;
+
+};
+
+struct simRadio_t {
+
+  int mode;
+  uint64_t modeSince;
+  float frequency;
+  int config;
+  uint8_t txPower;
+  uint64_t txEnd;
+  uint8_t rxBuf[255];
+  uint8_t rxLength;
+  uint8_t rxBufValid;
+  uint8_t lastRssi;
+  struct simRadioStats_t stats;
+
+};
+
+struct simNode_t {
+
+  void* library;
+  double x, y;
+  uint64_t busyUntil;
+  void (*isr)(void);
+  uint32_t isrPeriod;
+  uint64_t isrNext;
+  struct simRadio_t radio;
+  simNodeSetup_t setup;
+  simNodeLoop_t loop;
+  simNodeSend_t send;
+  simNodeSendMessage_t sendMessage;
+  simNodeSet_t set;
+  simNodeGet_t get;
+  simNodeCbr_t cbr;
+  simNodeMacCounters_t macCounters;
+  simNodeRouteCounters_t routeCounters;
+  simNodeChanCounters_t chanCounters;
+  simNodeTrace_t trace;
+  simNodeGlobalTime_t globalTime;
+  uint32_t clockOffset; // micros() of the node at simulator time 0
+  double clockSkew;
+
+};
+
+static struct simConfig_t config;
+static std::vector<simNode_t> nodes;
+static std::vector<simTransmission_t> transmissions;
+static uint64_t now;
+static int current = -1;
+static std::mt19937 rng;
+static simDeliverCallback_t deliverCallback;
+
+static const uint8_t txPowerDbm[8] = { 1, 2, 5, 8, 11, 14, 17, 20 };
+
+
+static double configBitRate ( int config ) {
+
+  // RH_RF22::ModemConfigChoice order
+  static const double bitRate[] = {
+    1000,
+    2000, 2000, 2400, 4800, 9600, 19200, 38400, 57600, 125000, 512, 512,
+    2000, 2400, 4800, 9600, 19200, 38400, 57600, 125000,
+    1200, 2400, 4800, 9600, 19200, 38400, 40000
+  };
+
+  if ( config < 0 || config >= (int)(sizeof(bitRate)/sizeof(bitRate[0])) ) return 125000;
+  return bitRate[config];
+}
+
+
+static double configSensitivity ( int config ) {
+
+  // Si4432: about -121dBm at 2.4kbps, 1dB lost per dB of bit rate
+  return -121.0 + 10.0*log10(configBitRate(config)/2400.0);
+}
+
+
+static double configNoise ( int modemConfig ) {
+
+  // Thermal noise follows the receiver bandwidth, about the bit rate
+  return config.noiseFloor + 10.0*log10(configBitRate(modemConfig)/125000.0);
+}
+
+
+static uint8_t dbmToRssi ( double dbm ) {
+
+  // Si4432 RSSI register: 0.5dB per LSB
+  double rssi = ( dbm + 122.0 ) * 2.0;
+
+  if ( rssi < 0 ) return 0;
+  if ( rssi > 255 ) return 255;
+  return (uint8_t)rssi;
+}
+
+
+static double distance ( int a, int b ) {
+
+  double dx = nodes[a].x - nodes[b].x;
+  double dy = nodes[a].y - nodes[b].y;
+  double d = sqrt(dx*dx + dy*dy);
+
+  return d < 1.0 ? 1.0 : d;
+}
+
+
+static double receivedPower ( const simTransmission_t& t, int receiver ) {
+
+  return t.power - config.pathLossAt1m - 10.0*config.pathLossExponent*log10(distance(t.source, receiver));
+}
+
+
+static uint64_t propagation ( int a, int b ) {
+
+  return (uint64_t)(distance(a, b) / SIM_SPEED_OF_LIGHT);
+}
+
+
+static uint64_t nodeNow ( int node ) {
+
+  return nodes[node].busyUntil > now ? nodes[node].busyUntil : now;
+}
+
+
+static void setMode ( int node, int mode ) {
+
+  struct simRadio_t *radio = &nodes[node].radio;
+  uint64_t t = nodeNow(node);
+
+  if ( radio->mode == mode ) return;
+  if ( radio->mode == SIM_MODE_RX ) radio->stats.rxOnTime += t - radio->modeSince;
+  radio->mode = mode;
+  radio->modeSince = t;
+}
+
+
+static void updateTx ( int node ) {
+
+  // The driver goes back to idle at the end of the transmission
+  struct simRadio_t *radio = &nodes[node].radio;
+
+  if ( radio->mode == SIM_MODE_TX && nodeNow(node) >= radio->txEnd ) {
+    radio->mode = SIM_MODE_IDLE;
+    radio->modeSince = radio->txEnd;
+  }
+}
+
+
+static void deliver ( simTransmission_t& t ) {
+
+  for ( int r=0; r<(int)nodes.size(); r++ ) {
+
+    struct simRadio_t *radio = &nodes[r].radio;
+    uint64_t arrival = t.start + propagation(t.source, r);
+    double signal, interference;
+
+    if ( r == t.source ) continue;
+    if ( radio->frequency != t.frequency || radio->config != t.config ) continue;
+
+    signal = receivedPower(t, r);
+    if ( signal < configSensitivity(t.config) ) {
+      radio->stats.weakSignals++;
+      continue;
+    }
+    if ( radio->mode != SIM_MODE_RX || radio->modeSince > arrival || radio->rxBufValid ) {
+      radio->stats.notListening++;
+      continue;
+    }
+
+    // Interference: the jammer, and every other transmission on the channel overlapping this one
+    interference = pow(10.0, configNoise(t.config)/10.0);
+    if ( t.frequency == config.jamFrequency ) interference += pow(10.0, config.jamPower/10.0);
+    for ( size_t i=0; i<transmissions.size(); i++ ) {
+      simTransmission_t& u = transmissions[i];
+      if ( &u == &t || u.frequency != t.frequency || u.source == r ) continue;
+      if ( u.end <= t.start || u.start >= t.end ) continue;
+      interference += pow(10.0, receivedPower(u, r)/10.0);
+    }
+    if ( signal - 10.0*log10(interference) < config.captureThreshold ) {
+      radio->stats.collisions++;
+      continue;
+    }
+    if ( simUniform() < config.loss ) {
+      radio->stats.randomLosses++;
+      continue;
+    }
+
+    memcpy(radio->rxBuf, t.data, t.length);
+    radio->rxLength = t.length;
+    radio->rxBufValid = true;
+    radio->lastRssi = dbmToRssi(signal);
+    radio->stats.rxPackets++;
+    // RadioHead leaves RX mode on a valid packet
+    radio->mode = SIM_MODE_IDLE;
+    radio->stats.rxOnTime += t.end - radio->modeSince;
+    radio->modeSince = t.end;
+  }
+  t.delivered = true;
+}
+
+
+static void updateMedium ( void ) {
+
+  size_t i;
+
+  for ( i=0; i<transmissions.size(); i++ )
+    if ( !transmissions[i].delivered && transmissions[i].end <= now )
+      deliver(transmissions[i]);
+
+  // Forget old transmissions
+  for ( i=0; i<transmissions.size(); )
+    if ( transmissions[i].delivered && transmissions[i].end + SIM_KEEP_ENDED_TRANSMISSIONS < now )
+      transmissions.erase(transmissions.begin() + i);
+    else i++;
+
+  for ( i=0; i<nodes.size(); i++ ) updateTx(i);
+}
+
+
+// Simulator side API
+
+void simInit ( const struct simConfig_t* c ) {
+
+  config = *c;
+  rng.seed(config.seed);
+  now = 0;
+  transmissions.clear();
+}
+
+
+int simAddNode ( const char* library, double x, double y ) {
+
+  struct simNode_t node;
+  char path[] = "/tmp/wino-node-XXXXXX";
+  char buf[65536];
+  FILE *in, *out;
+  size_t n;
+  int fd;
+
+  // dlopen() loads a library only once per path: load a private copy to get private globals
+  fd = mkstemp(path);
+  if ( fd < 0 ) return -1;
+  in = fopen(library, "rb");
+  out = fdopen(fd, "wb");
+  if ( in == NULL || out == NULL ) return -1;
+  while ( ( n = fread(buf, 1, sizeof(buf), in) ) > 0 ) fwrite(buf, 1, n, out);
+  fclose(in);
+  fclose(out);
+
+  memset(&node, 0, sizeof(node));
+  node.x = x;
+  node.y = y;
+  node.radio.mode = SIM_MODE_IDLE;
+  node.radio.config = 0;
+  node.radio.frequency = 434.0;
+  if ( config.clockDrift > 0 ) {
+    node.clockOffset = rng();
+    node.clockSkew = ( 2*simUniform() - 1 ) * config.clockDrift * 1e-6;
+  }
+  nodes.push_back(node);
+
+  // The node globals (the RH_RF22 object...) are constructed during dlopen
+  current = nodes.size()-1;
+  nodes[current].library = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+  unlink(path);
+  if ( nodes[current].library == NULL ) {
+    fprintf(stderr, "%s\n", dlerror());
+    exit(1);
+  }
+  nodes[current].setup = (simNodeSetup_t)dlsym(nodes[current].library, "simNodeSetup");
+  nodes[current].loop = (simNodeLoop_t)dlsym(nodes[current].library, "simNodeLoop");
+  nodes[current].send = (simNodeSend_t)dlsym(nodes[current].library, "simNodeSend");
+  nodes[current].sendMessage = (simNodeSendMessage_t)dlsym(nodes[current].library, "simNodeSendMessage");
+  nodes[current].set = (simNodeSet_t)dlsym(nodes[current].library, "simNodeSet");
+  nodes[current].get = (simNodeGet_t)dlsym(nodes[current].library, "simNodeGet");
+  nodes[current].cbr = (simNodeCbr_t)dlsym(nodes[current].library, "simNodeCbr");
+  nodes[current].macCounters = (simNodeMacCounters_t)dlsym(nodes[current].library, "simNodeMacCounters");
+  nodes[current].routeCounters = (simNodeRouteCounters_t)dlsym(nodes[current].library, "simNodeRouteCounters");
+  nodes[current].chanCounters = (simNodeChanCounters_t)dlsym(nodes[current].library, "simNodeChanCounters");
+  nodes[current].trace = (simNodeTrace_t)dlsym(nodes[current].library, "simNodeTrace");
+  nodes[current].globalTime = (simNodeGlobalTime_t)dlsym(nodes[current].library, "simNodeGlobalTime");
+  current = -1;
+
+  return nodes.size()-1;
+}
+
+
+void simRemoveNodes ( void ) {
+
+  for ( size_t i=0; i<nodes.size(); i++ ) dlclose(nodes[i].library);
+  nodes.clear();
+  transmissions.clear();
+}
+
+
+int simNodeCount ( void ) {
+
+  return nodes.size();
+}
+
+
+void simSetupNode ( int node, uint16_t address, uint16_t panId, uint8_t channel, uint8_t txPower ) {
+
+  current = node;
+  nodes[node].setup(address, panId, channel, txPower);
+  current = -1;
+}
+
+
+int simSend ( int node, uint16_t destAddress, uint8_t* payload, uint8_t len ) {
+
+  int r;
+
+  current = node;
+  r = nodes[node].send(destAddress, payload, len);
+  current = -1;
+  return r;
+}
+
+
+int simSendMessage ( int node, uint16_t destAddress, uint8_t* data, uint16_t len ) {
+
+  int r;
+
+  current = node;
+  r = nodes[node].sendMessage(destAddress, data, len);
+  current = -1;
+  return r;
+}
+
+
+int simSet ( int node, uint8_t param, uint16_t value ) {
+
+  int r;
+
+  current = node;
+  r = nodes[node].set(param, value);
+  current = -1;
+  return r;
+}
+
+
+uint16_t simGet ( int node, uint8_t param ) {
+
+  uint16_t r;
+
+  current = node;
+  r = nodes[node].get(param);
+  current = -1;
+  return r;
+}
+
+
+void simCbr ( int node, uint8_t active, uint32_t period, uint8_t length, uint8_t ack, uint16_t destAddress ) {
+
+  current = node;
+  nodes[node].cbr(active, period, length, ack, destAddress);
+  current = -1;
+}
+
+
+void simMacCounters ( int node, struct simMacCounters_t* counters ) {
+
+  current = node;
+  nodes[node].macCounters(counters);
+  current = -1;
+}
+
+
+void simRouteCounters ( int node, struct simRouteCounters_t* counters ) {
+
+  current = node;
+  nodes[node].routeCounters(counters);
+  current = -1;
+}
+
+
+void simChanCounters ( int node, struct simChanCounters_t* counters ) {
+
+  current = node;
+  nodes[node].chanCounters(counters);
+  current = -1;
+}
+
+
+uint16_t simTrace ( int node, struct simTraceEvent_t* events, uint16_t maxCount ) {
+
+  uint16_t count;
+
+  current = node;
+  count = nodes[node].trace(events, maxCount);
+  current = -1;
+  return count;
+}
+
+
+uint8_t simGlobalTime ( int node, uint32_t* globalTime ) {
+
+  uint8_t synchronized;
+
+  current = node;
+  synchronized = nodes[node].globalTime(simNodeClock(node, now), globalTime);
+  current = -1;
+  return synchronized;
+}
+
+
+uint32_t simNodeClock ( int node, uint64_t time ) {
+
+  // Delays and timer periods are not skewed: a few ppm of them don't matter
+  return nodes[node].clockOffset + (uint32_t)( time + (int64_t)( time * nodes[node].clockSkew ) );
+}
+
+
+void simSetDeliverCallback ( simDeliverCallback_t callback ) {
+
+  deliverCallback = callback;
+}
+
+
+uint64_t simNow ( void ) {
+
+  return now;
+}
+
+
+void simStep ( void ) {
+
+  updateMedium();
+
+  for ( size_t i=0; i<nodes.size(); i++ ) {
+    current = i;
+    // Timer interrupts run even if the node is blocked
+    while ( nodes[i].isr != NULL && nodes[i].isrNext <= now ) {
+      uint64_t busyUntil = nodes[i].busyUntil;
+      nodes[i].busyUntil = nodes[i].isrNext;
+      nodes[i].isr();
+      nodes[i].busyUntil = busyUntil;
+      nodes[i].isrNext += nodes[i].isrPeriod;
+    }
+    if ( nodes[i].busyUntil <= now ) nodes[i].loop();
+    updateTx(i);
+  }
+  current = -1;
+
+  now += config.tick;
+}
+
+
+const struct simRadioStats_t* simRadioStats ( int node ) {
+
+  // Count the receiver on time up to now
+  struct simRadio_t *radio = &nodes[node].radio;
+
+  if ( radio->mode == SIM_MODE_RX ) {
+    radio->stats.rxOnTime += now - radio->modeSince;
+    radio->modeSince = now;
+  }
+  return &radio->stats;
+}
+
+
+double simUniform ( void ) {
+
+  return std::uniform_real_distribution<double>(0.0, 1.0)(rng);
+}
+
+
+// Node side API (sim.h)
+
+uint32_t simMicros ( void ) {
+
+  if ( current < 0 ) return now;
+  return simNodeClock(current, nodeNow(current));
+}
+
+
+void simDelayMicroseconds ( uint32_t us ) {
+
+  nodes[current].busyUntil = nodeNow(current) + us;
+  updateTx(current);
+}
+
+
+uint16_t simAnalogRead ( void ) {
+
+  return rng() & 0x3FF;
+}
+
+
+void simLog ( const char* line ) {
+
+  if ( config.verbose )
+    printf("%10lu node %d: %s\n", (unsigned long)simMicros(), current, line);
+}
+
+
+void simTimerBegin ( void (*isr)(void), uint32_t period ) {
+
+  nodes[current].isr = isr;
+  nodes[current].isrPeriod = period;
+  nodes[current].isrNext = nodeNow(current) + period;
+}
+
+
+void simTimerEnd ( void ) {
+
+  nodes[current].isr = NULL;
+}
+
+
+void simDeliver ( uint16_t sourceAddress, const uint8_t* payload, uint16_t length, uint8_t rssi, uint32_t timestamp, uint32_t txTimestamp ) {
+
+  if ( deliverCallback != NULL )
+    deliverCallback(current, sourceAddress, payload, length, rssi, timestamp, txTimestamp);
+}
+
+
+void simRadioSetModemConfig ( int c ) {
+
+  nodes[current].radio.config = c;
+}
+
+
+void simRadioSetFrequency ( float centre ) {
+
+  struct simRadio_t *radio = &nodes[current].radio;
+
+  // The packets already on air on the new channel were not heard from their beginning
+  if ( radio->frequency != centre && radio->mode == SIM_MODE_RX ) {
+    radio->stats.rxOnTime += nodeNow(current) - radio->modeSince;
+    radio->modeSince = nodeNow(current);
+  }
+  radio->frequency = centre;
+}
+
+
+void simRadioSetTxPower ( uint8_t power ) {
+
+  nodes[current].radio.txPower = power & 0x07;
+}
+
+
+void simRadioSetMode ( int mode ) {
+
+  updateTx(current);
+  setMode(current, mode);
+}
+
+
+int simRadioMode ( void ) {
+
+  updateTx(current);
+  return nodes[current].radio.mode;
+}
+
+
+uint8_t simRadioAvailable ( void ) {
+
+  struct simRadio_t *radio = &nodes[current].radio;
+
+  updateTx(current);
+  if ( !radio->rxBufValid ) {
+    if ( radio->mode == SIM_MODE_TX ) return false;
+    setMode(current, SIM_MODE_RX);
+  }
+  return radio->rxBufValid;
+}
+
+
+uint8_t simRadioRecv ( uint8_t* buf, uint8_t* len ) {
+
+  struct simRadio_t *radio = &nodes[current].radio;
+
+  if ( !simRadioAvailable() ) return false;
+  if ( *len > radio->rxLength ) *len = radio->rxLength;
+  memcpy(buf, radio->rxBuf, *len);
+  radio->rxBufValid = false;
+  return true;
+}
+
+
+uint8_t simRadioSend ( const uint8_t* data, uint8_t len ) {
+
+  struct simRadio_t *radio = &nodes[current].radio;
+  simTransmission_t t;
+
+  // RadioHead waits for the previous packet first
+  simRadioWaitPacketSent();
+
+  memset(&t, 0, sizeof(t));
+  t.source = current;
+  t.start = nodeNow(current) + SIM_TX_STARTUP;
+  t.end = t.start + (uint64_t)((len + SIM_RF22_PACKET_OVERHEAD) * 8 * 1e6 / configBitRate(radio->config));
+  t.frequency = radio->frequency;
+  t.config = radio->config;
+  t.power = txPowerDbm[radio->txPower];
+  t.length = len;
+  memcpy(t.data, data, len);
+  transmissions.push_back(t);
+
+  setMode(current, SIM_MODE_TX);
+  radio->txEnd = t.end;
+  radio->stats.txPackets++;
+  radio->stats.txTime += t.end - nodeNow(current);
+  return true;
+}
+
+
+void simRadioWaitPacketSent ( void ) {
+
+  struct simRadio_t *radio = &nodes[current].radio;
+
+  if ( radio->mode == SIM_MODE_TX && radio->txEnd > nodeNow(current) )
+    nodes[current].busyUntil = radio->txEnd;
+  updateTx(current);
+}
+
+
+uint8_t simRadioRssiRead ( void ) {
+
+  // Energy on the channel now: noise, jammer and every transmission on air at this node
+  double power = pow(10.0, config.noiseFloor/10.0);
+  uint64_t t = nodeNow(current);
+
+  if ( nodes[current].radio.frequency == config.jamFrequency ) power += pow(10.0, config.jamPower/10.0);
+
+  for ( size_t i=0; i<transmissions.size(); i++ ) {
+    simTransmission_t& u = transmissions[i];
+    uint64_t p = propagation(u.source, current);
+    if ( u.source == current || u.frequency != nodes[current].radio.frequency ) continue;
+    if ( t < u.start + p || t >= u.end + p ) continue;
+    power += pow(10.0, receivedPower(u, current)/10.0);
+  }
+  return dbmToRssi(10.0*log10(power));
+}
+
+
+uint8_t simRadioLastRssi ( void ) {
+
+  return nodes[current].radio.lastRssi;
+}
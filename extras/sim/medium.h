@@ -0,0 +1,67 @@
+/**
+ * @file medium.h
+ * @brief Host simulation: virtual clock, nodes and shared radio medium (simulator side)
+ */
+
+#ifndef MEDIUM_H
+#define MEDIUM_H
+
+#include <stdint.h>
+
+#include "sim.h"
+
+struct simConfig_t {
+
+  uint32_t tick; /**< @brief Period of the nodes loop() in us.*/
+  double pathLossAt1m; /**< @brief Path loss at 1m in dB.*/
+  double pathLossExponent; /**< @brief Log-distance path loss exponent.*/
+  double noiseFloor; /**< @brief Noise floor in dBm, in the bandwidth of the 125kbps modem configuration. Slower ones receive less noise.*/
+  double captureThreshold; /**< @brief Minimum SINR in dB to decode a packet.*/
+  double loss; /**< @brief Probability to lose a packet that could be decoded.*/
+  uint32_t seed; /**< @brief Seed of the simulator random generator.*/
+  int verbose; /**< @brief Print the nodes Serial output.*/
+  double clockDrift; /**< @brief Largest clock skew of a node in ppm: each node gets a random skew and a random clock at boot. 0: the nodes share the simulator clock.*/
+  float jamFrequency; /**< @brief Frequency of a continuous jammer in MHz, as set by the radios (float). 0: no jammer.*/
+  double jamPower; /**< @brief Jammer power received by every node, in dBm.*/
+
+}; // simConfig_t
+
+struct simRadioStats_t {
+
+  uint32_t txPackets;
+  uint64_t txTime; /**< @brief Time spent transmitting, in us.*/
+  uint64_t rxOnTime; /**< @brief Time spent with the receiver on, in us.*/
+  uint32_t rxPackets; /**< @brief Packets given to the driver.*/
+  uint32_t collisions; /**< @brief Packets lost because of interference.*/
+  uint32_t weakSignals; /**< @brief Packets below sensitivity.*/
+  uint32_t randomLosses; /**< @brief Packets dropped by the configured loss probability.*/
+  uint32_t notListening; /**< @brief Packets missed because the receiver was not in RX during the whole packet.*/
+
+}; // simRadioStats_t
+
+// Called when a node application receives a payload
+typedef void (*simDeliverCallback_t) ( int node, uint16_t sourceAddress, const uint8_t* payload, uint16_t length, uint8_t rssi, uint32_t timestamp, uint32_t txTimestamp );
+
+void simInit ( const struct simConfig_t* config );
+int simAddNode ( const char* library, double x, double y );
+void simRemoveNodes ( void );
+int simNodeCount ( void );
+void simSetupNode ( int node, uint16_t address, uint16_t panId, uint8_t channel, uint8_t txPower );
+int simSend ( int node, uint16_t destAddress, uint8_t* payload, uint8_t len );
+int simSendMessage ( int node, uint16_t destAddress, uint8_t* data, uint16_t len );
+int simSet ( int node, uint8_t param, uint16_t value );
+uint16_t simGet ( int node, uint8_t param );
+void simCbr ( int node, uint8_t active, uint32_t period, uint8_t length, uint8_t ack, uint16_t destAddress );
+void simMacCounters ( int node, struct simMacCounters_t* counters );
+void simRouteCounters ( int node, struct simRouteCounters_t* counters );
+void simChanCounters ( int node, struct simChanCounters_t* counters );
+uint16_t simTrace ( int node, struct simTraceEvent_t* events, uint16_t maxCount );
+uint8_t simGlobalTime ( int node, uint32_t* globalTime );
+uint32_t simNodeClock ( int node, uint64_t time );
+void simSetDeliverCallback ( simDeliverCallback_t callback );
+uint64_t simNow ( void );
+void simStep ( void );
+const struct simRadioStats_t* simRadioStats ( int node );
+double simUniform ( void );
+
+#endif
@@ -0,0 +1,289 @@
+/**
+ * @file node.cpp
+ * @brief Host simulation: one WiNo node. Built as a shared library that wino-sim loads once per node,
+ * so that every node has its own copy of the SimpleWiNo globals
+ */
+
+#include <stdio.h>
+#include <stdarg.h>
+
+#include "Arduino.h"
+#include "sim.h"
+
+// MAC CBR generator parameters, set at run time by simNodeCbr (the Makefile maps the MAC_CBR_* macros on them)
+static uint8_t simCbrActive;
+static uint32_t simCbrPeriod;
+static uint8_t simCbrLength;
+static uint8_t simCbrAck;
+static uint16_t simCbrDestination;
+
+#include "../../SimpleWiNo.cpp"
+
+SerialClass Serial;
+SPIClass SPI;
+
+static SimpleWiNo wino;
+static uint8_t simMessage[FRAG_MESSAGE_MAX_LENGTH]; // Lent to sendMessage until it is sent
+static uint8_t simReceivedMessage[FRAG_MESSAGE_MAX_LENGTH];
+static uint32_t randomState = 1;
+static char serialLine[256];
+static size_t serialLineLength;
+
+
+// Arduino API
+
+uint32_t micros ( void ) {
+
+  return simMicros();
+}
+
+
+uint32_t millis ( void ) {
+
+  return simMicros() / 1000;
+}
+
+
+void delay ( uint32_t ms ) {
+
+  simDelayMicroseconds(ms*1000);
+}
+
+
+void delayMicroseconds ( uint32_t us ) {
+
+  simDelayMicroseconds(us);
+}
+
+
+long random ( long howbig ) {
+
+  // xorshift32, one state per node
+  randomState ^= randomState << 13;
+  randomState ^= randomState >> 17;
+  randomState ^= randomState << 5;
+  if ( howbig <= 0 ) return 0;
+  return randomState % howbig;
+}
+
+
+long random ( long howsmall, long howbig ) {
+
+  if ( howsmall >= howbig ) return howsmall;
+  return howsmall + random(howbig - howsmall);
+}
+
+
+void randomSeed ( unsigned long seed ) {
+
+  randomState = seed ? seed : 1;
+}
+
+
+int analogRead ( uint8_t pin ) {
+
+  (void)pin;
+  return simAnalogRead();
+}
+
+
+void analogWrite ( uint8_t pin, int value ) { (void)pin; (void)value; }
+void pinMode ( uint8_t pin, uint8_t mode ) { (void)pin; (void)mode; }
+void digitalWrite ( uint8_t pin, uint8_t value ) { (void)pin; (void)value; }
+void noInterrupts ( void ) {}
+void interrupts ( void ) {}
+
+
+bool IntervalTimer::begin ( void (*isr)(void), uint32_t period ) {
+
+  simTimerBegin(isr, period);
+  return true;
+}
+
+
+void IntervalTimer::end ( void ) {
+
+  simTimerEnd();
+}
+
+
+static void serialWrite ( const char* str ) {
+
+  // Line buffered: the simulator prefixes each line with the time and the node
+  for ( ; *str; str++ ) {
+    if ( *str == '\n' || serialLineLength == sizeof(serialLine)-1 ) {
+      serialLine[serialLineLength] = 0;
+      simLog(serialLine);
+      serialLineLength = 0;
+      if ( *str == '\n' ) continue;
+    }
+    serialLine[serialLineLength++] = *str;
+  }
+}
+
+
+int SerialClass::printf ( const char* format, ... ) {
+
+  char buf[256];
+  va_list ap;
+  int n;
+
+  va_start(ap, format);
+  n = vsnprintf(buf, sizeof(buf), format, ap);
+  va_end(ap);
+  serialWrite(buf);
+  return n;
+}
+
+
+void SerialClass::print ( const char* str ) {
+
+  serialWrite(str);
+}
+
+
+void SerialClass::print ( long value, int base ) {
+
+  printf(base == HEX ? "%lX" : "%ld", value);
+}
+
+
+void SerialClass::println ( const char* str ) {
+
+  serialWrite(str);
+  serialWrite("\n");
+}
+
+
+void SerialClass::println ( long value, int base ) {
+
+  print(value, base);
+  serialWrite("\n");
+}
+
+
+// Node API used by wino-sim
+
+SIM_EXPORT void simNodeSetup ( uint16_t address, uint16_t panId, uint8_t channel, uint8_t txPower ) {
+
+  wino.init();
+  wino.set(NODE_SHORT_ADDRESS, address);
+  wino.set(NODE_PANID, panId);
+  wino.set(NODE_TXPOWER, txPower);
+  wino.set(NODE_CHANNEL, channel);
+}
+
+
+SIM_EXPORT void simNodeLoop ( void ) {
+
+  struct rxView_t view;
+  uint16_t sourceAddress, length;
+
+  // The sketch loop(): run the engines and consume everything received
+  wino.process();
+  while ( wino.recvMessage(&sourceAddress, simReceivedMessage, &length) )
+    simDeliver(sourceAddress, simReceivedMessage, length, 0, micros(), micros());
+  while ( wino.recvView(&view) ) {
+#ifdef PHY_TIMESTAMPS_AT_TX
+    simDeliver(view.sourceAddress, view.payload, view.length, view.rssi, view.timestamp, view.txTimestamp);
+#else
+    simDeliver(view.sourceAddress, view.payload, view.length, view.rssi, view.timestamp, view.timestamp);
+#endif
+    wino.release();
+  }
+}
+
+
+SIM_EXPORT int simNodeSend ( uint16_t destAddress, uint8_t* payload, uint8_t len ) {
+
+  return wino.send(destAddress, payload, len);
+}
+
+
+SIM_EXPORT int simNodeSendMessage ( uint16_t destAddress, uint8_t* data, uint16_t len ) {
+
+  if ( wino.messageStatus(fragTxMessageId) == SEND_PENDING || len > sizeof(simMessage) ) return -1;
+  memcpy(simMessage, data, len);
+  return wino.sendMessage(destAddress, simMessage, len);
+}
+
+
+SIM_EXPORT int simNodeSet ( uint8_t param, uint16_t value ) {
+
+  return wino.set(param, value);
+}
+
+
+SIM_EXPORT uint16_t simNodeGet ( uint8_t param ) {
+
+  return wino.get(param);
+}
+
+
+SIM_EXPORT void simNodeCbr ( uint8_t active, uint32_t period, uint8_t length, uint8_t ack, uint16_t destAddress ) {
+
+  simCbrActive = active;
+  simCbrPeriod = period;
+  simCbrLength = length;
+  simCbrAck = ack;
+  simCbrDestination = destAddress;
+  // Nodes don't boot together: random phase
+  macCbrNextTimeToSend = micros() + random(period);
+}
+
+
+SIM_EXPORT void simNodeMacCounters ( struct simMacCounters_t* counters ) {
+
+  struct winoStats_t stats;
+
+  wino.stats(&stats);
+  counters->cbrGenerated = stats.mac.cbrGenerated;
+  counters->cbrRejected = stats.mac.cbrRejected;
+  counters->confirmSuccess = stats.mac.confirmSuccess;
+  counters->confirmNoAck = stats.mac.confirmNoAck;
+  counters->confirmChannelAccessFailure = stats.mac.confirmChannelAccessFailure;
+}
+
+
+SIM_EXPORT void simNodeRouteCounters ( struct simRouteCounters_t* counters ) {
+
+  struct winoStats_t stats;
+
+  wino.stats(&stats);
+  counters->forwarded = stats.route.forwarded;
+  counters->forwardFailures = stats.route.forwardFailures;
+  counters->queued = stats.route.queued;
+  counters->queueFull = stats.route.queueFull;
+  counters->queueOccupancyTotal = stats.route.queueOccupancyTotal;
+  counters->queueMax = stats.route.queueMax;
+  counters->hopLatencyTotal = stats.route.hopLatencyTotal;
+  counters->hopLatencyMax = stats.route.hopLatencyMax;
+  counters->noRoute = stats.route.noRoute;
+}
+
+
+SIM_EXPORT void simNodeChanCounters ( struct simChanCounters_t* counters ) {
+
+  struct winoStats_t stats;
+
+  wino.stats(&stats);
+  counters->scanSamples = stats.chan.scanSamples;
+  counters->hops = stats.chan.hops;
+  counters->deferrals = stats.chan.deferrals;
+  counters->mapChanges = stats.chan.mapChanges;
+}
+
+
+SIM_EXPORT uint16_t simNodeTrace ( struct simTraceEvent_t* events, uint16_t maxCount ) {
+
+  static_assert(sizeof(struct simTraceEvent_t) == sizeof(struct macTraceEvent_t), "trace event layouts differ");
+  return wino.trace((struct macTraceEvent_t*)events, maxCount);
+}
+
+
+SIM_EXPORT uint8_t simNodeGlobalTime ( uint32_t localTime, uint32_t* globalTime ) {
+
+  // globalMicros() at localTime: the node may be blocked, its micros() ahead of the simulator
+  *globalTime = syncGlobalTime(localTime);
+  return wino.get(SYNC_ROOT) != SYNC_ROOT_NONE;
+}
@@ -0,0 +1,102 @@
+/**
+ * @file sim.h
+ * @brief Host simulation of WiNo nodes: interface between the simulator (wino-sim) and the node library
+ */
+
+#ifndef SIM_H
+#define SIM_H
+
+#include <stdint.h>
+
+#define SIM_EXPORT extern "C" __attribute__((visibility("default")))
+
+// Radio modes, same values as RHGenericDriver::RHMode
+#define SIM_MODE_INITIALISING 0
+#define SIM_MODE_SLEEP 1
+#define SIM_MODE_IDLE 2
+#define SIM_MODE_TX 3
+#define SIM_MODE_RX 4
+
+// Provided by the simulator to the node library. A node only sees its own radio and clock:
+// the simulator knows which node is running
+extern "C" {
+
+  uint32_t simMicros ( void );
+  void simDelayMicroseconds ( uint32_t us );
+  uint16_t simAnalogRead ( void );
+  void simLog ( const char* line );
+  void simTimerBegin ( void (*isr)(void), uint32_t period );
+  void simTimerEnd ( void );
+  void simDeliver ( uint16_t sourceAddress, const uint8_t* payload, uint16_t length, uint8_t rssi, uint32_t timestamp, uint32_t txTimestamp );
+
+  void simRadioSetModemConfig ( int config );
+  void simRadioSetFrequency ( float centre );
+  void simRadioSetTxPower ( uint8_t power );
+  void simRadioSetMode ( int mode );
+  int simRadioMode ( void );
+  uint8_t simRadioAvailable ( void );
+  uint8_t simRadioRecv ( uint8_t* buf, uint8_t* len );
+  uint8_t simRadioSend ( const uint8_t* data, uint8_t len );
+  void simRadioWaitPacketSent ( void );
+  uint8_t simRadioRssiRead ( void );
+  uint8_t simRadioLastRssi ( void );
+}
+
+struct simMacCounters_t {
+
+  uint32_t cbrGenerated;
+  uint32_t cbrRejected;
+  uint32_t confirmSuccess;
+  uint32_t confirmNoAck;
+  uint32_t confirmChannelAccessFailure;
+
+}; // simMacCounters_t
+
+struct simRouteCounters_t {
+
+  uint32_t forwarded;
+  uint32_t forwardFailures;
+  uint32_t queued;
+  uint32_t queueFull;
+  uint32_t queueOccupancyTotal;
+  uint32_t queueMax;
+  uint32_t hopLatencyTotal;
+  uint32_t hopLatencyMax;
+  uint32_t noRoute;
+
+}; // simRouteCounters_t
+
+struct simChanCounters_t {
+
+  uint32_t scanSamples;
+  uint32_t hops;
+  uint32_t deferrals;
+  uint32_t mapChanges;
+
+}; // simChanCounters_t
+
+// Same layout as macTraceEvent_t
+struct simTraceEvent_t {
+
+  uint32_t timestamp;
+  uint8_t event;
+  uint8_t value;
+  uint16_t arg;
+
+}; // simTraceEvent_t
+
+// Exported by the node library (node.cpp), resolved with dlsym by the simulator
+typedef void (*simNodeSetup_t) ( uint16_t address, uint16_t panId, uint8_t channel, uint8_t txPower );
+typedef void (*simNodeLoop_t) ( void );
+typedef int (*simNodeSend_t) ( uint16_t destAddress, uint8_t* payload, uint8_t len );
+typedef int (*simNodeSendMessage_t) ( uint16_t destAddress, uint8_t* data, uint16_t len );
+typedef int (*simNodeSet_t) ( uint8_t param, uint16_t value );
+typedef uint16_t (*simNodeGet_t) ( uint8_t param );
+typedef void (*simNodeCbr_t) ( uint8_t active, uint32_t period, uint8_t length, uint8_t ack, uint16_t destAddress );
+typedef void (*simNodeMacCounters_t) ( struct simMacCounters_t* counters );
+typedef void (*simNodeRouteCounters_t) ( struct simRouteCounters_t* counters );
+typedef void (*simNodeChanCounters_t) ( struct simChanCounters_t* counters );
+typedef uint16_t (*simNodeTrace_t) ( struct simTraceEvent_t* events, uint16_t maxCount );
+typedef uint8_t (*simNodeGlobalTime_t) ( uint32_t localTime, uint32_t* globalTime );
+
+#endif
@@ -0,0 +1,428 @@
+/**
+ * @file wino-sim.cpp
+ * @brief Host simulation: run a WiNo network on a virtual radio medium
+ *
+ * Every node but the sink sends a payload to the sink (or to everybody) every period. By default the
+ * simulator generates the payloads and gives them to SimpleWiNo::send(). With --cbr, the library MAC CBR
+ * generator (macSendCbrFrame) is used instead. The payload begins with its generation time, so that the
+ * delivery ratio and the end-to-end latency are measured by the simulator. With --message, the payloads are
+ * messages given to SimpleWiNo::sendMessage() (fragmentation layer), dropped while the previous one is sent.
+ * With --mesh, the payloads go to the sink through the collection tree of the routing layer. With --jam, a
+ * jammer sits on one channel, and --hopping spreads the exchanges of the nodes over the others.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include <algorithm>
+#include <set>
+#include <vector>
+
+#include "medium.h"
+#include "../../SimpleWiNo.h"
+
+#define SIM_PANID 0xCAFE
+#define SIM_SINK_ADDRESS 1
+#define SIM_PAYLOAD_HEADER_LENGTH 4 // generation time
+#define SIM_MESSAGE_MAX_LENGTH 4096
+#define SIM_FRAME_PAYLOAD_MAX_LENGTH ( MAX_FRAME_LENGTH - 9 ) // MAC_DATA_FRAME_HEADER_LENGTH (kernel/mac.h): larger payloads need --message
+#define SIM_SYNC_SAMPLE_PERIOD 100000 // us between two samples of the global time of the nodes (--sync)
+#define SIM_CHANNEL 10 // NODE_CHANNEL of all the nodes
+#define SIM_JAM_POWER -50.0 // dBm received by every node from the jammer (--jam): over the CCA threshold
+
+struct trafficStats_t {
+
+  uint32_t generated;
+  uint32_t rejected;
+  uint32_t delivered;
+  uint32_t duplicates;
+  uint32_t corrupted; // messages whose content differs from the one sent
+  std::vector<uint32_t> latencies;
+  std::vector<uint32_t> airLatencies;
+  std::set<uint64_t> received;
+  std::vector<uint32_t> syncErrors; // us, global time of a node minus the one of the sink
+  uint32_t unsynchronized; // samples of nodes without the global time
+
+};
+
+static struct trafficStats_t traffic;
+static int messages;
+
+
+// Same byte order as the library encodeUint32
+static void encodeUint32 ( uint32_t from, uint8_t* to ) { to[0] = from >> 24; to[1] = from >> 16; to[2] = from >> 8; to[3] = from; }
+static uint32_t decodeUint32 ( const uint8_t* data ) { return ( (uint32_t)data[0] << 24 ) | ( data[1] << 16 ) | ( data[2] << 8 ) | data[3]; }
+
+
+static void onDeliver ( int node, uint16_t sourceAddress, const uint8_t* payload, uint16_t length, uint8_t rssi, uint32_t timestamp, uint32_t txTimestamp ) {
+
+  uint32_t generated;
+
+  (void)rssi;
+  if ( length < SIM_PAYLOAD_HEADER_LENGTH ) return;
+  generated = decodeUint32(&payload[0]);
+
+  // A source never generates two payloads at the same time
+  if ( !traffic.received.insert(((uint64_t)sourceAddress << 32) | generated).second ) {
+    traffic.duplicates++;
+    return;
+  }
+  // Messages are filled with a pattern that depends on their generation time
+  if ( messages ) {
+    for ( uint16_t k=SIM_PAYLOAD_HEADER_LENGTH; k<length; k++ ) {
+      if ( payload[k] != (uint8_t)( generated + k ) ) {
+        traffic.corrupted++;
+        return;
+      }
+    }
+  }
+  traffic.delivered++;
+  // Clocks of the nodes (--drift): generated is the simulator time
+  traffic.latencies.push_back(timestamp - simNodeClock(node, generated));
+  traffic.airLatencies.push_back(timestamp - txTimestamp - ( simNodeClock(node, simNow()) - simNodeClock(sourceAddress-SIM_SINK_ADDRESS, simNow()) ));
+}
+
+
+static double mean ( const std::vector<uint32_t>& values ) {
+
+  double sum = 0;
+
+  for ( size_t i=0; i<values.size(); i++ ) sum += values[i];
+  return values.empty() ? 0 : sum / values.size();
+}
+
+
+static uint32_t percentile ( std::vector<uint32_t> values, int p ) {
+
+  if ( values.empty() ) return 0;
+  std::sort(values.begin(), values.end());
+  return values[(values.size()-1)*p/100];
+}
+
+
+static void printTrace ( int node ) {
+
+  // Names of the MAC_TRACE_* events and of the MAC_CSMA_CA_*_STATE states (kernel/mac.h)
+  static const char* eventNames[] = { "?", "STATE", "BACKOFF", "CCA", "TX_START", "TX_END", "ACK_RX", "ACK_TX", "RX", "CONFIRM", "BACK_RX" };
+  static const char* stateNames[] = { "?", "BEGIN_OF_PERIOD", "NEW_FRAME", "INIT_CSMA_CA_VALUES", "SET_RANDOM_BACKOFF_DELAY",
+                                      "WAIT_BACKOFF_DELAY", "PERFORM_CCA", "TX_FRAME", "WAIT_ACK", "WAIT_INTERFRAME", "WAIT_TX_DONE" };
+  struct simTraceEvent_t events[1024];
+  uint16_t count, i;
+
+  count = simTrace(node, events, sizeof(events)/sizeof(events[0]));
+  printf("node %d MAC trace, last %u events\n", node, count);
+  for ( i=0; i<count; i++ ) {
+    const struct simTraceEvent_t *e = &events[i];
+    uint32_t delta = i ? e->timestamp - events[i-1].timestamp : 0;
+    const char* eventName = e->event < sizeof(eventNames)/sizeof(eventNames[0]) ? eventNames[e->event] : "?";
+    if ( e->event == 1 && e->value < sizeof(stateNames)/sizeof(stateNames[0]) && e->arg < sizeof(stateNames)/sizeof(stateNames[0]) )
+      printf("%10u +%6u %-8s %s <- %s\n", e->timestamp, delta, eventName, stateNames[e->value], stateNames[e->arg]);
+    else
+      printf("%10u +%6u %-8s %3u %5u\n", e->timestamp, delta, eventName, e->value, e->arg);
+  }
+}
+
+
+static void usage ( const char* name ) {
+
+  printf("Usage: %s [options]\n"
+         "  -l, --library PATH    node library (default ./libwinonode.so)\n"
+         "  -n, --nodes N         number of nodes, node 0 is the sink (default 10)\n"
+         "  -d, --duration S      simulated time in seconds (default 10)\n"
+         "  -p, --period US       payload generation period per node in us, 0 for none (default 100000)\n"
+         "  -s, --size BYTES      payload size, up to 55 bytes without --message (default 16)\n"
+         "  -m, --message         send the payloads with sendMessage(), up to 1024 bytes (fragmentation layer)\n"
+         "  -b, --broadcast       send to the broadcast address instead of the sink\n"
+         "  -c, --cbr             use the library MAC CBR generator\n"
+         "  -A, --no-ack          CBR frames without ACK request\n"
+         "  -C, --adaptive-csma   enable the adaptive CSMA/CA (MAC_ADAPTIVE_CSMA)\n"
+         "  -B, --block-ack       send the unicast frames by windows ACKed by a block ACK (MAC_BLOCK_ACK)\n"
+         "  -P, --profile N       modem profile of the network, 0 (125kbps, default) to 3 (4.8kbps) (PHY_MODEM_PROFILE)\n"
+         "  -R, --rate-adaptation send the data frames of good links with a faster profile (MAC_RATE_ADAPTATION)\n"
+         "  -S, --beacon MS       the sink is a coordinator sending a beacon every MS ms (MAC_BEACON_INTERVAL)\n"
+         "  -G, --gts N           the other nodes ask the sink for a GTS of N slots (MAC_GTS_REQUEST, with --beacon)\n"
+         "  -W, --lpl MS          the radios sleep and sample the channel every MS ms (MAC_LPL_INTERVAL)\n"
+         "  -Y, --sync MS         synchronize the clocks, a sync frame every MS ms (SYNC_INTERVAL, needs PHY_TIMESTAMPS_AT_TX)\n"
+         "  -D, --drift PPM       nodes have their own clock, with a random skew up to PPM (default 0: one clock)\n"
+         "  -M, --mesh MS         route the payloads over several hops, the sink is the root of the tree, a tree beacon every MS ms (ROUTE_INTERVAL)\n"
+         "  -J, --jam CH          a jammer on channel CH, the nodes are on channel 10 (default none)\n"
+         "  -E, --scan MS         sample the energy of a channel every MS ms, each in turn (CHANNEL_SCAN_INTERVAL)\n"
+         "  -H, --hopping MS      hop over the channels not busy, MS ms per slot (CHANNEL_HOPPING, with --sync)\n"
+         "  -g, --aggregation US  aggregate the payloads queued within US us (MAC_AGGREGATION_HOLD, default 0: off)\n"
+         "  -a, --area M          nodes are placed in a square of side M meters (default 20)\n"
+         "  -e, --exponent X      path loss exponent (default 3.0)\n"
+         "  -L, --loss P          random packet loss probability (default 0)\n"
+         "  -t, --tick US         loop() period in us (default 20)\n"
+         "  -r, --seed N          random seed (default 1)\n"
+         "  -j, --json LABEL      print the results as one JSON object, tagged with LABEL\n"
+         "  -T, --trace NODE      print the last MAC trace events of NODE at the end\n"
+         "  -v, --verbose         print the nodes Serial output\n", name);
+}
+
+
+int main ( int argc, char** argv ) {
+
+  const char* library = "./libwinonode.so";
+  const char* json = NULL;
+  int traceNode = -1;
+  int nodeCount = 10;
+  double duration = 10;
+  uint32_t period = 100000;
+  int size = 16;
+  int broadcast = 0;
+  int cbr = 0;
+  int ack = 1;
+  int adaptiveCsma = 0;
+  uint16_t aggregationHold = 0;
+  int blockAck = 0;
+  int profile = 0;
+  int rateAdaptation = 0;
+  int beaconInterval = 0;
+  int gtsSlots = 0;
+  int lplInterval = 0;
+  int syncInterval = 0;
+  int routeInterval = 0;
+  int jamChannel = -1;
+  int scanInterval = 0;
+  int hopping = 0;
+  double area = 20;
+  struct simConfig_t config = { 20, 25.0, 3.0, -110.0, 8.0, 0.0, 1, 0, 0.0, 0.0f, SIM_JAM_POWER };
+  struct simMacCounters_t mac = { 0, 0, 0, 0, 0 };
+  struct simRouteCounters_t route = { 0, 0, 0, 0, 0, 0, 0, 0, 0 };
+  struct simChanCounters_t chan = { 0, 0, 0, 0 };
+  struct simRadioStats_t radio;
+  std::vector<uint64_t> nextSend;
+  uint16_t destination;
+  uint64_t end, nextSyncSample;
+  int i, c;
+
+  static struct option options[] = {
+    { "library", required_argument, 0, 'l' }, { "nodes", required_argument, 0, 'n' },
+    { "duration", required_argument, 0, 'd' }, { "period", required_argument, 0, 'p' },
+    { "size", required_argument, 0, 's' }, { "message", no_argument, 0, 'm' }, { "broadcast", no_argument, 0, 'b' },
+    { "cbr", no_argument, 0, 'c' }, { "no-ack", no_argument, 0, 'A' },
+    { "adaptive-csma", no_argument, 0, 'C' }, { "aggregation", required_argument, 0, 'g' },
+    { "block-ack", no_argument, 0, 'B' }, { "profile", required_argument, 0, 'P' },
+    { "rate-adaptation", no_argument, 0, 'R' }, { "beacon", required_argument, 0, 'S' },
+    { "gts", required_argument, 0, 'G' }, { "lpl", required_argument, 0, 'W' },
+    { "sync", required_argument, 0, 'Y' }, { "drift", required_argument, 0, 'D' },
+    { "mesh", required_argument, 0, 'M' }, { "jam", required_argument, 0, 'J' },
+    { "scan", required_argument, 0, 'E' }, { "hopping", required_argument, 0, 'H' },
+    { "area", required_argument, 0, 'a' }, { "exponent", required_argument, 0, 'e' },
+    { "loss", required_argument, 0, 'L' }, { "tick", required_argument, 0, 't' },
+    { "seed", required_argument, 0, 'r' }, { "json", required_argument, 0, 'j' },
+    { "trace", required_argument, 0, 'T' },
+    { "verbose", no_argument, 0, 'v' }, { "help", no_argument, 0, 'h' }, { 0, 0, 0, 0 }
+  };
+
+  while ( ( c = getopt_long(argc, argv, "l:n:d:p:s:mbcACBP:RS:G:W:Y:D:M:J:E:H:g:a:e:L:t:r:j:T:vh", options, NULL) ) != -1 ) {
+    switch ( c ) {
+      case 'l': library = optarg; break;
+      case 'n': nodeCount = atoi(optarg); break;
+      case 'd': duration = atof(optarg); break;
+      case 'p': period = strtoul(optarg, NULL, 0); break;
+      case 's': size = atoi(optarg); break;
+      case 'm': messages = 1; break;
+      case 'b': broadcast = 1; break;
+      case 'c': cbr = 1; break;
+      case 'A': ack = 0; break;
+      case 'C': adaptiveCsma = 1; break;
+      case 'B': blockAck = 1; break;
+      case 'P': profile = atoi(optarg); break;
+      case 'R': rateAdaptation = 1; break;
+      case 'S': beaconInterval = atoi(optarg); break;
+      case 'G': gtsSlots = atoi(optarg); break;
+      case 'W': lplInterval = atoi(optarg); break;
+      case 'Y': syncInterval = atoi(optarg); break;
+      case 'D': config.clockDrift = atof(optarg); break;
+      case 'M': routeInterval = atoi(optarg); break;
+      case 'J': jamChannel = atoi(optarg); break;
+      case 'E': scanInterval = atoi(optarg); break;
+      case 'H': hopping = atoi(optarg); break;
+      case 'g': aggregationHold = strtoul(optarg, NULL, 0); break;
+      case 'a': area = atof(optarg); break;
+      case 'e': config.pathLossExponent = atof(optarg); break;
+      case 'L': config.loss = atof(optarg); break;
+      case 't': config.tick = strtoul(optarg, NULL, 0); break;
+      case 'r': config.seed = strtoul(optarg, NULL, 0); break;
+      case 'j': json = optarg; break;
+      case 'T': traceNode = atoi(optarg); break;
+      case 'v': config.verbose = 1; break;
+      default: usage(argv[0]); return c == 'h' ? 0 : 1;
+    }
+  }
+  if ( nodeCount < 2 || size < SIM_PAYLOAD_HEADER_LENGTH || size > ( messages ? SIM_MESSAGE_MAX_LENGTH : SIM_FRAME_PAYLOAD_MAX_LENGTH ) || config.tick == 0
+       || ( messages && ( cbr || broadcast ) ) || profile < 0 || profile > MODEM_PROFILE_4K8
+       || beaconInterval < 0 || beaconInterval > 65535 || gtsSlots < 0 || ( gtsSlots && !beaconInterval )
+       || lplInterval < 0 || lplInterval > 65535 || syncInterval < 0 || syncInterval > 65535 || config.clockDrift < 0
+       || routeInterval < 0 || routeInterval > 65535 || ( routeInterval && ( messages || cbr ) )
+       || jamChannel < -1 || jamChannel > 17 || scanInterval < 0 || scanInterval > 65535
+       || hopping < 0 || hopping > 65535 || ( hopping && !syncInterval ) ) {
+    usage(argv[0]);
+    return 1;
+  }
+  destination = broadcast ? BROADCAST_ADDRESS : SIM_SINK_ADDRESS;
+  // Same float as the frequency of the radios on the channel
+  if ( jamChannel >= 0 ) config.jamFrequency = 433.0 + jamChannel*0.1;
+
+  simInit(&config);
+  simSetDeliverCallback(onDeliver);
+
+  // Sink in the middle, other nodes uniformly placed
+  for ( i=0; i<nodeCount; i++ ) {
+    double x = i == 0 ? area/2 : simUniform()*area;
+    double y = i == 0 ? area/2 : simUniform()*area;
+    if ( simAddNode(library, x, y) < 0 ) {
+      fprintf(stderr, "cannot load %s\n", library);
+      return 1;
+    }
+    simSetupNode(i, SIM_SINK_ADDRESS+i, SIM_PANID, SIM_CHANNEL, 4);
+    if ( adaptiveCsma ) simSet(i, MAC_ADAPTIVE_CSMA, 1);
+    if ( blockAck ) simSet(i, MAC_BLOCK_ACK, 1);
+    if ( profile ) simSet(i, PHY_MODEM_PROFILE, profile);
+    if ( rateAdaptation ) simSet(i, MAC_RATE_ADAPTATION, 1);
+    if ( aggregationHold ) simSet(i, MAC_AGGREGATION_HOLD, aggregationHold);
+    if ( beaconInterval && i == 0 ) simSet(i, MAC_BEACON_INTERVAL, beaconInterval);
+    if ( gtsSlots && i != 0 ) simSet(i, MAC_GTS_REQUEST, gtsSlots);
+    if ( lplInterval ) simSet(i, MAC_LPL_INTERVAL, lplInterval);
+    if ( syncInterval && !simSet(i, SYNC_INTERVAL, syncInterval) ) {
+      fprintf(stderr, "%s is built without PHY_TIMESTAMPS_AT_TX: no --sync (see libwinonode-bench.so)\n", library);
+      return 1;
+    }
+    if ( routeInterval ) {
+      if ( i == 0 ) simSet(i, ROUTE_SINK, 1);
+      simSet(i, ROUTE_INTERVAL, routeInterval);
+    }
+    if ( scanInterval ) simSet(i, CHANNEL_SCAN_INTERVAL, scanInterval);
+    if ( hopping ) simSet(i, CHANNEL_HOPPING, hopping);
+    if ( cbr && i != 0 && period != 0 ) simCbr(i, true, period, size, ack, destination);
+    nextSend.push_back((uint64_t)(simUniform()*period));
+  }
+
+  end = (uint64_t)(duration*1e6);
+  // The synchronization is measured over the second half of the run
+  nextSyncSample = end/2;
+  while ( simNow() < end ) {
+
+    if ( syncInterval && simNow() >= nextSyncSample ) {
+      uint32_t sinkTime, nodeTime;
+      uint8_t sinkSynchronized = simGlobalTime(0, &sinkTime);
+      for ( i=1; i<nodeCount; i++ ) {
+        // A node out of reach of the root of the sink has its own root
+        if ( sinkSynchronized && simGlobalTime(i, &nodeTime) && simGet(i, SYNC_ROOT) == simGet(0, SYNC_ROOT) ) {
+          int32_t error = nodeTime - sinkTime;
+          traffic.syncErrors.push_back(error < 0 ? -error : error);
+        } else traffic.unsynchronized++;
+      }
+      nextSyncSample += SIM_SYNC_SAMPLE_PERIOD;
+    }
+
+    for ( i=1; i<nodeCount && period != 0 && !cbr; i++ ) {
+      if ( simNow() >= nextSend[i] ) {
+        uint8_t payload[SIM_MESSAGE_MAX_LENGTH];
+        memset(payload, 0, size);
+        encodeUint32(simNow(), &payload[0]);
+        if ( messages )
+          for ( int k=SIM_PAYLOAD_HEADER_LENGTH; k<size; k++ ) payload[k] = (uint8_t)( simNow() + k );
+        traffic.generated++;
+        if ( ( messages ? simSendMessage(i, destination, payload, size) : simSend(i, destination, payload, size) ) < 0 )
+          traffic.rejected++;
+        nextSend[i] += period;
+      }
+    }
+    simStep();
+  }
+
+  // Report
+  memset(&radio, 0, sizeof(radio));
+  for ( i=0; i<nodeCount; i++ ) {
+    const struct simRadioStats_t *stats = simRadioStats(i);
+    struct simMacCounters_t counters;
+    struct simRouteCounters_t routeCounters;
+    struct simChanCounters_t chanCounters;
+    radio.txPackets += stats->txPackets;
+    radio.rxPackets += stats->rxPackets;
+    radio.collisions += stats->collisions;
+    radio.txTime += stats->txTime;
+    radio.rxOnTime += stats->rxOnTime;
+    simMacCounters(i, &counters);
+    mac.cbrGenerated += counters.cbrGenerated;
+    mac.cbrRejected += counters.cbrRejected;
+    mac.confirmSuccess += counters.confirmSuccess;
+    mac.confirmNoAck += counters.confirmNoAck;
+    mac.confirmChannelAccessFailure += counters.confirmChannelAccessFailure;
+    simRouteCounters(i, &routeCounters);
+    route.forwarded += routeCounters.forwarded;
+    route.forwardFailures += routeCounters.forwardFailures;
+    route.queued += routeCounters.queued;
+    route.queueFull += routeCounters.queueFull;
+    route.queueOccupancyTotal += routeCounters.queueOccupancyTotal;
+    route.queueMax = std::max(route.queueMax, routeCounters.queueMax);
+    route.hopLatencyTotal += routeCounters.hopLatencyTotal;
+    route.hopLatencyMax = std::max(route.hopLatencyMax, routeCounters.hopLatencyMax);
+    route.noRoute += routeCounters.noRoute;
+    simChanCounters(i, &chanCounters);
+    chan.scanSamples += chanCounters.scanSamples;
+    chan.hops += chanCounters.hops;
+    chan.deferrals += chanCounters.deferrals;
+    chan.mapChanges += chanCounters.mapChanges;
+  }
+  if ( cbr ) {
+    traffic.generated = mac.cbrGenerated;
+    traffic.rejected = mac.cbrRejected;
+  }
+
+  double deliveryRatio = traffic.generated ? (double)traffic.delivered/traffic.generated : 0;
+  double goodput = traffic.delivered*(size*8.0)/duration;
+  double hopLatency = route.forwarded ? (double)route.hopLatencyTotal/route.forwarded : 0;
+  double queueOccupancy = route.queued ? (double)route.queueOccupancyTotal/route.queued : 0;
+
+  if ( json != NULL ) {
+    printf("{\"label\":\"%s\",\"nodes\":%d,\"duration\":%.1f,\"period\":%u,\"size\":%d,\"ack\":%s,\"cbr\":%s,"
+           "\"adaptive_csma\":%s,\"aggregation_hold\":%u,\"messages\":%s,\"block_ack\":%s,\"profile\":%d,\"rate_adaptation\":%s,\"beacon\":%d,\"gts\":%d,\"lpl\":%d,\"sync\":%d,\"drift\":%.1f,\"broadcast\":%s,\"seed\":%u,\"generated\":%u,\"rejected\":%u,\"delivered\":%u,\"duplicates\":%u,\"corrupted\":%u,"
+           "\"delivery_ratio\":%.4f,\"goodput_bps\":%.0f,\"latency_mean_us\":%.0f,\"latency_p99_us\":%u,"
+           "\"air_latency_mean_us\":%.0f,\"confirm_success\":%u,\"confirm_no_ack\":%u,"
+           "\"confirm_channel_access_failure\":%u,\"radio_tx\":%u,\"radio_collisions\":%u,\"channel_use\":%.4f,\"rx_on\":%.4f,"
+           "\"sync_error_mean_us\":%.1f,\"sync_error_p99_us\":%u,\"unsynchronized\":%u,\"mesh\":%d,\"forwarded\":%u,\"hop_latency_mean_us\":%.0f,"
+           "\"hop_latency_max_us\":%u,\"forward_queue_mean\":%.2f,\"forward_queue_max\":%u,\"forward_queue_full\":%u,\"no_route\":%u,\"forward_failures\":%u,"
+           "\"jam\":%d,\"scan\":%d,\"hopping\":%d,\"scan_samples\":%u,\"channel_hops\":%u,\"channel_deferrals\":%u,\"channel_map_changes\":%u}\n",
+           json, nodeCount, duration, period, size, ack ? "true" : "false", cbr ? "true" : "false",
+           adaptiveCsma ? "true" : "false", aggregationHold, messages ? "true" : "false", blockAck ? "true" : "false", profile, rateAdaptation ? "true" : "false", beaconInterval, gtsSlots, lplInterval, syncInterval, config.clockDrift, broadcast ? "true" : "false", config.seed, traffic.generated, traffic.rejected, traffic.delivered,
+           traffic.duplicates, traffic.corrupted, deliveryRatio, goodput, mean(traffic.latencies), percentile(traffic.latencies, 99),
+           mean(traffic.airLatencies), mac.confirmSuccess, mac.confirmNoAck, mac.confirmChannelAccessFailure,
+           radio.txPackets, radio.collisions, radio.txTime/1e6/duration, radio.rxOnTime/1e6/duration/nodeCount,
+           mean(traffic.syncErrors), percentile(traffic.syncErrors, 99), traffic.unsynchronized, routeInterval, route.forwarded, hopLatency,
+           route.hopLatencyMax, queueOccupancy, route.queueMax, route.queueFull, route.noRoute, route.forwardFailures,
+           jamChannel, scanInterval, hopping, chan.scanSamples, chan.hops, chan.deferrals, chan.mapChanges);
+  } else {
+    printf("nodes %d duration %.1fs period %uus size %dB%s\n", nodeCount, duration, period, size,
+           cbr ? " (MAC CBR)" : messages ? " (messages)" : "");
+    printf("generated %u rejected %u delivered %u duplicates %u corrupted %u\n",
+           traffic.generated, traffic.rejected, traffic.delivered, traffic.duplicates, traffic.corrupted);
+    if ( !broadcast )
+      printf("delivery ratio %.3f goodput %.0fbit/s\n", deliveryRatio, goodput);
+    printf("latency mean %.0fus p99 %uus\n", mean(traffic.latencies), percentile(traffic.latencies, 99));
+    printf("confirms success %u no_ack %u channel_access_failure %u\n",
+           mac.confirmSuccess, mac.confirmNoAck, mac.confirmChannelAccessFailure);
+    printf("radio tx %u rx %u collisions %u channel use %.3f\n", radio.txPackets,
+           radio.rxPackets, radio.collisions, radio.txTime/1e6/duration);
+    printf("receiver on %.3f of the time per node\n", radio.rxOnTime/1e6/duration/nodeCount);
+    if ( syncInterval )
+      printf("sync error mean %.1fus p99 %uus unsynchronized samples %u\n", mean(traffic.syncErrors),
+             percentile(traffic.syncErrors, 99), traffic.unsynchronized);
+    if ( routeInterval ) {
+      printf("forwarded %u hop latency mean %.0fus max %uus\n", route.forwarded, hopLatency, route.hopLatencyMax);
+      printf("forwarding queue mean %.2f max %u full %u no route %u failures %u\n", queueOccupancy, route.queueMax,
+             route.queueFull, route.noRoute, route.forwardFailures);
+    }
+    if ( scanInterval || hopping )
+      printf("channel hops %u deferrals %u map changes %u scan samples %u\n", chan.hops, chan.deferrals,
+             chan.mapChanges, chan.scanSamples);
+  }
+
+  if ( traceNode >= 0 && traceNode < nodeCount ) printTrace(traceNode);
+
+  simRemoveNodes();
+  return 0;
+}
@@ -0,0 +1,330 @@
+/**
+ * @file chan.c
+ * @brief Frequency agility over the PHY_CHANNELS channels: energy detection scan, channel quality table, and receiver-directed channel hopping on the global time of the synchronization layer (kernel/sync.h)
+ * @date 20261017
+ */
+
+#include "chan.h"
+
+extern uint16_t nodeShortAddress;
+
+
+void chanInit ( void ) {
+
+  chanScanInterval = 0;
+  chanHopping = 0;
+  chanHome = DEFAULT_RF22_CHANNEL;
+  chanMap = CHAN_MAP_ALL;
+  chanScanNext = 0;
+  chanMapHopping = false;
+  chanMapChannel = CHAN_NONE;
+  chanRoot = SYNC_ROOT_NONE;
+  chanRootSettled = false;
+  memset(chanTable, 0, sizeof(chanTable));
+  memset(&chanStats, 0, sizeof(chanStats));
+}
+
+
+void chanSetScanInterval ( uint16_t interval ) {
+
+  chanScanInterval = interval;
+  chanNextScan = micros();
+}
+
+
+uint8_t chanSetHopping ( uint16_t slot ) {
+
+  // No slot without the global time
+  if ( slot && ( syncInterval == 0 ) ) return false;
+  chanHopping = slot;
+  // The neighbors learn the channel of this node with its next channel map
+  chanMapHopping = false;
+  chanMapChannel = CHAN_NONE;
+  if ( slot == 0 ) phySetChannel ( chanHome );
+  return true;
+}
+
+
+void chanSetHome ( uint8_t channel ) {
+
+  chanHome = channel;
+  if ( chanHopping == 0 ) phySetChannel ( channel );
+}
+
+
+void chanEngine ( void ) {
+
+  uint16_t root;
+  uint8_t hopping, channel;
+
+  // Background scan, when the MAC is idle or in a backoff: the radio does not listen during the sample. On a jammed channel, the MAC is always in a backoff
+  if ( chanScanInterval && cmpUi32GreaterOrEqualWithRollover ( micros(), chanNextScan ) && chanRadioFree()
+       && ( ( ( macCsma_CaState == MAC_CSMA_CA_NEW_FRAME_STATE ) && !macFrameInCsma_CaEngine ) || ( macCsma_CaState == MAC_CSMA_CA_WAIT_BACKOFF_DELAY ) ) ) {
+    chanNextScan = micros() + (uint32_t)chanScanInterval * 1000;
+    chanScanChannel ( chanScanNext );
+    chanScanNext = ( chanScanNext + 1 ) % PHY_CHANNELS;
+  }
+
+  if ( chanHopping == 0 ) return;
+
+  // A new root gives a new global time: the slots of the neighbors may not match it yet
+  root = syncIsSynchronized() ? syncRootAddress : SYNC_ROOT_NONE;
+  if ( root != chanRoot ) {
+    chanRoot = root;
+    chanRootSince = micros();
+    chanRootSettled = false;
+  }
+  if ( !chanRootSettled && ( root != SYNC_ROOT_NONE ) && ( micros() - chanRootSince >= CHAN_SYNC_SETTLE * (uint32_t)syncInterval * 1000 ) )
+    chanRootSettled = true;
+
+  // The neighbors must know where this node listens before they send to it
+  hopping = chanHopsNow();
+  if ( ( hopping != chanMapHopping ) || ( !hopping && ( chanFixedChannel() != chanMapChannel ) ) ) {
+    if ( macDebug ) {
+      Serial.printf("CHAN_DEBUG %s\n", hopping ? "hopping" : "not hopping");
+    }
+    chanMapHopping = hopping;
+    chanMapChannel = chanFixedChannel();
+    chanNextMap = micros() + random( CHAN_MAP_INTERVAL / 8 );
+  }
+  if ( cmpUi32GreaterOrEqualWithRollover ( micros(), chanNextMap ) ) {
+    // Jitter: the channel maps of neighbors are broadcast without ACK, they must not collide at each interval
+    chanNextMap = micros() + CHAN_MAP_INTERVAL - CHAN_MAP_INTERVAL / 4 + random( CHAN_MAP_INTERVAL / 2 );
+    chanSendMap();
+  }
+
+  // Listening channel of the slot, once the exchange in progress is over
+  if ( !chanRadioFree() || ( macCsma_CaState == MAC_CSMA_CA_PERFORM_CCA ) || ( macCsma_CaState == MAC_CSMA_CA_TX_FRAME_STATE )
+       || ( macCsma_CaState == MAC_CSMA_CA_WAIT_TX_DONE_STATE ) || ( macCsma_CaState == MAC_CSMA_CA_WAIT_ACK_STATE ) ) return;
+  channel = chanListenChannel();
+  if ( channel != phyChannel ) {
+    phySetChannel ( channel );
+    chanStats.hops++;
+  }
+}
+
+
+uint32_t chanTxWait ( uint16_t destinationAddress ) {
+
+  uint32_t slot, remaining, elapsed, map;
+  uint8_t i, channel;
+
+  if ( chanHopping == 0 ) return 0;
+
+  map = 0;
+  channel = CHAN_NONE;
+  i = ( destinationAddress == BROADCAST_ADDRESS ) ? NEIGHB_NEIGHBOR_NOT_FOUND : neighbGetNeighborIndex ( destinationAddress );
+  if ( i != NEIGHB_NEIGHBOR_NOT_FOUND ) {
+    map = neighbors[i].channelMap;
+    channel = neighbors[i].channel;
+  }
+
+  // The destination listens on one channel: at any time
+  if ( ( map == 0 ) && ( channel != CHAN_NONE ) ) {
+    phySetChannel ( channel );
+    return 0;
+  }
+  // No global time: the frame goes on the channel of this node
+  if ( !syncIsSynchronized() ) {
+    phySetChannel ( chanFixedChannel() );
+    return 0;
+  }
+
+  slot = chanSlot ( &remaining );
+  elapsed = (uint32_t)chanHopping * 1000 - remaining;
+  if ( elapsed < CHAN_GUARD ) return CHAN_GUARD - elapsed;
+  // The nodes that do not hop listen on the channel of the broadcast slots too
+  if ( slot % CHAN_BROADCAST_PERIOD == 0 ) channel = chanFixedChannel();
+  // Broadcast, or hop sequence of the destination not known: the next broadcast slot
+  else if ( map == 0 ) channel = CHAN_NONE;
+  else channel = chanHopChannel ( map, destinationAddress, slot );
+  if ( ( channel == CHAN_NONE ) || chanBusy ( channel ) || ( remaining < 2 * CHAN_GUARD ) || !macFitExchange ( remaining - CHAN_GUARD ) ) {
+    chanStats.deferrals++;
+    return remaining + CHAN_GUARD;
+  }
+  phySetChannel ( channel );
+  return 0;
+}
+
+
+void chanIndication ( uint16_t sourceAddress, uint8_t* payload, uint8_t payloadLength ) {
+
+  uint8_t i;
+
+  if ( payloadLength < CHAN_MAP_LENGTH ) return;
+  i = neighbGetNeighborIndex ( sourceAddress );
+  if ( i == NEIGHB_NEIGHBOR_NOT_FOUND ) return;
+  neighbors[i].channelMap = ( ( (uint32_t)payload[1] << 16 ) | ( (uint32_t)payload[2] << 8 ) | payload[3] ) & CHAN_MAP_ALL;
+  neighbors[i].channel = ( payload[4] < PHY_CHANNELS ) ? payload[4] : CHAN_NONE;
+}
+
+
+uint8_t chanHopsNow ( void ) {
+
+  // Superframes and low-power listening have their own schedule on one channel
+  return chanHopping && chanRootSettled && syncIsSynchronized() && ( syncRootAddress == chanRoot )
+         && !macLplInterval && !macSuperframeActive();
+}
+
+
+uint8_t chanRadioFree ( void ) {
+
+  return !macAckPending && !phyTxBusy() && !phyRadioAsleep && ( macRateSwitchState == MAC_RATE_SWITCH_IDLE );
+}
+
+
+uint32_t chanSlot ( uint32_t* remaining ) {
+
+  uint32_t global, duration;
+
+  duration = (uint32_t)chanHopping * 1000;
+  global = syncGlobalTime ( micros() );
+  *remaining = duration - global % duration;
+  // The global time wraps every 71 minutes: its last slot is shorter
+  if ( (uint32_t)( global + *remaining ) < global ) *remaining = 0 - global;
+  return global / duration;
+}
+
+
+uint8_t chanHopChannel ( uint32_t map, uint16_t address, uint32_t slot ) {
+
+  uint8_t k, channel, i;
+
+  // The neighbors of a node listen on other channels in the same slot: their exchanges don't collide
+  k = ( slot + address ) % chanMapCount ( map );
+  channel = 0;
+  for ( i=0; i<PHY_CHANNELS; i++ ) {
+    if ( map & ( (uint32_t)1 << channel ) ) {
+      if ( k == 0 ) return channel;
+      k--;
+    }
+    channel = ( channel + CHAN_HOP_STRIDE ) % PHY_CHANNELS;
+  }
+  return chanHome;
+}
+
+
+uint8_t chanFixedChannel ( void ) {
+
+  uint8_t k, channel;
+
+  // All the nodes should find the same one: the broadcast slots of the nodes that hop are on it
+  for ( k=0; k<CHAN_RENDEZVOUS; k++ ) {
+    channel = ( chanHome + k * ( PHY_CHANNELS / CHAN_RENDEZVOUS ) ) % PHY_CHANNELS;
+    if ( !chanBusy ( channel ) ) return channel;
+  }
+  return chanHome;
+}
+
+
+uint8_t chanListenChannel ( void ) {
+
+  uint32_t slot, remaining;
+
+  if ( !chanHopsNow() ) return chanFixedChannel();
+  slot = chanSlot ( &remaining );
+  if ( slot % CHAN_BROADCAST_PERIOD == 0 ) return chanFixedChannel();
+  return chanHopChannel ( chanMap, nodeShortAddress, slot );
+}
+
+
+uint8_t chanBusy ( uint8_t channel ) {
+
+  return ( chanTable[channel].samples >= CHAN_MIN_SAMPLES ) && ( chanTable[channel].busy > CHAN_BUSY_HIGH );
+}
+
+
+uint8_t chanBestChannel ( void ) {
+
+  uint8_t best, channel;
+
+  best = chanHome;
+  for ( channel=0; channel<PHY_CHANNELS; channel++ ) {
+    if ( chanTable[channel].samples == 0 ) continue;
+    if ( ( chanTable[best].samples == 0 ) || ( chanTable[channel].busy < chanTable[best].busy )
+         || ( ( chanTable[channel].busy == chanTable[best].busy ) && ( chanTable[channel].energy < chanTable[best].energy ) ) )
+      best = channel;
+  }
+  return best;
+}
+
+
+uint8_t chanMapCount ( uint32_t map ) {
+
+  uint8_t count;
+
+  for ( count=0; map; map >>= 1 )
+    count += map & 1;
+  return count;
+}
+
+
+void chanScanChannel ( uint8_t channel ) {
+
+  uint8_t previous, energy;
+
+  previous = phyChannel;
+  phySetChannel ( channel );
+  energy = phyEdRequest();
+  phySetChannel ( previous );
+  chanEdSample ( channel, energy );
+  chanStats.scanSamples++;
+}
+
+
+void chanEdSample ( uint8_t channel, uint8_t energy ) {
+
+  struct chanQuality_t *quality = &chanTable[channel];
+
+  if ( quality->samples == 0 ) {
+    quality->energy = energy << 8;
+    quality->busy = ( energy >= macCcaThreshold ) ? 65535 : 0;
+  } else {
+    if ( ( energy << 8 ) < quality->energy ) quality->energy -= ( quality->energy - ( energy << 8 ) ) >> CHAN_QUALITY_SHIFT;
+    else quality->energy += ( ( energy << 8 ) - quality->energy ) >> CHAN_QUALITY_SHIFT;
+    if ( energy >= macCcaThreshold ) quality->busy += ( 65535 - quality->busy ) >> CHAN_QUALITY_SHIFT;
+    else quality->busy -= quality->busy >> CHAN_QUALITY_SHIFT;
+  }
+  if ( quality->samples < 0xFFFF ) quality->samples++;
+  quality->lastSample = micros();
+  chanUpdateMap();
+}
+
+
+void chanUpdateMap ( void ) {
+
+  uint32_t map;
+  uint8_t channel;
+
+  map = chanMap;
+  for ( channel=0; channel<PHY_CHANNELS; channel++ ) {
+    if ( chanTable[channel].samples < CHAN_MIN_SAMPLES ) continue;
+    if ( chanTable[channel].busy > CHAN_BUSY_HIGH ) map &= ~( (uint32_t)1 << channel );
+    else if ( chanTable[channel].busy < CHAN_BUSY_LOW ) map |= (uint32_t)1 << channel;
+  }
+  if ( ( map == chanMap ) || ( chanMapCount ( map ) < CHAN_MIN_CHANNELS ) ) return;
+
+  if ( macDebug ) {
+    Serial.printf("CHAN_DEBUG hop sequence map %05lX\n", (unsigned long)map);
+  }
+  chanMap = map;
+  chanStats.mapChanges++;
+  // The neighbors send on the old hop sequence until they get the new one
+  if ( chanHopping ) chanNextMap = micros();
+}
+
+
+void chanSendMap ( void ) {
+
+  uint8_t payload[CHAN_MAP_LENGTH];
+  uint32_t map;
+
+  map = chanMapHopping ? chanMap : 0;
+  payload[0] = MAC_COMMAND_CHANNEL_MAP;
+  payload[1] = map >> 16;
+  payload[2] = map >> 8;
+  payload[3] = map;
+  payload[4] = chanMapChannel;
+  // Lost if the TX queue is full: the next one is in an interval
+  macQueueCommand ( NO_ACK_REQUESTED, BROADCAST_ADDRESS, payload, sizeof(payload) );
+}
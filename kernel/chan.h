@@ -0,0 +1,198 @@
+/**
+ * @file chan.h
+ * @brief Frequency agility over the PHY_CHANNELS channels: energy detection scan, channel quality table, and receiver-directed channel hopping on the global time of the synchronization layer (kernel/sync.h)
+ * @date 20261017
+ */
+
+#ifndef CHAN_H
+#define CHAN_H
+
+#include "mac.h"
+#include "sync.h"
+
+#define CHAN_MAP_ALL 0x3FFFF // the PHY_CHANNELS channels, bit n for the channel n
+#define CHAN_HOP_STRIDE 5 // channels between two consecutive ones of a hop sequence, coprime with PHY_CHANNELS: a wideband interferer hits few slots in a row
+#define CHAN_RENDEZVOUS 3 // candidates for the rendezvous channel, PHY_CHANNELS/CHAN_RENDEZVOUS apart from the home channel (NODE_CHANNEL): the first not busy
+#define CHAN_BROADCAST_PERIOD 4 // one slot in CHAN_BROADCAST_PERIOD is a broadcast slot: all the nodes listen on the rendezvous channel
+#define CHAN_GUARD 1000 // us at each end of a slot without transmission: synchronization error and channel change
+#define CHAN_SYNC_SETTLE 4 // sync intervals with the same root before a node hops: the competing roots meet on one channel
+#define CHAN_MAP_INTERVAL 2000000 // us between two channel maps of a node
+#define CHAN_QUALITY_SHIFT 3 // EWMA weight of an energy sample is 1/2^CHAN_QUALITY_SHIFT
+#define CHAN_MIN_SAMPLES 4 // energy samples of a channel before it may leave the hop sequence
+#define CHAN_BUSY_HIGH 52428 // busy ratio (65535 is 1) over which a channel leaves the hop sequence: over the share of the air the traffic of the network takes
+#define CHAN_BUSY_LOW 26214 // busy ratio under which it comes back (hysteresis)
+#define CHAN_MIN_CHANNELS 2 // channels left in the hop sequence at least: the map is not changed else
+#define CHAN_MAP_LENGTH 5 // MAC_COMMAND_CHANNEL_MAP, hop sequence map of the source (3 bytes, 0 if it does not hop), channel it listens on else
+#define CHAN_NONE PHY_CHANNELS // channel of a neighbor not known yet
+
+struct chanQuality_t {
+ /**
+  * @brief Energy detection samples of a channel
+  */
+  uint16_t energy;/**< @brief EWMA of the energy, 1/256 RSSI units.*/
+  uint16_t busy;/**< @brief EWMA of the samples over the CCA threshold, 65535 is 1.*/
+  uint16_t samples;
+  uint32_t lastSample;
+
+}; // chanQuality_t
+
+// Global vars
+uint16_t chanScanInterval; // ms between two energy samples of the background scan (one channel each, in turn), 0 if the scan is off
+uint16_t chanHopping; // ms per slot of the channel hopping, 0 if the hopping is off
+uint8_t chanHome; // NODE_CHANNEL: the only channel without hopping, and the first rendezvous channel
+uint32_t chanMap; // Channels of the hop sequence of this node, advertised to its neighbors
+uint8_t chanScanNext; // Next channel sampled by the background scan
+uint32_t chanNextScan;
+uint32_t chanNextMap; // Next channel map sent
+uint8_t chanMapHopping; // The last channel map sent said this node hops
+uint8_t chanMapChannel; // The last channel map sent said this node listens on it
+uint16_t chanRoot; // Root of the global time followed, SYNC_ROOT_NONE if not synchronized
+uint32_t chanRootSince;
+uint8_t chanRootSettled; // chanRoot followed for CHAN_SYNC_SETTLE sync intervals
+struct chanQuality_t chanTable[PHY_CHANNELS];
+struct chanStats_t chanStats;
+
+
+// Prototypes
+
+/**
+* @brief Initialize the channel agility layer
+* @return No return
+* @date 20261017
+*/
+void chanInit ( void );
+
+/**
+* @brief Start (interval in ms between two energy samples) or stop (0) the background scan. The table is kept
+* @return No return
+* @date 20261017
+*/
+void chanSetScanInterval ( uint16_t interval );
+
+/**
+* @brief Start (ms per slot) or stop (0) the channel hopping. All the nodes of the network should use the same slot
+* @return false if the synchronization is off (SYNC_INTERVAL): the slots follow the global time
+* @date 20261017
+*/
+uint8_t chanSetHopping ( uint16_t slot );
+
+/**
+* @brief Set the home channel (NODE_CHANNEL), and tune the radio to it if the node does not hop
+* @return No return
+* @date 20261017
+*/
+void chanSetHome ( uint8_t channel );
+
+/**
+* @brief Process engine of the channel agility layer: background scan, channel maps, and the listening channel of each slot
+* @return No return
+* @date 20261017
+*/
+void chanEngine ( void );
+
+/**
+* @brief Called by MAC layer before the CCA of a frame: tune the radio to the channel the destination listens on. In a slot, the exchange must end before the guard
+* @return 0 if the radio is ready for the exchange, else us to wait before trying again
+* @date 20261017
+*/
+uint32_t chanTxWait ( uint16_t destinationAddress );
+
+/**
+* @brief Called by MAC layer with the payload of a received MAC_COMMAND_CHANNEL_MAP command
+* @return No return
+* @date 20261017
+*/
+void chanIndication ( uint16_t sourceAddress, uint8_t* payload, uint8_t payloadLength );
+
+/**
+* @brief Tell if this node hops now: hopping on, the global time of one root for CHAN_SYNC_SETTLE sync intervals, no superframe nor low-power listening
+* @return true if it does
+* @date 20261017
+*/
+uint8_t chanHopsNow ( void );
+
+/**
+* @brief Tell if the radio may leave its channel: no ACK to send, no frame on air, no rate switch exchange
+* @return true if it may
+* @date 20261017
+*/
+uint8_t chanRadioFree ( void );
+
+/**
+* @brief Get the slot of the global time now
+* @return the slot number, and in remaining the us left in it
+* @date 20261017
+*/
+uint32_t chanSlot ( uint32_t* remaining );
+
+/**
+* @brief Get the channel a node listens on in a unicast slot: its hop sequence is the channels of its map, CHAN_HOP_STRIDE apart, from an offset given by its address
+* @return the channel
+* @date 20261017
+*/
+uint8_t chanHopChannel ( uint32_t map, uint16_t address, uint32_t slot );
+
+/**
+* @brief Get the rendezvous channel: the home channel, or the first candidate not busy. The nodes that do not hop listen on it, the others in the broadcast slots
+* @return the channel
+* @date 20261017
+*/
+uint8_t chanFixedChannel ( void );
+
+/**
+* @brief Get the channel this node listens on now
+* @return the channel
+* @date 20261017
+*/
+uint8_t chanListenChannel ( void );
+
+/**
+* @brief Tell if the background scan found a channel busy (CHAN_BUSY_HIGH)
+* @return true if it did
+* @date 20261017
+*/
+uint8_t chanBusy ( uint8_t channel );
+
+/**
+* @brief Get the least busy channel, the least energy first among equals
+* @return the channel, the home channel if none was sampled
+* @date 20261017
+*/
+uint8_t chanBestChannel ( void );
+
+/**
+* @brief Count the channels of a map
+* @return the count
+* @date 20261017
+*/
+uint8_t chanMapCount ( uint32_t map );
+
+/**
+* @brief Take an energy sample of a channel, and come back to the channel of the radio
+* @return No return
+* @date 20261017
+*/
+void chanScanChannel ( uint8_t channel );
+
+/**
+* @brief Add an energy sample of a channel to the quality table: the background scan, and the CCA of the MAC layer
+* @return No return
+* @date 20261017
+*/
+void chanEdSample ( uint8_t channel, uint8_t energy );
+
+/**
+* @brief Update the hop sequence map from the quality table, with CHAN_BUSY_HIGH/CHAN_BUSY_LOW hysteresis
+* @return No return
+* @date 20261017
+*/
+void chanUpdateMap ( void );
+
+/**
+* @brief Queue a channel map: the hop sequence of this node, or the channel it listens on
+* @return No return
+* @date 20261017
+*/
+void chanSendMap ( void );
+
+#endif
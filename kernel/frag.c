@@ -0,0 +1,265 @@
+/**
+ * @file frag.c
+ * @brief Fragmentation and reassembly of messages larger than a MAC frame
+ * @date 20261017
+ */
+
+#include "frag.h"
+
+extern uint16_t nodePanId;
+
+
+void fragInit ( void ) {
+
+  for ( uint8_t i=0; i<FRAG_REASSEMBLY_SLOTS; i++ )
+    fragSlots[i].state = FRAG_SLOT_FREE;
+  fragTxState = FRAG_TX_IDLE;
+  fragTxStatus = MCPS_DATA_CONFIRM_STATUS_UNKNOWN;
+  // After a reboot, the destination may still answer for the last message ids
+  fragTxMessageId = random(256);
+}
+
+
+int fragSendMessage ( uint16_t destinationAddress, uint8_t* data, uint16_t length ) {
+
+  if ( fragTxState != FRAG_TX_IDLE ) return -1;
+  if ( ( length == 0 ) || ( length > FRAG_MESSAGE_MAX_LENGTH ) || ( destinationAddress == BROADCAST_ADDRESS ) ) return -1;
+
+  fragTxMessageId++;
+  fragTxData = data;
+  fragTxLength = length;
+  fragTxDestination = destinationAddress;
+  fragTxCount = ( length + FRAG_FRAGMENT_LENGTH - 1 ) / FRAG_FRAGMENT_LENGTH;
+  memset(fragTxMissing, 0, sizeof(fragTxMissing));
+  for ( uint8_t i=0; i<fragTxCount; i++ )
+    fragTxMissing[i/8] |= 1 << (i%8);
+  fragTxStatus = MCPS_DATA_CONFIRM_STATUS_PENDING;
+  fragTxRound = 0;
+  fragTxNewRound ( 0 );
+  return fragTxMessageId;
+}
+
+
+uint8_t fragGetTxStatus ( uint8_t handle ) {
+
+  if ( handle != fragTxMessageId ) return MCPS_DATA_CONFIRM_STATUS_UNKNOWN;
+  return fragTxStatus;
+}
+
+
+void fragTxNewRound ( uint8_t first ) {
+
+  if ( ++fragTxRound > FRAG_MAX_ROUNDS ) {
+    if ( macDebug ) {
+      Serial.printf("FRAG_DEBUG message %d to %04X failed\n", fragTxMessageId, fragTxDestination);
+    }
+    fragTxStatus = MCPS_DATA_CONFIRM_STATUS_NO_ACK;
+    fragTxState = FRAG_TX_IDLE;
+    return;
+  }
+
+  // Only the fragments still missing are sent again. The last one asks for the status
+  for ( fragTxLast=fragTxCount-1; fragTxLast>0 && !( fragTxMissing[fragTxLast/8] & ( 1 << (fragTxLast%8) ) ); fragTxLast-- ) ;
+  if ( !( fragTxMissing[fragTxLast/8] & ( 1 << (fragTxLast%8) ) ) ) {
+    // All received, but the status did not say the message is complete: the last fragment polls again
+    fragTxLast = fragTxCount-1;
+    fragTxMissing[fragTxLast/8] |= 1 << (fragTxLast%8);
+  }
+  fragTxNext = first;
+  fragTxState = FRAG_TX_SENDING;
+}
+
+
+void fragEngine ( void ) {
+
+  struct fragSlot_t *slot;
+  uint8_t status, kind, length;
+
+  switch ( fragTxState ) {
+
+    case FRAG_TX_SENDING:
+
+      // As many fragments as the TX queue takes, the next ones on the next call
+      for ( ; fragTxNext<fragTxCount; fragTxNext++ ) {
+        if ( !( fragTxMissing[fragTxNext/8] & ( 1 << (fragTxNext%8) ) ) ) continue;
+        kind = FRAG_KIND_DATA;
+        if ( fragTxNext == fragTxLast ) kind |= FRAG_KIND_POLL;
+        if ( fragTxNext == fragTxCount-1 ) length = fragTxLength - fragTxNext*FRAG_FRAGMENT_LENGTH;
+        else length = FRAG_FRAGMENT_LENGTH;
+        if ( fragSendFrame ( fragTxDestination, kind, fragTxMessageId, fragTxNext, fragTxCount,
+                             fragTxData + fragTxNext*FRAG_FRAGMENT_LENGTH, length, &fragTxPollHandle ) != MCPS_DATA_REQUEST_SUCCESS ) break;
+        if ( kind & FRAG_KIND_POLL ) {
+          fragTxState = FRAG_TX_WAIT_CONFIRM;
+          break;
+        }
+      }
+      // A late status cleared the fragment of the poll: no poll queued, the round starts again
+      if ( ( fragTxState == FRAG_TX_SENDING ) && ( fragTxNext >= fragTxCount ) ) fragTxNewRound ( 0 );
+      break;
+
+    case FRAG_TX_WAIT_CONFIRM:
+
+      // The status timeout starts when the poll is on air, not when it is queued
+      status = macGetTxStatus ( fragTxPollHandle );
+      if ( status == MCPS_DATA_CONFIRM_STATUS_PENDING ) break;
+      if ( status == MCPS_DATA_CONFIRM_STATUS_SUCCESS ) {
+        fragTxStatusTimeout = micros() + FRAG_STATUS_TIMEOUT;
+        fragTxState = FRAG_TX_WAIT_STATUS;
+      } else fragTxNewRound ( fragTxLast );
+      break;
+
+    case FRAG_TX_WAIT_STATUS:
+
+      // Status lost: poll again with the last fragment only
+      if ( cmpUi32GreaterWithRollover ( micros(), fragTxStatusTimeout ) )
+        fragTxNewRound ( fragTxLast );
+      break;
+
+    default:
+
+      break;
+  }
+
+  for ( uint8_t i=0; i<FRAG_REASSEMBLY_SLOTS; i++ ) {
+    slot = &fragSlots[i];
+    if ( ( slot->state == FRAG_SLOT_RECEIVING ) && (int32_t)( micros() - slot->lastUpdate ) > FRAG_REASSEMBLY_TIMEOUT ) {
+      if ( macDebug ) {
+        Serial.printf("FRAG_DEBUG message %d from %04X abandoned\n", slot->messageId, slot->source);
+      }
+      slot->state = FRAG_SLOT_FREE;
+      continue;
+    }
+    if ( slot->statusPending && ( slot->state != FRAG_SLOT_FREE ) ) {
+      if ( fragSendFrame ( slot->source, FRAG_KIND_STATUS, slot->messageId, slot->received, slot->count,
+                           slot->bitmap, ( slot->count + 7 ) / 8, NULL ) == MCPS_DATA_REQUEST_SUCCESS )
+        slot->statusPending = false;
+    }
+  }
+}
+
+
+uint8_t fragSendFrame ( uint16_t destinationAddress, uint8_t kind, uint8_t messageId, uint8_t index, uint8_t count, uint8_t* data, uint8_t length, uint8_t* handle ) {
+
+  uint8_t *payload;
+  uint8_t maxPayloadLength;
+
+  // Straight in the TX queue: never aggregated with other payloads
+  payload = macBeginDataFrame ( true, true, nodePanId, destinationAddress, &maxPayloadLength, FRAME_FRAGMENT );
+  if ( payload == NULL ) return MCPS_DATA_REQUEST_MAC_TX_BUSY;
+  payload[0] = kind;
+  payload[1] = messageId;
+  payload[2] = index;
+  payload[3] = count;
+  memcpy(&payload[FRAG_HEADER_LENGTH], data, length);
+  return macCommitDataFrame ( FRAG_HEADER_LENGTH + length, handle );
+}
+
+
+uint8_t fragIndication ( uint16_t sourceAddress, uint8_t* payload, uint8_t payloadLength ) {
+
+  struct fragSlot_t *slot;
+  uint8_t kind, messageId, index, count, length;
+  uint8_t *data;
+
+  // Malformed fragments are ignored, but ACKed: the source would send them again
+  if ( payloadLength < FRAG_HEADER_LENGTH ) return true;
+  kind = payload[0];
+  messageId = payload[1];
+  index = payload[2];
+  count = payload[3];
+  data = payload + FRAG_HEADER_LENGTH;
+  length = payloadLength - FRAG_HEADER_LENGTH;
+
+  if ( kind == FRAG_KIND_STATUS ) {
+
+    // Status of the message being sent: its missing fragments are sent again
+    if ( ( fragTxState == FRAG_TX_IDLE ) || ( sourceAddress != fragTxDestination ) || ( messageId != fragTxMessageId )
+         || ( count != fragTxCount ) || ( length < ( count + 7 ) / 8 ) ) return true;
+    for ( uint8_t i=0; i<( count + 7 ) / 8; i++ )
+      fragTxMissing[i] &= ~data[i];
+    if ( index == count ) {
+      if ( macDebug ) {
+        Serial.printf("FRAG_DEBUG message %d to %04X sent in %d rounds\n", fragTxMessageId, fragTxDestination, fragTxRound);
+      }
+      fragTxStatus = MCPS_DATA_CONFIRM_STATUS_SUCCESS;
+      fragTxState = FRAG_TX_IDLE;
+    } else if ( fragTxState != FRAG_TX_SENDING ) fragTxNewRound ( 0 );
+    return true;
+  }
+
+  // Data fragment. Every fragment but the last one is full: its place in the message is known
+  if ( ( kind & ~FRAG_KIND_POLL ) != FRAG_KIND_DATA ) return true;
+  if ( ( count == 0 ) || ( count > FRAG_MAX_FRAGMENTS ) || ( index >= count ) ) return true;
+  if ( ( index < count-1 ) ? ( length != FRAG_FRAGMENT_LENGTH ) : ( length > FRAG_FRAGMENT_LENGTH || index*FRAG_FRAGMENT_LENGTH + length > FRAG_MESSAGE_MAX_LENGTH ) )
+    return true;
+
+  slot = fragGetSlot ( sourceAddress, messageId, count );
+  if ( slot == NULL ) return false;
+  if ( slot->count != count ) return true;
+
+  if ( ( slot->state == FRAG_SLOT_RECEIVING ) && !( slot->bitmap[index/8] & ( 1 << (index%8) ) ) ) {
+    memcpy(&slot->data[index*FRAG_FRAGMENT_LENGTH], data, length);
+    slot->bitmap[index/8] |= 1 << (index%8);
+    slot->received++;
+    if ( index == count-1 ) slot->length = index*FRAG_FRAGMENT_LENGTH + length;
+    slot->lastUpdate = micros();
+    if ( slot->received == count ) {
+      // Complete: tell the source now, it may stop before its poll
+      slot->state = FRAG_SLOT_COMPLETE;
+      slot->statusPending = true;
+    }
+  }
+  if ( kind & FRAG_KIND_POLL ) slot->statusPending = true;
+  return true;
+}
+
+
+struct fragSlot_t* fragGetSlot ( uint16_t sourceAddress, uint8_t messageId, uint8_t count ) {
+
+  struct fragSlot_t *slot, *freeSlot;
+
+  freeSlot = NULL;
+  for ( uint8_t i=0; i<FRAG_REASSEMBLY_SLOTS; i++ ) {
+    slot = &fragSlots[i];
+    if ( slot->state == FRAG_SLOT_FREE ) {
+      if ( freeSlot == NULL ) freeSlot = slot;
+      continue;
+    }
+    if ( slot->source != sourceAddress ) {
+      if ( ( slot->state == FRAG_SLOT_READ ) && ( freeSlot == NULL ) ) freeSlot = slot;
+      continue;
+    }
+    if ( slot->messageId == messageId ) return slot;
+    // A source sends one message at a time: its previous one is over
+    if ( slot->state != FRAG_SLOT_COMPLETE ) freeSlot = slot;
+  }
+  if ( freeSlot == NULL ) return NULL;
+
+  freeSlot->state = FRAG_SLOT_RECEIVING;
+  freeSlot->source = sourceAddress;
+  freeSlot->messageId = messageId;
+  freeSlot->count = count;
+  freeSlot->received = 0;
+  memset(freeSlot->bitmap, 0, sizeof(freeSlot->bitmap));
+  freeSlot->length = 0;
+  freeSlot->statusPending = false;
+  freeSlot->lastUpdate = micros();
+  return freeSlot;
+}
+
+
+uint8_t fragReceiveMessage ( uint16_t* sourceAddress, uint8_t* data, uint16_t* length ) {
+
+  struct fragSlot_t *slot;
+
+  for ( uint8_t i=0; i<FRAG_REASSEMBLY_SLOTS; i++ ) {
+    slot = &fragSlots[i];
+    if ( slot->state != FRAG_SLOT_COMPLETE ) continue;
+    memcpy(data, slot->data, slot->length);
+    *sourceAddress = slot->source;
+    *length = slot->length;
+    slot->state = FRAG_SLOT_READ;
+    return true;
+  }
+  return false;
+}
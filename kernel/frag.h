@@ -0,0 +1,144 @@
+/**
+ * @file frag.h
+ * @brief Fragmentation and reassembly of messages larger than a MAC frame
+ * @date 20261017
+ */
+
+#ifndef FRAG_H
+#define FRAG_H
+
+#include "mac.h"
+
+#ifndef FRAG_MESSAGE_MAX_LENGTH
+#define FRAG_MESSAGE_MAX_LENGTH 1024 // bytes, largest message sent or reassembled
+#endif
+#ifndef FRAG_REASSEMBLY_SLOTS
+#define FRAG_REASSEMBLY_SLOTS 2 // messages reassembled at the same time, FRAG_MESSAGE_MAX_LENGTH bytes each
+#endif
+#define FRAG_HEADER_LENGTH 4 // kind, message id, fragment index, fragment count
+#define FRAG_FRAGMENT_LENGTH ( MAX_FRAME_LENGTH - MAC_DATA_FRAME_HEADER_LENGTH - FRAG_HEADER_LENGTH ) // payload bytes per fragment, all but the last one
+#define FRAG_MAX_FRAGMENTS ( ( FRAG_MESSAGE_MAX_LENGTH + FRAG_FRAGMENT_LENGTH - 1 ) / FRAG_FRAGMENT_LENGTH )
+#define FRAG_BITMAP_LENGTH ( ( FRAG_MAX_FRAGMENTS + 7 ) / 8 ) // bytes, one bit per fragment
+#define FRAG_STATUS_TIMEOUT 100000 // us the source waits for the status of the destination after the last fragment of a round
+#define FRAG_MAX_ROUNDS 5 // rounds of (re)transmission before the message fails
+#define FRAG_REASSEMBLY_TIMEOUT 2000000 // us without any fragment before a reassembly is abandoned
+
+#if ( FRAG_MAX_FRAGMENTS > 255 ) || ( FRAG_BITMAP_LENGTH > FRAG_FRAGMENT_LENGTH )
+#error "FRAG_MESSAGE_MAX_LENGTH is too large"
+#endif
+
+// Fragment kinds (first byte of the payload of a FRAME_FRAGMENT frame)
+#define FRAG_KIND_DATA		0x01 // kind, message id, index, count, data
+#define FRAG_KIND_STATUS	0x02 // kind, message id, fragments received, count, bitmap of the fragments received
+#define FRAG_KIND_POLL		0x80 // with FRAG_KIND_DATA: last fragment of a round, the destination answers with its status
+
+#define FRAG_TX_IDLE		0
+#define FRAG_TX_SENDING		1 // fragments of the round still to be queued
+#define FRAG_TX_WAIT_CONFIRM	2 // waiting for the MAC to confirm the poll fragment
+#define FRAG_TX_WAIT_STATUS	3
+
+#define FRAG_SLOT_FREE		0
+#define FRAG_SLOT_RECEIVING	1
+#define FRAG_SLOT_COMPLETE	2 // waiting for recvMessage
+#define FRAG_SLOT_READ		3 // free, but still answers the polls of its message
+
+struct fragSlot_t {
+ /**
+  * @brief Reassembly of one message. Fragments are copied at their place: index * FRAG_FRAGMENT_LENGTH
+  */
+  uint8_t state;
+  uint16_t source;
+  uint8_t messageId;
+  uint8_t count;/**< @brief Number of fragments of the message.*/
+  uint8_t received;/**< @brief Number of different fragments received.*/
+  uint8_t bitmap[FRAG_BITMAP_LENGTH];/**< @brief Bit i set if fragment i is received.*/
+  uint16_t length;/**< @brief Message length, known with the last fragment.*/
+  uint8_t statusPending;/**< @brief fragEngine must send the status to the source.*/
+  uint32_t lastUpdate;
+  uint8_t data[FRAG_MESSAGE_MAX_LENGTH];
+
+}; // fragSlot_t
+
+// Global vars
+struct fragSlot_t fragSlots[FRAG_REASSEMBLY_SLOTS];
+uint8_t* fragTxData; // Message being sent, lent by the caller until its status is not pending
+uint16_t fragTxLength;
+uint16_t fragTxDestination;
+uint8_t fragTxMessageId;
+uint8_t fragTxCount;
+uint8_t fragTxMissing[FRAG_BITMAP_LENGTH]; // Bit i set while fragment i is not received by the destination
+uint8_t fragTxNext; // Next fragment examined by the current round
+uint8_t fragTxLast; // Last missing fragment: sent with FRAG_KIND_POLL
+uint8_t fragTxPollHandle; // MAC handle of the poll fragment
+uint8_t fragTxRound;
+uint8_t fragTxState;
+uint8_t fragTxStatus; // MCPS_DATA_CONFIRM_STATUS_* of message fragTxMessageId
+uint32_t fragTxStatusTimeout;
+
+
+// Prototypes
+
+/**
+* @brief Initialize the fragmentation layer
+* @return No return
+* @date 20261017
+*/
+void fragInit ( void );
+
+/**
+* @brief Process engine of the fragmentation layer. Queues the fragments and the status frames in the MAC TX queue as it gets room, and handles the timeouts
+* @return No return
+* @date 20261017
+*/
+void fragEngine ( void );
+
+/**
+* @brief Start sending a message of up to FRAG_MESSAGE_MAX_LENGTH bytes to destinationAddress (not broadcast). The data is not copied: it must stay unchanged while fragGetTxStatus returns MCPS_DATA_CONFIRM_STATUS_PENDING
+* @return the message id (its handle), or -1 if a message is being sent yet, or if the length or destination is wrong
+* @date 20261017
+*/
+int fragSendMessage ( uint16_t destinationAddress, uint8_t* data, uint16_t length );
+
+/**
+* @brief Get the status of a message sent with fragSendMessage
+* @return MCPS_DATA_CONFIRM_STATUS_PENDING while it is sent, MCPS_DATA_CONFIRM_STATUS_SUCCESS once the destination has all its fragments, MCPS_DATA_CONFIRM_STATUS_NO_ACK after FRAG_MAX_ROUNDS rounds, MCPS_DATA_CONFIRM_STATUS_UNKNOWN for another handle than the last message
+* @date 20261017
+*/
+uint8_t fragGetTxStatus ( uint8_t handle );
+
+/**
+* @brief Copy the oldest reassembled message to data (FRAG_MESSAGE_MAX_LENGTH bytes) and free it
+* @return true if a message was available
+* @date 20261017
+*/
+uint8_t fragReceiveMessage ( uint16_t* sourceAddress, uint8_t* data, uint16_t* length );
+
+/**
+* @brief Called by MAC layer with the payload of a received FRAME_FRAGMENT frame
+* @return false if the fragment can't be stored (no reassembly slot): the MAC does not ACK it
+* @date 20261017
+*/
+uint8_t fragIndication ( uint16_t sourceAddress, uint8_t* payload, uint8_t payloadLength );
+
+/**
+* @brief Queue a fragment frame in the MAC TX queue
+* @return MCPS_DATA_REQUEST_SUCCESS, or MCPS_DATA_REQUEST_MAC_TX_BUSY if the TX queue is full
+* @date 20261017
+*/
+uint8_t fragSendFrame ( uint16_t destinationAddress, uint8_t kind, uint8_t messageId, uint8_t index, uint8_t count, uint8_t* data, uint8_t length, uint8_t* handle );
+
+/**
+* @brief Start a new round of the message being sent from fragment first, or fail it after FRAG_MAX_ROUNDS rounds
+* @return No return
+* @date 20261017
+*/
+void fragTxNewRound ( uint8_t first );
+
+/**
+* @brief Get the reassembly slot of a message, or take one for it. A new message from a source abandons its previous one
+* @return the slot, NULL if none is available
+* @date 20261017
+*/
+struct fragSlot_t* fragGetSlot ( uint16_t sourceAddress, uint8_t messageId, uint8_t count );
+
+#endif
@@ -6,6 +6,10 @@
  */
 
 #include "mac.h"
+#include "frag.h"
+#include "sync.h"
+#include "route.h"
+#include "chan.h"
 
 extern uint16_t nodeShortAddress;
 extern uint16_t nodePanId;
@@ -16,15 +20,153 @@ void macInit ( void ) {
   mac_sqn.data = 0;
   neighbFreeNeighborTable();
   macCbrNextTimeToSend = 0;
-  macFrameToSend = false;
-  macFrameReceived = false;
+  memset(&macStats, 0, sizeof(macStats));
+  macTxQueueHead = 0;
+  macTxQueueTail = 0;
+  macOpenFrameHeaderLength = 0;
+  macAggregationHold = 0;
+  macAggregateOpen = false;
+  macRxAggregateOffset = 0;
+  for ( uint8_t i=0; i<MAC_TX_CONFIRM_HISTORY_LENGTH; i++ )
+    macTxConfirmHistory[i].status = MCPS_DATA_CONFIRM_STATUS_UNKNOWN;
   lastAckReceived = 0xff;
+  macAckPending = false;
+  macBlockAck = false;
+  macWindowCount = 0;
+  macRateAdaptation = false;
+  macRateSwitchFrame = NULL;
+  macRateSwitchState = MAC_RATE_SWITCH_IDLE;
+  macSetBeaconInterval ( 0 );
+  macSetLplInterval ( 0 );
+  macLplHold = MAC_LPL_DEFAULT_HOLD;
+  macLplStrobing = false;
+  macGtsRequested = 0;
+  macGtsRequestPending = false;
+  // micros() may be past 2^31 already: a timeout left at 0 would be in the future
+  macInterframeDurationTimeout = micros();
   macCsma_CaState = MAC_CSMA_CA_WAIT_INTERFRAME_STATE;
+  macSetAdaptiveCsma ( false );
+#ifdef MAC_TRACE
+  macTraceTail = 0;
+#endif
+}
+
+
+void macTraceRecord ( uint8_t event, uint8_t value, uint16_t arg ) {
+
+#ifdef MAC_TRACE
+  struct macTraceEvent_t *traceEvent;
+
+  traceEvent = &macTraceRing[macTraceTail % MAC_TRACE_LENGTH];
+  traceEvent->timestamp = micros();
+  traceEvent->event = event;
+  traceEvent->value = value;
+  traceEvent->arg = arg;
+  macTraceTail++;
+#endif
+}
+
+
+uint16_t macTraceGet ( struct macTraceEvent_t* events, uint16_t maxCount ) {
+
+#ifdef MAC_TRACE
+  uint16_t first, count;
+
+  // The ring holds the last MAC_TRACE_LENGTH events
+  count = macTraceTail < MAC_TRACE_LENGTH ? macTraceTail : MAC_TRACE_LENGTH;
+  if ( count > maxCount ) count = maxCount;
+  first = macTraceTail - count;
+  for ( uint16_t i=0; i<count; i++ )
+    events[i] = macTraceRing[(uint16_t)(first+i) % MAC_TRACE_LENGTH];
+  return count;
+#else
+  return 0;
+#endif
+}
+
+
+void macTraceDump ( void ) {
+
+#ifdef MAC_TRACE
+  struct macTraceEvent_t traceEvent;
+  uint16_t first, count;
+
+  count = macTraceTail < MAC_TRACE_LENGTH ? macTraceTail : MAC_TRACE_LENGTH;
+  first = macTraceTail - count;
+  // Printing is slow: copy each event before printing it, the engines keep recording meanwhile
+  for ( uint16_t i=0; i<count; i++ ) {
+    traceEvent = macTraceRing[(uint16_t)(first+i) % MAC_TRACE_LENGTH];
+    Serial.printf("TRACE %lu %u %u %u\n", traceEvent.timestamp, traceEvent.event, traceEvent.value, traceEvent.arg);
+  }
+  macTraceTail = 0;
+#endif
+}
+
+
+void macSetAdaptiveCsma ( uint8_t enable ) {
+
+  macAdaptiveCsma = enable;
+  macMinBe = MAC_MIN_BE;
+  macCcaThreshold = MAC_CCA_MEDIUM_BUSY;
+  macCcaMargin = MAC_CCA_MARGIN;
+  macNoiseFloor = ( MAC_CCA_MEDIUM_BUSY - MAC_CCA_MARGIN ) << 8;
+  macCcaBusyRatio = 0;
+  macTxFailureRatio = 0;
+  macAdaptSamples = 0;
+  macNoiseFloorNextSample = micros();
+}
+
+
+void macAdaptCsma ( uint16_t *ratio, uint8_t sample ) {
+
+  uint16_t threshold;
+
+  if ( !macAdaptiveCsma ) return;
+
+  if ( sample ) *ratio += ( 65535 - *ratio ) >> MAC_ADAPT_SHIFT;
+  else *ratio -= *ratio >> MAC_ADAPT_SHIFT;
+  if ( ++macAdaptSamples < MAC_ADAPT_PERIOD ) return;
+  macAdaptSamples = 0;
+
+  // Collisions: longer backoffs spread the contenders. Quiet channel: shorter ones.
+  // On a saturated channel, longer backoffs only add latency: the CCA already defers
+  if ( ( macTxFailureRatio > MAC_ADAPT_FAILURE_HIGH ) && ( macCcaBusyRatio < MAC_ADAPT_BUSY_HIGH ) ) {
+    if ( macMinBe < MAC_ADAPT_MIN_BE_HIGHEST ) macMinBe++;
+  } else if ( ( macTxFailureRatio < MAC_ADAPT_FAILURE_LOW ) || ( macCcaBusyRatio > MAC_ADAPT_BUSY_HIGH ) ) {
+    if ( macMinBe > MAC_MIN_BE ) macMinBe--;
+    else if ( ( macMinBe > MAC_ADAPT_MIN_BE_LOWEST ) && ( macCcaBusyRatio < MAC_ADAPT_BUSY_LOW ) ) macMinBe--;
+  }
+
+  // Collisions on a channel that looks free: the CCA misses transmissions, lower the threshold.
+  // Busy channel but frames get through: the CCA hears nodes too far to collide, raise it
+  if ( ( macTxFailureRatio > MAC_ADAPT_FAILURE_HIGH ) && ( macCcaBusyRatio < MAC_ADAPT_BUSY_LOW ) ) {
+    if ( macCcaMargin > MAC_CCA_MARGIN_MIN ) macCcaMargin--;
+  } else if ( ( macCcaBusyRatio > MAC_ADAPT_BUSY_HIGH ) && ( macTxFailureRatio < MAC_ADAPT_FAILURE_LOW ) ) {
+    if ( macCcaMargin < MAC_CCA_MARGIN_MAX ) macCcaMargin++;
+  }
+  threshold = ( macNoiseFloor >> 8 ) + macCcaMargin;
+  macCcaThreshold = threshold > 255 ? 255 : threshold;
+}
+
+
+void macNoiseFloorSample ( uint8_t energy ) {
+
+  uint16_t threshold;
+
+  if ( !macAdaptiveCsma ) return;
+
+  // Follows quiet samples quickly and louder ones slowly: a frame on air is not noise
+  if ( ( energy << 8 ) < macNoiseFloor ) macNoiseFloor -= ( macNoiseFloor - ( energy << 8 ) ) >> 2;
+  else macNoiseFloor += ( ( energy << 8 ) - macNoiseFloor ) >> 6;
+
+  threshold = ( macNoiseFloor >> 8 ) + macCcaMargin;
+  macCcaThreshold = threshold > 255 ? 255 : threshold;
 }
 
 
 void PD_data_indication ( struct rxFrame_t *rxFrame ) {
 
+  MAC_TRACE_EVENT(MAC_TRACE_RX, rxFrame->data[2], rxFrame->length);
   if ( phyDebug ) {
 	  Serial.printf("PHY_DEBUG %ld\t%d\t%d\t", rxFrame->timestamp, rxFrame->rssi, rxFrame->length);
 	  for (int i=0; i<rxFrame->length; i++) {
@@ -36,39 +178,587 @@ void PD_data_indication ( struct rxFrame_t *rxFrame ) {
 }
 
 
-uint8_t MCPS_data_request ( uint8_t ackRequest, uint8_t intraPan, uint16_t panId, uint16_t destinationAddress, uint8_t* payload, uint8_t payloadLength ) {
+void PD_data_confirm ( struct txFrame_t *txFrame ) {
+
+  MAC_TRACE_EVENT(MAC_TRACE_TX_END, txFrame->data[2], txFrame->data[1] & FRAME_TYPE_MASK);
+  if ( txFrame == currentTxFrame ) macTxDone = true;
+}
+
+
+uint32_t macAckWaitDuration ( void ) {
+
+  return MAC_ACK_WAIT_DURATION + phyAirTime ( phyRadioProfile, MAC_BLOCK_ACK_FRAME_LENGTH ) - phyAirTime ( MODEM_PROFILE_125K, MAC_BLOCK_ACK_FRAME_LENGTH );
+}
+
+
+uint8_t macLinkProfile ( uint16_t nodeAddress ) {
+
+  uint8_t i;
+
+  if ( !macRateAdaptation ) return phyModemProfile;
+  i = neighbGetNeighborIndex ( nodeAddress );
+  if ( ( i == NEIGHB_NEIGHBOR_NOT_FOUND ) || ( neighbors[i].profile > phyModemProfile ) ) return phyModemProfile;
+  return neighbors[i].profile;
+}
+
+
+void macAdaptRate ( uint16_t nodeAddress, uint8_t acked, uint8_t rssi ) {
+
+  struct neighbor_t *neighbor;
+  uint8_t i, linkRssi;
+
+  if ( !macRateAdaptation ) return;
+  i = neighbGetNeighborIndex ( nodeAddress );
+  if ( i == NEIGHB_NEIGHBOR_NOT_FOUND ) return;
+  neighbor = &neighbors[i];
+
+  // The ACK tells how the destination is heard: it goes in the RSSI average, like its frames
+  if ( rssi ) neighbUpdateLinkQuality ( i, rssi, false, 0 );
+  if ( neighbor->profile > phyModemProfile ) neighbor->profile = phyModemProfile;
+  linkRssi = neighbor->rssiAverage >> 8;
+
+  // Lost with a faster profile, or too weak for it now: back to a more robust one at once
+  if ( ( neighbor->profile < phyModemProfile )
+       && ( ( !acked && ( phyRadioProfile < phyModemProfile ) ) || ( linkRssi < phyModemSensitivities[neighbor->profile] + MAC_RATE_MARGIN ) ) ) {
+    neighbor->profile++;
+    neighbor->rateSuccesses = 0;
+    macStats.rateDowngrades++;
+    return;
+  }
+  if ( !acked ) {
+    neighbor->rateSuccesses = 0;
+    return;
+  }
+
+  // A steady link with room over the sensitivity of the next profile tries it
+  if ( ++neighbor->rateSuccesses < MAC_RATE_UP_SUCCESSES ) return;
+  neighbor->rateSuccesses = 0;
+  if ( ( neighbor->profile > 0 ) && ( linkRssi >= phyModemSensitivities[neighbor->profile-1] + MAC_RATE_MARGIN ) )
+    neighbor->profile--;
+}
+
+
+void macPrepareRateSwitch ( void ) {
+
+  uint8_t profile, k;
+  uint16_t destinationAddress;
+  uint32_t saved;
+
+  // The command sent before, if any, is over
+  if ( macRateSwitchFrame != NULL ) currentTxFrame = macRateSwitchFrame;
+  macRateSwitchFrame = NULL;
+  // The CSMA/CA is done with the profile of the network: the other nodes listen with it
+  phySetRadioProfile ( phyModemProfile );
+
+  // Superframes and channel hopping: the CAP, the GTS and the slots are fitted to the exchanges with the profile of the network
+  if ( macRateSwitchSkip || macSuperframeActive() || chanHopsNow() || !( currentTxFrame->data[1] & ACK_REQUEST ) || ( currentTxFrameRetries < 0 ) ) return;
+  destinationAddress = decodeUint16 ( &currentTxFrame->data[5] );
+  profile = macLinkProfile ( destinationAddress );
+  if ( profile >= phyModemProfile ) return;
+
+  // Worth it only if the frames of the exchange save more time on air than the command and its ACK take
+  saved = 0;
+  if ( macWindowCount ) {
+    for ( k=macWindowNextFrame ( 0 ); k<macWindowCount; k=macWindowNextFrame ( k+1 ) )
+      saved += phyAirTime ( phyModemProfile, macWindowFrame ( k )->length ) - phyAirTime ( profile, macWindowFrame ( k )->length );
+  } else saved = phyAirTime ( phyModemProfile, currentTxFrame->length ) - phyAirTime ( profile, currentTxFrame->length );
+  if ( saved <= phyAirTime ( phyModemProfile, MAC_RATE_SWITCH_FRAME_LENGTH ) + MAC_WAIT_BEFORE_SEND_ACK + phyAirTime ( phyModemProfile, MAC_ACK_FRAME_LENGTH ) ) return;
+
+  macCommandTxFrame.length = macMakeMacHeader ( FRAME_TYPE_MAC_COMMAND, ACK_REQUESTED, true, decodeUint16 ( &currentTxFrame->data[3] ), destinationAddress, mac_sqn.mac_command++, macCommandTxFrame.data );
+  macCommandTxFrame.data[macCommandTxFrame.length++] = MAC_COMMAND_RATE_SWITCH;
+  macCommandTxFrame.data[macCommandTxFrame.length++] = profile;
+  macRateSwitchFrame = currentTxFrame;
+  currentTxFrame = &macCommandTxFrame;
+}
+
+
+uint8_t macRateSwitchEngine ( void ) {
+
+  if ( macRateSwitchState == MAC_RATE_SWITCH_IDLE ) return true;
+  // Each ACK goes with the profile of the frame it answers
+  if ( macAckPending || phyTxBusy() ) return false;
+
+  switch ( macRateSwitchState ) {
+
+    case MAC_RATE_SWITCH_ACCEPTED:
+
+      phySetRadioProfile ( macRateSwitchProfile );
+      macRateSwitchTimeout = micros() + phyAirTime ( macRateSwitchProfile, MAX_FRAME_LENGTH+PHY_TRAILER_LENGTH ) + MAC_RATE_SWITCH_GUARD;
+      macRateSwitchState = MAC_RATE_SWITCH_RECEIVING;
+      return false;
+
+    case MAC_RATE_SWITCH_RECEIVING:
+
+      if ( !cmpUi32GreaterWithRollover ( micros(), macRateSwitchTimeout ) ) return false;
+      break;
+
+    default:
+
+      break;
+  }
+
+  // Exchange over, or the source gave up: back to the profile of the network
+  phySetRadioProfile ( phyModemProfile );
+  macRateSwitchState = MAC_RATE_SWITCH_IDLE;
+  return true;
+}
+
+
+void macSetBeaconInterval ( uint16_t interval ) {
+
+  macBeaconInterval = interval;
+  macGtsCount = 0;
+  macCoordinatorAddress = MAC_COORDINATOR_NONE;
+  macGtsSlots = 0;
+  macFinalCapSlot = MAC_SUPERFRAME_SLOTS - 1;
+  macBeaconAirTime = 0;
+  macSuperframeDuration = (uint32_t)interval * 1000;
+  // The first beacon goes right away
+  macSuperframeStart = micros() - macSuperframeDuration;
+}
+
+
+uint8_t macSuperframeActive ( void ) {
+
+  return macBeaconInterval || ( macCoordinatorAddress != MAC_COORDINATOR_NONE );
+}
+
+
+void macBeaconEngine ( void ) {
+
+  uint8_t payload[2];
+
+  if ( macBeaconInterval ) {
+    // The CAP and the GTS end before the next beacon: only an ACK may still be on air
+    if ( ( (int32_t)( micros() - macSuperframeStart - macSuperframeDuration ) >= 0 ) && !phyTxBusy() ) macSendBeacon();
+    return;
+  }
+  if ( macCoordinatorAddress == MAC_COORDINATOR_NONE ) return;
+
+  // Beacon missed: the next superframe begins when it was expected anyway
+  if ( (int32_t)( micros() - macSuperframeStart - macSuperframeDuration - macBeaconAirTime - MAC_BEACON_GUARD ) > 0 ) {
+    macSuperframeStart += macSuperframeDuration;
+    macStats.beaconsMissed++;
+    if ( ++macBeaconsMissed >= MAC_BEACON_LOST_COUNT ) {
+      // Coordinator lost: non beacon-enabled CSMA/CA until a beacon is heard again
+      macCoordinatorAddress = MAC_COORDINATOR_NONE;
+      macGtsSlots = 0;
+      macGtsRequestPending = ( macGtsRequested != 0 );
+      return;
+    }
+  }
+
+  if ( macGtsRequestPending ) {
+    payload[0] = MAC_COMMAND_GTS_REQUEST;
+    payload[1] = macGtsRequested;
+    if ( macQueueCommand ( ACK_REQUESTED, macCoordinatorAddress, payload, sizeof(payload) ) == MCPS_DATA_REQUEST_SUCCESS ) macGtsRequestPending = false;
+  }
+}
+
+
+void macSendBeacon ( void ) {
+
+  uint8_t *payload;
+  uint8_t k, slot;
+
+  // GTS of the devices gone quiet are freed
+  for ( k=0; k<macGtsCount; ) {
+    if ( (uint8_t)( mac_sqn.beacon - macGtsTable[k].lastUsed ) > MAC_GTS_EXPIRATION ) macAllocateGts ( macGtsTable[k].address, 0 );
+    else k++;
+  }
+
+  macBeaconTxFrame.length = macMakeMacHeader ( FRAME_TYPE_BEACON, NO_ACK_REQUESTED, true, nodePanId, BROADCAST_ADDRESS, mac_sqn.beacon++, macBeaconTxFrame.data );
+  payload = &macBeaconTxFrame.data[macBeaconTxFrame.length];
+  encodeUint16 ( macBeaconInterval, &payload[0] );
+  // The GTS are at the end of the superframe, the first one last
+  slot = MAC_SUPERFRAME_SLOTS;
+  for ( k=0; k<macGtsCount; k++ ) {
+    slot -= macGtsTable[k].slots;
+    encodeUint16 ( macGtsTable[k].address, &payload[MAC_BEACON_HEADER_LENGTH+k*MAC_GTS_DESCRIPTOR_LENGTH] );
+    payload[MAC_BEACON_HEADER_LENGTH+k*MAC_GTS_DESCRIPTOR_LENGTH+2] = slot;
+    payload[MAC_BEACON_HEADER_LENGTH+k*MAC_GTS_DESCRIPTOR_LENGTH+3] = macGtsTable[k].slots;
+  }
+  macFinalCapSlot = slot - 1;
+  payload[2] = macFinalCapSlot;
+  payload[3] = macGtsCount;
+  macBeaconTxFrame.length += MAC_BEACON_HEADER_LENGTH + macGtsCount*MAC_GTS_DESCRIPTOR_LENGTH;
+
+  macSuperframeStart = micros();
+  macBeaconAirTime = phyAirTime ( phyRadioProfile, macBeaconTxFrame.length+PHY_TRAILER_LENGTH );
+  PD_data_request ( &macBeaconTxFrame );
+  macStats.beaconsSent++;
+}
+
+
+void macReceiveBeacon ( struct rxFrame_t *rxFrame, uint16_t sourceAddress, uint8_t sequenceNumber, uint8_t elementIndex ) {
+
+  uint8_t *payload, *descriptor;
+  uint8_t k, count;
+  uint16_t interval;
+
+  if ( elementIndex != NEIGHB_NEIGHBOR_NOT_FOUND ) neighbors[elementIndex].sqn.beacon = sequenceNumber;
+  // A coordinator does not follow another one, a device follows only one
+  if ( macBeaconInterval || ( ( macCoordinatorAddress != MAC_COORDINATOR_NONE ) && ( sourceAddress != macCoordinatorAddress ) ) ) return;
+
+  payload = rxFrame->data + MAC_DATA_FRAME_HEADER_LENGTH;
+  count = payload[3];
+  if ( ( rxFrame->length < MAC_DATA_FRAME_HEADER_LENGTH + MAC_BEACON_HEADER_LENGTH ) || ( count > MAC_GTS_MAX )
+       || ( rxFrame->length < MAC_DATA_FRAME_HEADER_LENGTH + MAC_BEACON_HEADER_LENGTH + count*MAC_GTS_DESCRIPTOR_LENGTH ) ) {
+    macStats.malformedFrames++;
+    return;
+  }
+  interval = decodeUint16 ( &payload[0] );
+  if ( ( interval == 0 ) || ( payload[2] >= MAC_SUPERFRAME_SLOTS ) ) {
+    macStats.malformedFrames++;
+    return;
+  }
+
+  if ( macCoordinatorAddress == MAC_COORDINATOR_NONE ) macGtsRequestPending = ( macGtsRequested != 0 );
+  macCoordinatorAddress = sourceAddress;
+  macSuperframeDuration = (uint32_t)interval * 1000;
+  macBeaconAirTime = phyAirTime ( phyRadioProfile, rxFrame->length+PHY_TRAILER_LENGTH );
+  // The frame is timestamped at the end of its reception
+  macSuperframeStart = rxFrame->timestamp - macBeaconAirTime;
+  macFinalCapSlot = payload[2];
+  macBeaconsMissed = 0;
+
+  macGtsSlots = 0;
+  for ( k=0; k<count; k++ ) {
+    descriptor = &payload[MAC_BEACON_HEADER_LENGTH+k*MAC_GTS_DESCRIPTOR_LENGTH];
+    if ( ( decodeUint16 ( &descriptor[0] ) == nodeShortAddress ) && ( descriptor[2] + descriptor[3] <= MAC_SUPERFRAME_SLOTS ) ) {
+      macGtsFirstSlot = descriptor[2];
+      macGtsSlots = descriptor[3];
+    }
+  }
+  // Request lost, denied or expired: asked again now and then
+  if ( ( macGtsSlots != macGtsRequested ) && ( ( sequenceNumber % MAC_GTS_EXPIRATION ) == 0 ) ) macGtsRequestPending = true;
+}
+
 
+uint8_t macAllocateGts ( uint16_t nodeAddress, uint8_t slots ) {
 
-  uint8_t i,j;
+  uint8_t k, total;
 
-  if ( macFrameToSend )
+  // A request replaces the GTS of the device
+  k = macGetGts ( nodeAddress );
+  if ( k < macGtsCount ) {
+    memmove ( &macGtsTable[k], &macGtsTable[k+1], ( macGtsCount - k - 1 ) * sizeof(struct gts_t) );
+    macGtsCount--;
+  }
+  if ( slots == 0 ) return true;
+
+  total = slots;
+  for ( k=0; k<macGtsCount; k++ ) total += macGtsTable[k].slots;
+  if ( ( macGtsCount == MAC_GTS_MAX ) || ( slots > MAC_SUPERFRAME_SLOTS - MAC_MIN_CAP_SLOTS ) || ( total > MAC_SUPERFRAME_SLOTS - MAC_MIN_CAP_SLOTS ) ) {
+    macStats.gtsDenied++;
+    return false;
+  }
+  macGtsTable[macGtsCount].address = nodeAddress;
+  macGtsTable[macGtsCount].slots = slots;
+  macGtsTable[macGtsCount].lastUsed = mac_sqn.beacon;
+  macGtsCount++;
+  return true;
+}
+
+
+uint8_t macGetGts ( uint16_t nodeAddress ) {
+
+  uint8_t k;
+
+  for ( k=0; k<macGtsCount; k++ )
+    if ( macGtsTable[k].address == nodeAddress ) break;
+  return k;
+}
+
+
+uint32_t macExchangeDuration ( void ) {
+
+  uint32_t duration;
+  uint8_t k;
+
+  if ( macWindowCount ) {
+    duration = MAC_WAIT_BEFORE_SEND_ACK + phyAirTime ( phyRadioProfile, MAC_BLOCK_ACK_FRAME_LENGTH );
+    for ( k=macWindowNextFrame ( 0 ); k<macWindowCount; k=macWindowNextFrame ( k+1 ) )
+      duration += phyAirTime ( phyRadioProfile, macWindowFrame ( k )->length+PHY_TRAILER_LENGTH );
+    return duration;
+  }
+  duration = phyAirTime ( phyRadioProfile, currentTxFrame->length+PHY_TRAILER_LENGTH );
+  if ( currentTxFrame->data[1] & ACK_REQUEST ) duration += MAC_WAIT_BEFORE_SEND_ACK + phyAirTime ( phyRadioProfile, MAC_ACK_FRAME_LENGTH );
+  return duration;
+}
+
+
+uint8_t macInPeriod ( uint32_t start, uint32_t end ) {
+
+  uint32_t elapsed, duration;
+
+  elapsed = micros() - macSuperframeStart;
+  if ( ( elapsed < start ) || ( elapsed >= end ) ) return false;
+
+  if ( !macFitExchange ( end - start ) ) return true;
+  duration = macExchangeDuration();
+  return elapsed + duration <= end;
+}
+
+
+uint8_t macFitExchange ( uint32_t duration ) {
+
+  // The last frames of the window wait for the next one
+  while ( ( macWindowCount > 1 ) && ( macExchangeDuration() > duration ) ) macWindowCount--;
+  macWindowAcked &= ( 1 << macWindowCount ) - 1;
+  return macExchangeDuration() <= duration;
+}
+
+
+uint8_t macQueueCommand ( uint8_t ackRequest, uint16_t destinationAddress, uint8_t* payload, uint8_t payloadLength ) {
+
+  struct txFrame_t *txFrame;
+
+  // The tail slot may hold a frame begun by the upper layer
+  if ( macOpenFrameHeaderLength ) {
+    macStats.txFrameOpen++;
+    return MCPS_DATA_REQUEST_MAC_TX_BUSY;
+  }
+  if ( macTxQueueCount() == MAC_TX_QUEUE_LENGTH ) {
+    macStats.txQueueFull++;
     return MCPS_DATA_REQUEST_MAC_TX_BUSY;
+  }
+
+  // Sequence number and handle of a data frame: it goes through the TX queue like one
+  txFrame = &macTxQueue[macTxQueueTail % MAC_TX_QUEUE_LENGTH];
+  macOpenFrameHeaderLength = macMakeMacHeader ( FRAME_TYPE_MAC_COMMAND, ackRequest, true, nodePanId, destinationAddress, mac_sqn.data, txFrame->data );
+  memcpy ( txFrame->data + macOpenFrameHeaderLength, payload, payloadLength );
+  return macCommitDataFrame ( payloadLength, NULL );
+}
+
+
+void macSetLplInterval ( uint16_t interval ) {
+
+  macLplInterval = interval;
+  macLplAwakeUntil = macLplSampleEnd = micros();
+  macLplNextWakeUp = micros() + (uint32_t)interval * 1000;
+  if ( interval == 0 ) phyWakeUp();
+}
+
+
+uint8_t macLplActive ( void ) {
+
+  // Beacons and GTS need the radio on time
+  return macLplInterval && !macSuperframeActive();
+}
+
+
+uint32_t macLplAckWait ( void ) {
+
+  return MAC_WAIT_BEFORE_SEND_ACK + phyAirTime ( phyRadioProfile, MAC_ACK_FRAME_LENGTH ) + MAC_LPL_ACK_GUARD;
+}
+
+
+uint8_t macLplWakeThreshold ( void ) {
+
+  uint16_t threshold;
+
+  threshold = phyModemSensitivities[phyModemProfile] + MAC_LPL_WAKE_MARGIN;
+  return threshold < macCcaThreshold ? threshold : macCcaThreshold;
+}
+
+
+void macLplStayAwake ( uint32_t duration ) {
+
+  if ( (int32_t)( micros() + duration - macLplAwakeUntil ) > 0 ) macLplAwakeUntil = micros() + duration;
+}
+
+
+void macLplEngine ( void ) {
+
+  uint32_t now;
+
+  if ( !macLplActive() ) {
+    phyWakeUp();
+    return;
+  }
+
+  // Frames to send or to ACK, exchange in progress: the radio stays on, and macLplHold after
+  if ( macTxQueueCount() || macAckPending || phyTxBusy() || ( macRateSwitchState != MAC_RATE_SWITCH_IDLE ) )
+    macLplStayAwake ( (uint32_t)macLplHold * 1000 );
+
+  now = micros();
+  if ( phyRadioAsleep ) {
+    if ( !cmpUi32GreaterWithRollover ( now, macLplNextWakeUp ) ) return;
+    // Wake-up: the samples cover the gap between two strobed copies
+    phyWakeUp();
+    macLplNextWakeUp += (uint32_t)macLplInterval * 1000;
+    if ( cmpUi32GreaterWithRollover ( now, macLplNextWakeUp ) ) macLplNextWakeUp = now + (uint32_t)macLplInterval * 1000;
+    macLplSampleEnd = now + macLplAckWait() + 2 * MAC_LPL_SAMPLE_PERIOD;
+    macLplNextSample = now;
+  }
+  if ( (int32_t)( macLplAwakeUntil - now ) > 0 ) return;
+
+  if ( (int32_t)( macLplSampleEnd - now ) > 0 ) {
+    if ( ( (int32_t)( now - macLplNextSample ) >= 0 ) && !phyTxBusy() ) {
+      macLplNextSample = now + MAC_LPL_SAMPLE_PERIOD;
+      if ( phyEdRequest() >= macLplWakeThreshold() ) {
+        // A strobe on air: listen for its next copy
+        macStats.lplWakeUps++;
+        macLplStayAwake ( phyAirTime ( phyModemProfile, MAX_FRAME_LENGTH+PHY_TRAILER_LENGTH ) + macLplAckWait() );
+      }
+    }
+    return;
+  }
+  phySleep();
+}
+
+
+uint8_t MCPS_data_request ( uint8_t ackRequest, uint8_t intraPan, uint16_t panId, uint16_t destinationAddress, uint8_t* payload, uint8_t payloadLength, uint8_t* handle ) {
+
+
+  uint8_t* framePayload;
+  uint8_t maxPayloadLength, result;
+
+  if ( macAggregatePayload ( ackRequest, intraPan, panId, destinationAddress, payload, payloadLength, handle ) )
+    return MCPS_DATA_REQUEST_SUCCESS;
+
+  framePayload = macBeginDataFrame ( ackRequest, intraPan, panId, destinationAddress, &maxPayloadLength, 0 );
+  if ( framePayload == NULL )
+    return MCPS_DATA_REQUEST_MAC_TX_BUSY;
+  if ( payloadLength > maxPayloadLength ) {
+    macOpenFrameHeaderLength = 0;
+    return MCPS_DATA_REQUEST_FRAME_TOO_LONG;
+  }
+
+  // Copy payload
+  memcpy(framePayload, payload, payloadLength);
+
+  result = macCommitDataFrame ( payloadLength, handle );
+  if ( ( result == MCPS_DATA_REQUEST_SUCCESS ) && macAggregationHold ) {
+    // Next payloads to this destination may join this frame until the CSMA/CA engine takes it
+    macAggregateOpen = true;
+    macAggregateDeadline = micros() + macAggregationHold;
+  }
+  return result;
+}
+
+
+uint8_t macAggregatePayload ( uint8_t ackRequest, uint8_t intraPan, uint16_t panId, uint16_t destinationAddress, uint8_t* payload, uint8_t payloadLength, uint8_t* handle ) {
+
+  struct txFrame_t *txFrame;
+  uint8_t headerLength;
+
+  if ( !macAggregateOpen ) return false;
+
+  txFrame = &macTxQueue[(uint8_t)(macTxQueueTail-1) % MAC_TX_QUEUE_LENGTH];
+  if ( destinationAddress == BROADCAST_ADDRESS )
+    ackRequest = false;
+  if ( ( ( decodeUint16 ( &txFrame->data[0] ) & ~( FRAME_AGGREGATED | FRAME_BLOCK_ACK ) ) != macMakeFrameControlField ( FRAME_TYPE_DATA, ackRequest, intraPan ) )
+       || ( decodeUint16 ( &txFrame->data[3] ) != panId ) || ( decodeUint16 ( &txFrame->data[5] ) != destinationAddress ) )
+    return false;
+
+  headerLength = MAC_DATA_FRAME_HEADER_LENGTH;
+  if ( !( txFrame->data[1] & FRAME_AGGREGATED ) ) {
+    // Second payload: give the first one its length byte
+    if ( txFrame->length + 2 + payloadLength > MAX_FRAME_LENGTH ) return false;
+    memmove ( &txFrame->data[headerLength+1], &txFrame->data[headerLength], txFrame->length - headerLength );
+    txFrame->data[headerLength] = txFrame->length - headerLength;
+    txFrame->data[1] |= FRAME_AGGREGATED;
+    txFrame->length++;
+  } else if ( txFrame->length + 1 + payloadLength > MAX_FRAME_LENGTH ) return false;
+
+  txFrame->data[txFrame->length] = payloadLength;
+  memcpy ( &txFrame->data[txFrame->length+1], payload, payloadLength );
+  txFrame->length += 1 + payloadLength;
+  macStats.aggregatedPayloads++;
+  if ( handle != NULL ) *handle = txFrame->data[2];
+
+  // No room for another payload: send it without waiting
+  if ( txFrame->length + 2 > MAX_FRAME_LENGTH ) macAggregateOpen = false;
+  return true;
+}
+
+
+uint8_t* macBeginDataFrame ( uint8_t ackRequest, uint8_t intraPan, uint16_t panId, uint16_t destinationAddress, uint8_t* maxPayloadLength, uint16_t frameFlags ) {
+
+  struct txFrame_t *txFrame;
+
+  // The tail slot may hold a frame begun by another caller: the sketch (beginFrame), until its commitFrame
+  if ( macOpenFrameHeaderLength ) {
+    macStats.txFrameOpen++;
+    return NULL;
+  }
+  if ( macTxQueueCount() == MAC_TX_QUEUE_LENGTH ) {
+    macStats.txQueueFull++;
+    return NULL;
+  }
+
+  txFrame = &macTxQueue[macTxQueueTail % MAC_TX_QUEUE_LENGTH];
 
   // If the destinationAddress is the broadcast address, ackRequest must me disabled
   if ( destinationAddress == BROADCAST_ADDRESS )
     ackRequest = false;
 
-  // Make MAC header
-  i = macMakeMacHeader ( FRAME_TYPE_DATA, ackRequest, intraPan, panId, destinationAddress, mac_sqn.data, macCurrentTxFrame.data);
+  // Make MAC header. The payload is written by the caller right after it
+  macOpenFrameHeaderLength = macMakeMacHeader ( FRAME_TYPE_DATA, ackRequest, intraPan, panId, destinationAddress, mac_sqn.data, txFrame->data);
+  // A window would not wake the destination up: its frames wait for the block ACK, not for an ACK each
+  if ( macBlockAck && ackRequest && !macLplInterval ) frameFlags |= FRAME_BLOCK_ACK;
+  encodeUint16 ( decodeUint16 ( &txFrame->data[0] ) | frameFlags, &txFrame->data[0] );
+  *maxPayloadLength = MAX_FRAME_LENGTH - macOpenFrameHeaderLength;
 
-  // Copy payload
-  for (j=0; j<payloadLength; j++)
-    macCurrentTxFrame.data[i+j] = payload[j];
-  macCurrentTxFrame.length = i+payloadLength;
+  return txFrame->data + macOpenFrameHeaderLength;
+}
+
+
+uint8_t macCommitDataFrame ( uint8_t payloadLength, uint8_t* handle ) {
+
+  struct txFrame_t *txFrame;
+  struct txConfirm_t *txConfirm;
+
+  if ( macOpenFrameHeaderLength == 0 )
+    return MCPS_DATA_REQUEST_NO_FRAME;
+  if ( payloadLength > MAX_FRAME_LENGTH - macOpenFrameHeaderLength ) {
+    // Dropped: an open frame would hold the tail slot, and refuse all the other frames
+    macOpenFrameHeaderLength = 0;
+    return MCPS_DATA_REQUEST_FRAME_TOO_LONG;
+  }
+
+  txFrame = &macTxQueue[macTxQueueTail % MAC_TX_QUEUE_LENGTH];
+  txFrame->length = macOpenFrameHeaderLength+payloadLength;
+  macOpenFrameHeaderLength = 0;
+  // The frame before this one is not the last of the queue anymore
+  macAggregateOpen = false;
   if ( macDebug ) {
 	Serial.printf("MAC_DEBUG new frame in buffer\n");
   }
 
+  // The sequence number is the handle of the frame
+  txConfirm = &macTxConfirmHistory[mac_sqn.data % MAC_TX_CONFIRM_HISTORY_LENGTH];
+  txConfirm->handle = mac_sqn.data;
+  txConfirm->status = MCPS_DATA_CONFIRM_STATUS_PENDING;
+  if ( handle != NULL ) *handle = mac_sqn.data;
+
   // increment sequence number for the next data frame
   mac_sqn.data++;
-  macFrameToSend = true;
+  macTxQueueTail++;
   return MCPS_DATA_REQUEST_SUCCESS;
 }
 
 
 void MCPS_data_confirm ( struct txFrame_t *txFrame, uint8_t code ) {
 
-  macFrameToSend = false;
+  struct txConfirm_t *txConfirm;
+
+  // The confirmed frame is always the head of the TX queue
+  txConfirm = &macTxConfirmHistory[txFrame->data[2] % MAC_TX_CONFIRM_HISTORY_LENGTH];
+  if ( txConfirm->handle == txFrame->data[2] ) txConfirm->status = code;
+  macTxQueueHead++;
+  MAC_TRACE_EVENT(MAC_TRACE_CONFIRM, code, txFrame->data[2]);
+  // ACKed links: ETX of the destination. A channel access failure says nothing about the link
+  if ( ( txFrame->data[1] & ACK_REQUEST ) && ( code != MCPS_DATA_CONFIRM_STATUS_CHANNEL_ACCESS_FAILURE ) )
+    neighbUpdateEtx ( decodeUint16 ( &txFrame->data[5] ), MAC_MAX_FRAME_RETRIES - currentTxFrameRetries + 1, code == MCPS_DATA_CONFIRM_STATUS_SUCCESS );
+  switch ( code ) {
+    case MCPS_DATA_CONFIRM_STATUS_SUCCESS: macStats.confirmSuccess++; break;
+    case MCPS_DATA_CONFIRM_STATUS_NO_ACK: macStats.confirmNoAck++; break;
+    case MCPS_DATA_CONFIRM_STATUS_CHANNEL_ACCESS_FAILURE: macStats.confirmChannelAccessFailure++; break;
+  }
+
   if ( macDebug ) {
     Serial.printf("MCPS_data_confirm ");
     switch(code) {
@@ -81,9 +771,41 @@ void MCPS_data_confirm ( struct txFrame_t *txFrame, uint8_t code ) {
 }
 
 
+uint8_t macGetTxStatus ( uint8_t handle ) {
+
+  struct txConfirm_t *txConfirm;
+
+  txConfirm = &macTxConfirmHistory[handle % MAC_TX_CONFIRM_HISTORY_LENGTH];
+  if ( txConfirm->handle != handle ) return MCPS_DATA_CONFIRM_STATUS_UNKNOWN;
+  return txConfirm->status;
+}
+
+
+uint8_t macTxQueueCount ( void ) {
+
+  return (uint8_t)(macTxQueueTail - macTxQueueHead);
+}
+
+
 void macEngine ( void ) {
 
   uint8_t backoff, ui8temp;
+  uint32_t slotDuration, hopWait;
+#ifdef MAC_TRACE
+  uint8_t previousState = macCsma_CaState;
+#endif
+
+  macLplEngine();
+
+  // A scheduled ACK preempts the CSMA/CA engine
+  if ( macAckPending ) {
+    if ( !macSendScheduledAck() ) return;
+  }
+
+  // The radio serves the source of a rate switch: no CSMA/CA meanwhile
+  if ( !macRateSwitchEngine() ) return;
+
+  macBeaconEngine();
 
 #ifdef MAC_CBR_ACTIVE
   if ( MAC_CBR_ACTIVE ) {
@@ -96,6 +818,27 @@ void macEngine ( void ) {
 
   switch ( macCsma_CaState ) {
 
+    case MAC_CSMA_CA_BEGIN_OF_PERIOD_STATE:
+
+      // Superframes: wait for the period of the frame, the GTS of this device or the CAP
+      if ( macFrameInGtsEngine && macGtsSlots && macSuperframeActive() ) {
+        slotDuration = macSuperframeDuration / MAC_SUPERFRAME_SLOTS;
+        if ( !macInPeriod ( macGtsFirstSlot * slotDuration, ( macGtsFirstSlot + macGtsSlots ) * slotDuration ) ) break;
+        // The GTS may have shrunk since the frame entered the engine
+        if ( macExchangeDuration() <= macGtsSlots * slotDuration ) {
+          // Collision-free: no backoff nor CCA
+          macStats.gtsAccesses++;
+          macCsma_CaState = MAC_CSMA_CA_TX_FRAME_STATE;
+          break;
+        }
+      }
+      // Too long for the GTS (it would overlap the next one), GTS or coordinator lost: CSMA/CA in the CAP
+      macFrameInGtsEngine = false;
+      if ( !macSuperframeActive() || macInPeriod ( macBeaconAirTime, ( macFinalCapSlot + 1 ) * ( macSuperframeDuration / MAC_SUPERFRAME_SLOTS ) ) )
+        macCsma_CaState = MAC_CSMA_CA_SET_RANDOM_BACKOFF_DELAY_STATE;
+
+      break; // end of MAC_CSMA_CA_BEGIN_OF_PERIOD_STATE
+
     case MAC_CSMA_CA_NEW_FRAME_STATE:
 
       if ( macFrameInCsma_CaEngine ) {
@@ -105,12 +848,30 @@ void macEngine ( void ) {
 
       } else {
 
-        // Check frame presence in buffer
-        if ( macFrameToSend ) {
-          currentTxFrame = &macCurrentTxFrame;
+        // Check frame presence in the TX queue
+        if ( macTxQueueCount() != 0 ) {
+          // The last frame of the queue waits for more payloads until its deadline
+          if ( macAggregateOpen && ( macTxQueueCount() == 1 ) ) {
+            if ( !cmpUi32GreaterWithRollover ( micros(), macAggregateDeadline ) ) break;
+            macAggregateOpen = false;
+          }
+          currentTxFrame = &macTxQueue[macTxQueueHead % MAC_TX_QUEUE_LENGTH];
           currentTxFrameRetries = MAC_MAX_FRAME_RETRIES;
           macFrameInCsma_CaEngine = true;
-        } else break; // end of MAC_CSMA_CA_NEW_FRAME_STATE
+          macRateSwitchSkip = false;
+          macWindowCount = 0;
+          if ( decodeUint16 ( &currentTxFrame->data[0] ) & FRAME_BLOCK_ACK ) macOpenWindow();
+          // The frames to the coordinator go in the GTS of this device, if they fit in it
+          macFrameInGtsEngine = macGtsSlots && macSuperframeActive() && ( decodeUint16 ( &currentTxFrame->data[5] ) == macCoordinatorAddress )
+                                && macFitExchange ( macGtsSlots * ( macSuperframeDuration / MAC_SUPERFRAME_SLOTS ) );
+        } else {
+          // Idle MAC: calibrate the noise floor now and then. The radio is not listening during the sample
+          if ( macAdaptiveCsma && !phyTxBusy() && !phyRadioAsleep && cmpUi32GreaterWithRollover ( micros(), macNoiseFloorNextSample ) ) {
+            macNoiseFloorNextSample = micros() + MAC_NOISE_FLOOR_PERIOD;
+            macNoiseFloorSample ( phyEdRequest() );
+          }
+          break; // end of MAC_CSMA_CA_NEW_FRAME_STATE
+        }
       }
 
       // No break here: go immediately to next step MAC_CSMA_CA_INIT_CSMA_CA_VALUES
@@ -118,17 +879,29 @@ void macEngine ( void ) {
     case MAC_CSMA_CA_INIT_CSMA_CA_VALUES:
 
       macCsma_CaNb = 0;
-      macCsma_CaBe = MAC_MIN_BE;
+      macCsma_CaBe = macMinBe;
+      macLplStrobing = false;
+      macLplCcaRunning = false;
+      macPrepareRateSwitch();
+      if ( macFrameInGtsEngine ) {
+        macCsma_CaState = MAC_CSMA_CA_BEGIN_OF_PERIOD_STATE;
+        break;
+      }
       // No break here: go immediately to next step MAC_CSMA_CA_SET_RANDOM_BACKOFF_DELAY
 
     case MAC_CSMA_CA_SET_RANDOM_BACKOFF_DELAY_STATE:
 
       backoff = 1 << macCsma_CaBe; // 2^BE
       ui8temp = random(backoff);
+      MAC_TRACE_EVENT(MAC_TRACE_BACKOFF, ui8temp, macCsma_CaBe);
       if ( macDebug ) {
         Serial.printf("MAC_DEBUG New CSMA/CA backoff=%d", ui8temp);
       }
       macCsmaCaBackoffDurationTimeout = micros() + MAC_BACKOFF_SLOT_DURATION*ui8temp;
+      if ( macLplActive() && macCsma_CaNb ) {
+        // Busy channel: likely a strobe, that may last a whole wake-up interval
+        macCsmaCaBackoffDurationTimeout = micros() + (uint32_t)macLplInterval * 1000 / backoff * ui8temp;
+      }
       macCsma_CaState = MAC_CSMA_CA_WAIT_BACKOFF_DELAY;
 
       break; // end of MAC_CSMA_CA_SET_RANDOM_BACKOFF_DELAY_STATE
@@ -142,17 +915,56 @@ void macEngine ( void ) {
 
     case MAC_CSMA_CA_PERFORM_CCA:
 
+      // An ACK may still be on air: a CCA would abort it
+      if ( phyTxBusy() ) break;
+
+      // Superframes: the exchange must end in the CAP, else it waits for the next one
+      if ( macSuperframeActive() && !macInPeriod ( macBeaconAirTime, ( macFinalCapSlot + 1 ) * ( macSuperframeDuration / MAC_SUPERFRAME_SLOTS ) ) ) {
+        macCsma_CaState = MAC_CSMA_CA_BEGIN_OF_PERIOD_STATE;
+        break;
+      }
+
+      // Channel hopping: the exchange goes on the channel of the destination, and ends in the slot
+      hopWait = chanTxWait ( decodeUint16 ( &currentTxFrame->data[5] ) );
+      if ( hopWait ) {
+        // Random: the frames deferred to the same slot must not collide at its beginning
+        macCsmaCaBackoffDurationTimeout = micros() + hopWait + MAC_BACKOFF_SLOT_DURATION * random( 1 << macCsma_CaBe );
+        macCsma_CaState = MAC_CSMA_CA_WAIT_BACKOFF_DELAY;
+        break;
+      }
+
       ui8temp = phyEdRequest();
+      MAC_TRACE_EVENT(MAC_TRACE_CCA, ui8temp, macCsma_CaNb);
       if ( macDebug ) {
         Serial.printf(" cca=%d\n", ui8temp);
       }
-      if ( ui8temp < MAC_CCA_MEDIUM_BUSY )
+      macAdaptCsma ( &macCcaBusyRatio, ui8temp >= macCcaThreshold );
+      if ( ui8temp < macCcaThreshold ) {
+        macNoiseFloorSample ( ui8temp );
+        if ( macLplActive() ) {
+          // Low-power listening: the channel must stay free for a whole gap between two strobed copies
+          if ( !macLplCcaRunning ) {
+            macLplCcaRunning = true;
+            macLplCcaEnd = micros() + macLplAckWait();
+          }
+          if ( !cmpUi32GreaterWithRollover ( micros(), macLplCcaEnd ) ) {
+            macCsmaCaBackoffDurationTimeout = micros() + MAC_LPL_SAMPLE_PERIOD;
+            macCsma_CaState = MAC_CSMA_CA_WAIT_BACKOFF_DELAY;
+            break;
+          }
+          macLplCcaRunning = false;
+        }
         macCsma_CaState = MAC_CSMA_CA_TX_FRAME_STATE;
-      else {
+      } else {
+        macLplCcaRunning = false;
+        macStats.ccaBusy++;
         macCsma_CaNb++;
-        macCsma_CaBe++;
+        if ( macCsma_CaBe < MAC_MAX_BE ) macCsma_CaBe++;
         if ( macCsma_CaNb > MAC_MAX_CSMA_CA_BACKOFF ) {
-          // faillure
+          // faillure. In a window, the current frame is its first one, the head of the TX queue:
+          // the next frames get a new window
+          if ( macRateSwitchFrame != NULL ) currentTxFrame = macRateSwitchFrame;
+          macRateSwitchFrame = NULL;
           MCPS_data_confirm ( currentTxFrame, MCPS_DATA_CONFIRM_STATUS_CHANNEL_ACCESS_FAILURE );
           macFrameInCsma_CaEngine = false;
           macCsma_CaState = MAC_CSMA_CA_NEW_FRAME_STATE;
@@ -170,32 +982,111 @@ void macEngine ( void ) {
         if ( macDebug ) {
           Serial.printf("MAC_DEBUG Sending frame\n");
         }
-        PD_data_request ( currentTxFrame );
+        macTxDone = false;
+        if ( macLplActive() && !macLplStrobing ) {
+          // Strobe: copies of the frame until the destination wakes up and ACKs one
+          macLplStrobing = true;
+          macLplStrobeEnd = micros() + (uint32_t)macLplInterval * 1000 + macLplAckWait() + 2 * MAC_LPL_SAMPLE_PERIOD;
+        }
 
-        // Is this frame require ACK?
-        if ( currentTxFrame->data[1] & ACK_REQUEST ) {
-          currentTxFrameAckTimeoutOnLclk = micros()+MAC_ACK_WAIT_DURATION;
-          macCsma_CaState = MAC_CSMA_CA_WAIT_ACK_STATE;
-        } else { 
-          MCPS_data_confirm ( currentTxFrame, MCPS_DATA_CONFIRM_STATUS_SUCCESS );
-          macFrameInCsma_CaEngine = false;
-          macInterframeDurationTimeout = micros() + MAC_INTERFRAME_DELAY;
-          macCsma_CaState = MAC_CSMA_CA_WAIT_INTERFRAME_STATE;
+        if ( currentTxFrame != &macCommandTxFrame ) macStats.txDataFrames++;
+        if ( macWindowCount && ( currentTxFrame != &macCommandTxFrame ) ) {
+          // More frames of the window follow: the destination sends its block ACK after the last one
+          if ( macWindowNextFrame ( macWindowCurrent + 1 ) < macWindowCount ) currentTxFrame->data[1] |= FRAME_PENDING;
+          else currentTxFrame->data[1] &= ~FRAME_PENDING;
         }
+        // Forget ACKs received before: one overheard with the same sequence number would confirm this frame.
+        // Not later: phyEngine may decode the ACK of this frame before macEngine sees the end of the transmission
+        lastAckReceived = currentTxFrame->data[2] + 1;
+        MAC_TRACE_EVENT(MAC_TRACE_TX_START, currentTxFrame->data[2], currentTxFrame->length);
+        PD_data_request ( currentTxFrame );
+        macCsma_CaState = MAC_CSMA_CA_WAIT_TX_DONE_STATE;
       } else {
         if ( macDebug ) {
           Serial.printf("MAC_DEBUG MAC_MAX_FRAME_RETRIES attempt\n");
         }
-        MCPS_data_confirm ( currentTxFrame, MCPS_DATA_CONFIRM_STATUS_NO_ACK );
+        if ( macWindowCount ) macConfirmWindow ( true, MCPS_DATA_CONFIRM_STATUS_NO_ACK );
+        else MCPS_data_confirm ( currentTxFrame, MCPS_DATA_CONFIRM_STATUS_NO_ACK );
         macFrameInCsma_CaEngine = false;
         macCsma_CaState = MAC_CSMA_CA_NEW_FRAME_STATE;
       }
 
       break; // end of MAC_CSMA_CA_TX_FRAME_STATE
 
+    case MAC_CSMA_CA_WAIT_TX_DONE_STATE:
+
+      if ( !macTxDone ) break;
+
+      if ( macWindowCount && ( currentTxFrame != &macCommandTxFrame ) ) {
+        // The next frames of the window follow right away: no backoff, the channel is ours
+        ui8temp = macWindowNextFrame ( macWindowCurrent + 1 );
+        if ( ui8temp < macWindowCount ) {
+          macWindowCurrent = ui8temp;
+          currentTxFrame = macWindowFrame ( ui8temp );
+          macCsma_CaState = MAC_CSMA_CA_TX_FRAME_STATE;
+        } else {
+          macBlockAckReceived = false;
+          macWindowProgress = false;
+          currentTxFrameAckTimeoutOnLclk = micros()+macAckWaitDuration();
+          macCsma_CaState = MAC_CSMA_CA_WAIT_ACK_STATE;
+        }
+        break;
+      }
+
+      // Is this frame require ACK?
+      if ( currentTxFrame->data[1] & ACK_REQUEST ) {
+        currentTxFrameAckTimeoutOnLclk = micros() + ( macLplStrobing ? macLplAckWait() : macAckWaitDuration() );
+        macCsma_CaState = MAC_CSMA_CA_WAIT_ACK_STATE;
+      } else if ( macLplStrobing && !cmpUi32GreaterWithRollover ( micros(), macLplStrobeEnd ) ) {
+        // Broadcast: copies back to back for a whole wake-up interval
+        macStats.lplStrobes++;
+        macCsma_CaState = MAC_CSMA_CA_TX_FRAME_STATE;
+      } else { 
+        MCPS_data_confirm ( currentTxFrame, MCPS_DATA_CONFIRM_STATUS_SUCCESS );
+        macFrameInCsma_CaEngine = false;
+        macInterframeDurationTimeout = micros() + MAC_INTERFRAME_DELAY;
+        macCsma_CaState = MAC_CSMA_CA_WAIT_INTERFRAME_STATE;
+      }
+
+      break; // end of MAC_CSMA_CA_WAIT_TX_DONE_STATE
+
     case MAC_CSMA_CA_WAIT_ACK_STATE:
 
+      if ( macWindowCount && ( currentTxFrame != &macCommandTxFrame ) ) {
+        if ( macBlockAckReceived || cmpUi32GreaterWithRollover(micros(), currentTxFrameAckTimeoutOnLclk ) ) {
+          macAdaptCsma ( &macTxFailureRatio, !macBlockAckReceived );
+          macAdaptRate ( decodeUint16 ( &currentTxFrame->data[5] ), macBlockAckReceived && macWindowProgress, 0 );
+          macConfirmWindow ( false, MCPS_DATA_CONFIRM_STATUS_SUCCESS );
+          if ( macWindowCount == 0 ) {
+            macFrameInCsma_CaEngine = false;
+            macInterframeDurationTimeout = micros() + MAC_INTERFRAME_DELAY;
+            macCsma_CaState = MAC_CSMA_CA_WAIT_INTERFRAME_STATE;
+            break;
+          }
+          // Only the frames not ACKed are sent again. A round that ACKed some frames is not a retry
+          if ( !macWindowProgress ) {
+            currentTxFrameRetries--;
+            if ( currentTxFrameRetries >= 0 ) macStats.retries++;
+          }
+          macWindowCurrent = 0;
+          currentTxFrame = macWindowFrame ( 0 );
+          macCsma_CaState = MAC_CSMA_CA_INIT_CSMA_CA_VALUES;
+        }
+        break;
+      }
+
       if ( lastAckReceived == currentTxFrame->data[2] ) {
+        macAdaptCsma ( &macTxFailureRatio, false );
+        if ( currentTxFrame == &macCommandTxFrame ) {
+          // Rate switch accepted: the destination receives with the profile of the link now, the frame follows at once
+          phySetRadioProfile ( macCommandTxFrame.data[MAC_DATA_FRAME_HEADER_LENGTH+1] );
+          currentTxFrame = macRateSwitchFrame;
+          macRateSwitchFrame = NULL;
+          macStats.rateSwitches++;
+          macCsma_CaState = MAC_CSMA_CA_TX_FRAME_STATE;
+          break;
+        }
+        macAdaptRate ( decodeUint16 ( &currentTxFrame->data[5] ), true, lastAckRssi );
         MCPS_data_confirm ( currentTxFrame, MCPS_DATA_CONFIRM_STATUS_SUCCESS );
         macFrameInCsma_CaEngine = false;
         macInterframeDurationTimeout = micros() + MAC_INTERFRAME_DELAY;
@@ -203,7 +1094,21 @@ void macEngine ( void ) {
       } else {
         // Is this ACK in timeout ?
         if ( cmpUi32GreaterWithRollover(micros(), currentTxFrameAckTimeoutOnLclk )) {
-          currentTxFrameRetries--;
+          if ( macLplStrobing && !cmpUi32GreaterWithRollover ( micros(), macLplStrobeEnd ) ) {
+            // The destination may still sleep: next copy
+            macStats.lplStrobes++;
+            macCsma_CaState = MAC_CSMA_CA_TX_FRAME_STATE;
+            break;
+          }
+          macAdaptCsma ( &macTxFailureRatio, true );
+          if ( currentTxFrame == &macCommandTxFrame ) {
+            // The destination may be busy: the frame goes with the profile of the network, not a retry
+            macRateSwitchSkip = true;
+          } else {
+            macAdaptRate ( decodeUint16 ( &currentTxFrame->data[5] ), false, 0 );
+            currentTxFrameRetries--;
+            if ( currentTxFrameRetries >= 0 ) macStats.retries++;
+          }
           macCsma_CaState = MAC_CSMA_CA_INIT_CSMA_CA_VALUES;
         }
       }
@@ -212,6 +1117,8 @@ void macEngine ( void ) {
 
     case MAC_CSMA_CA_WAIT_INTERFRAME_STATE:
 
+      // Exchange over: listen with the profile of the network
+      phySetRadioProfile ( phyModemProfile );
       if ( cmpUi32GreaterWithRollover(micros(), macInterframeDurationTimeout) )
         macCsma_CaState = MAC_CSMA_CA_NEW_FRAME_STATE;
 
@@ -221,6 +1128,11 @@ void macEngine ( void ) {
 
       break;
   }
+
+#ifdef MAC_TRACE
+  if ( macCsma_CaState != previousState )
+    macTraceRecord(MAC_TRACE_STATE, macCsma_CaState, previousState);
+#endif
 }
 
 
@@ -248,7 +1160,7 @@ uint8_t macMakeMacHeader ( uint8_t frameType, uint8_t ackRequest, uint8_t intraP
   encodeUint16 ( destinationAddress, &buffer[5] );
   encodeUint16 ( nodeShortAddress, &buffer[7] );
 
-  return (9);
+  return MAC_DATA_FRAME_HEADER_LENGTH;
 }
 
 
@@ -266,24 +1178,120 @@ uint8_t macDecodeMacHeader ( uint8_t *frameType, uint8_t *ackRequest, uint8_t *i
   *destinationAddress = decodeUint16 ( &buffer[5] );
   *sourceAddress = decodeUint16 ( &buffer[7] );
 
-  return (9);
+  return MAC_DATA_FRAME_HEADER_LENGTH;
 }
 
 
 void macSendAck ( uint8_t sqn ) {
 
-  struct txFrame_t txFrame;
+  macAckTxFrame.length = MAC_ACK_FRAME_LENGTH;
+  encodeUint16 ( macMakeFrameControlField ( FRAME_TYPE_ACK, NO_ACK_REQUESTED, true ), &(macAckTxFrame.data[0]) );
+  macAckTxFrame.data[2] = sqn;
+  PD_data_request ( &macAckTxFrame );
+  MAC_TRACE_EVENT(MAC_TRACE_ACK_TX, sqn, 0);
+  macStats.acksSent++;
+}
+
+
+void macSendBlockAck ( uint16_t destinationAddress, uint8_t sqn, uint32_t bitmap ) {
+
+  macAckTxFrame.length = macMakeMacHeader ( FRAME_TYPE_BLOCK_ACK, NO_ACK_REQUESTED, true, nodePanId, destinationAddress, sqn, macAckTxFrame.data );
+  encodeUint32 ( bitmap, &macAckTxFrame.data[macAckTxFrame.length] );
+  macAckTxFrame.length += 4;
+  PD_data_request ( &macAckTxFrame );
+  MAC_TRACE_EVENT(MAC_TRACE_ACK_TX, sqn, 1);
+  macStats.acksSent++;
+}
+
+
+void macOpenWindow ( void ) {
+
+  uint8_t count;
+  struct txFrame_t *txFrame;
+
+  // The frame still open for aggregation can't be sent yet
+  count = macTxQueueCount();
+  if ( macAggregateOpen ) count--;
+  if ( count > MAC_BLOCK_ACK_WINDOW ) count = MAC_BLOCK_ACK_WINDOW;
 
-  txFrame.length = MAC_ACK_FRAME_LENGTH;
-  encodeUint16 ( macMakeFrameControlField ( FRAME_TYPE_ACK, NO_ACK_REQUESTED, true ), &(txFrame.data[0]) );
-  txFrame.data[2] = sqn;
-  PD_data_request ( &txFrame );
+  for ( macWindowCount=1; macWindowCount<count; macWindowCount++ ) {
+    txFrame = macWindowFrame ( macWindowCount );
+    if ( !( decodeUint16 ( &txFrame->data[0] ) & FRAME_BLOCK_ACK ) || ( decodeUint16 ( &txFrame->data[5] ) != decodeUint16 ( &currentTxFrame->data[5] ) ) ) break;
+  }
+  macWindowCurrent = 0;
+  macWindowAcked = 0;
+}
+
+
+struct txFrame_t* macWindowFrame ( uint8_t k ) {
+
+  return &macTxQueue[(uint8_t)(macTxQueueHead+k) % MAC_TX_QUEUE_LENGTH];
+}
+
+
+uint8_t macWindowNextFrame ( uint8_t k ) {
+
+  while ( ( k < macWindowCount ) && ( macWindowAcked & ( 1 << k ) ) ) k++;
+  return k;
+}
+
+
+void macConfirmWindow ( uint8_t all, uint8_t status ) {
+
+  // MCPS_data_confirm pops the head of the TX queue: frame 0 of the window
+  while ( macWindowCount && ( all || ( macWindowAcked & 1 ) ) ) {
+    MCPS_data_confirm ( macWindowFrame ( 0 ), ( macWindowAcked & 1 ) ? MCPS_DATA_CONFIRM_STATUS_SUCCESS : status );
+    macWindowAcked >>= 1;
+    macWindowCount--;
+  }
+}
+
+
+void macReceiveBlockAck ( uint8_t sqn, uint32_t bitmap ) {
+
+  uint8_t k, age;
+  uint16_t acked;
+
+  acked = macWindowAcked;
+  for ( k=0; k<macWindowCount; k++ ) {
+    age = sqn - macWindowFrame ( k )->data[2];
+    if ( ( age < 32 ) && ( ( bitmap >> age ) & 1 ) ) acked |= 1 << k;
+  }
+  if ( acked != macWindowAcked ) macWindowProgress = true;
+  macWindowAcked = acked;
+  macBlockAckReceived = true;
+  macStats.acksReceived++;
+  MAC_TRACE_EVENT(MAC_TRACE_BLOCK_ACK_RX, sqn, acked);
+}
+
+
+uint8_t macSendScheduledAck ( void ) {
+
+  int32_t wait;
+
+  wait = (int32_t)( macAckTime - micros() );
+  if ( wait > MAC_ACK_SPIN_MAX ) return false;
+
+  macAckPending = false;
+  if ( wait < (int32_t)( MAC_WAIT_BEFORE_SEND_ACK - macAckWaitDuration() ) ) {
+    // Too late, the source does not wait for it anymore
+    macStats.acksLate++;
+    return true;
+  }
+  // Close enough: wait for the exact turnaround time
+  if ( wait > 0 ) delayMicroseconds ( wait );
+  if ( macDebug ) {
+    Serial.printf("MAC_DEBUG Sending ACK sqn=%d\n", macAckSequenceNumber);
+  }
+  if ( macAckType == FRAME_TYPE_BLOCK_ACK ) macSendBlockAck ( macAckDestination, macAckSequenceNumber, macAckBitmap );
+  else macSendAck ( macAckSequenceNumber );
+  return true;
 }
 
 
 void macDecodeReceivedFrame ( struct rxFrame_t *rxFrame ) {
 
-  uint8_t i;
+  uint8_t i, neighborsCountBefore, ui8temp;
   uint8_t frameType;
   uint8_t ackRequest;
   uint8_t intraPan;
@@ -291,16 +1299,18 @@ void macDecodeReceivedFrame ( struct rxFrame_t *rxFrame ) {
   uint16_t destinationAddress;
   uint16_t sourceAddress;
   uint8_t sequenceNumber;
-  uint8_t headerLength;
 
-  headerLength = macDecodeMacHeader (&frameType,&ackRequest,&intraPan,&panId,
-                                     &destinationAddress,&sourceAddress,
-                                     &sequenceNumber,rxFrame->data);
+  macDecodeMacHeader (&frameType,&ackRequest,&intraPan,&panId,
+                      &destinationAddress,&sourceAddress,
+                      &sequenceNumber,rxFrame->data);
 
   if ( frameType == FRAME_TYPE_ACK ) {
 
     if ( rxFrame->length == MAC_ACK_FRAME_LENGTH ) {
       lastAckReceived = rxFrame->data[2];
+      lastAckRssi = rxFrame->rssi;
+      macStats.acksReceived++;
+      MAC_TRACE_EVENT(MAC_TRACE_ACK_RX, lastAckReceived, macCsma_CaState == MAC_CSMA_CA_WAIT_ACK_STATE && lastAckReceived == currentTxFrame->data[2]);
       if ( macDebug ) {
         Serial.printf("MAC_DEBUG An ack with sqn=%02x has been received\n", rxFrame->data[2]);
       }
@@ -314,6 +1324,7 @@ void macDecodeReceivedFrame ( struct rxFrame_t *rxFrame ) {
     if ( panId != nodePanId ) {
 
       // This frame is not for my PanID. Drop it
+      macStats.foreignPan++;
       if ( macDebug ) {
         Serial.printf("MAC_DEBUG Another PanId received\n");
       }
@@ -323,85 +1334,191 @@ void macDecodeReceivedFrame ( struct rxFrame_t *rxFrame ) {
     // This frame contains addressing fields. Look for the source presence in the neighbor table
     //printf(" panId=%x destinationAddress=%x sourceAddress=%x\n",panId,destinationAddress,sourceAddress);
 
-    i = neighbGetNeighborIndex ( sourceAddress );
+    // One lookup per frame: i is the source entry (found or added), NEIGHB_NEIGHBOR_NOT_FOUND if the table is full
+    neighborsCountBefore = neighborsCount;
+    i = neighbAddNeighbor ( sourceAddress, rxFrame->timestamp, rxFrame->rssi );
 
     if ( i == NEIGHB_NEIGHBOR_NOT_FOUND ) {
-
-      i = neighbAddNeighbor ( sourceAddress, rxFrame->timestamp, rxFrame->rssi );
-      if ( i > 1 ) {
-        if ( macDebug ) {
-          Serial.printf("MAC_DEBUG neighbAddNeighbor() duplicated node in neighb table\n");
-        }
-      } else if ( i == -1 ) {
-        if ( macDebug ) {
-          Serial.printf("Neighbor table is full\n");
-        }
-      } else {
-        i = neighbGetNeighborIndex ( sourceAddress );
-        if ( macDebug ) {
-          Serial.printf("MAC_DEBUG new neighbour (#%d)\n", i);
-          neighbPrintNeighbors();
-        }
+      macStats.neighborTableFull++;
+      if ( macDebug ) {
+        Serial.printf("Neighbor table is full\n");
+      }
+    } else if ( neighborsCount != neighborsCountBefore ) {
+      if ( macDebug ) {
+        Serial.printf("MAC_DEBUG new neighbour (#%d)\n", i);
+        neighbPrintNeighbors();
       }
     } else {
       // Update required fields
       neighbors[i].lastRssi = rxFrame->rssi;
       neighbors[i].lastUpdate = rxFrame->timestamp;
     }
+    // The rate switch commands have their own sequence numbers (mac_sqn.mac_command): they would add gaps
+    if ( i != NEIGHB_NEIGHBOR_NOT_FOUND )
+      neighbUpdateLinkQuality ( i, rxFrame->rssi, ( frameType == FRAME_TYPE_DATA ) || ( ( frameType == FRAME_TYPE_MAC_COMMAND )
+                                && ( rxFrame->length > MAC_DATA_FRAME_HEADER_LENGTH ) && ( rxFrame->data[MAC_DATA_FRAME_HEADER_LENGTH] != MAC_COMMAND_RATE_SWITCH ) ), sequenceNumber );
+#ifdef PHY_TIMESTAMPS_AT_TX
+    if ( i != NEIGHB_NEIGHBOR_NOT_FOUND ) neighbUpdateClock ( i, rxFrame->timestamp, rxFrame->txTimestamp, rxFrame->length );
+#endif
+
+    // Rate switch: the source sends its next frame right after this one
+    if ( ( macRateSwitchState == MAC_RATE_SWITCH_RECEIVING ) && ( sourceAddress == macRateSwitchSource ) )
+      macRateSwitchTimeout = rxFrame->timestamp + phyAirTime ( phyRadioProfile, MAX_FRAME_LENGTH+PHY_TRAILER_LENGTH ) + MAC_RATE_SWITCH_GUARD;
+
+    // Low-power listening: more frames may follow a unicast exchange, the other frames are over
+    if ( destinationAddress == nodeShortAddress ) macLplStayAwake ( (uint32_t)macLplHold * 1000 );
+    else macLplAwakeUntil = micros();
 
     if ( ( destinationAddress == nodeShortAddress ) || ( destinationAddress == BROADCAST_ADDRESS )) {
 
       // The frame is for this node or broadcast
-      // the hardware does not manage ACK. Send it if required
-      if ( ackRequest ) {
-        delayMicroseconds(MAC_WAIT_BEFORE_SEND_ACK);
-        if ( macDebug ) {
-          Serial.printf("MAC_DEBUG Sending ACK to %04X sqn=%d\n", sourceAddress, sequenceNumber);
-        }
-        macSendAck ( sequenceNumber );
-        if ( macDebug ) {
-          Serial.printf("MAC_DEBUG ACK sent\n");
-        }
-      }
-
       switch ( frameType ) {
 
         case FRAME_TYPE_BEACON: 
 
+          macReceiveBeacon ( rxFrame, sourceAddress, sequenceNumber, i );
           break;
    
         case FRAME_TYPE_DATA:
 
-  	  // getting last sqn.data for this source. If duplicate frame detected, free the frame
-          i = neighbGetNeighborIndex ( sourceAddress );
+  	  // data window of this source (i found above). If duplicate frame detected, free the frame
+          macStats.rxDataFrames++;
+          // Coordinator: the GTS of the source is in use
+          ui8temp = macGetGts ( sourceAddress );
+          if ( ui8temp < macGtsCount ) macGtsTable[ui8temp].lastUsed = mac_sqn.beacon;
 
-          if ( neighbors[i].sqn.data == sequenceNumber ) {
+          if ( ( rxFrame->data[1] & FRAME_AGGREGATED ) && !macCheckAggregate ( rxFrame, MAC_DATA_FRAME_HEADER_LENGTH ) ) {
+            // recv would read past the frame: drop it without ACK
+            macStats.malformedFrames++;
+            if ( macDebug ) {
+              Serial.printf("MAC_DEBUG Malformed aggregated frame from %04X dropped\n", sourceAddress);
+            }
+            return;
+          }
+
+          if ( ( i != NEIGHB_NEIGHBOR_NOT_FOUND ) && neighbIsDuplicateData ( i, sequenceNumber ) ) {
+            macStats.duplicates++;
             if ( macDebug ) {
 	      Serial.printf("Duplicated frame %d from %04X\n", sequenceNumber, sourceAddress);
 	    }
+  	  } else if ( decodeUint16 ( &rxFrame->data[0] ) & FRAME_FRAGMENT ) {
+            // Copied in a reassembly slot: the frame is freed
+            if ( !fragIndication ( sourceAddress, rxFrame->data+MAC_DATA_FRAME_HEADER_LENGTH, rxFrame->length-MAC_DATA_FRAME_HEADER_LENGTH ) ) {
+              if ( macDebug ) {
+                Serial.printf("MAC_DEBUG No reassembly slot, fragment from %04X dropped\n", sourceAddress);
+              }
+              if ( !( decodeUint16 ( &rxFrame->data[0] ) & FRAME_BLOCK_ACK ) ) return;
+              break;
+            }
+            if ( i != NEIGHB_NEIGHBOR_NOT_FOUND ) neighbRecordData ( i, sequenceNumber );
+  	  } else if ( ( decodeUint16 ( &rxFrame->data[0] ) & FRAME_ROUTED )
+                      && ( ( ui8temp = routeIndication ( sourceAddress, rxFrame->data+MAC_DATA_FRAME_HEADER_LENGTH, rxFrame->length-MAC_DATA_FRAME_HEADER_LENGTH ) ) != ROUTE_INDICATION_DELIVER ) ) {
+            // For another node: copied in the forwarding queue, the frame is freed
+            if ( ui8temp == ROUTE_INDICATION_QUEUE_FULL ) {
+              if ( macDebug ) {
+                Serial.printf("MAC_DEBUG Forwarding queue full, frame from %04X dropped\n", sourceAddress);
+              }
+              if ( !( decodeUint16 ( &rxFrame->data[0] ) & FRAME_BLOCK_ACK ) ) return;
+              break;
+            }
+            if ( i != NEIGHB_NEIGHBOR_NOT_FOUND ) neighbRecordData ( i, sequenceNumber );
   	  } else {
+            //MCPS_data_indication ( rxFrame, sourceAddress ); the network layer is route.c. Keep the frame in the PHY queue until recv
+            if ( !phyRxQueueCommit ( rxFrame ) ) {
+              // No room left for the payload: don't ACK, the source will retry later.
+              // A block ACK is sent anyway: the gap in its bitmap asks for this frame again
+              if ( macDebug ) {
+                Serial.printf("MAC_DEBUG RX queue full, frame from %04X dropped\n", sourceAddress);
+              }
+              if ( !( decodeUint16 ( &rxFrame->data[0] ) & FRAME_BLOCK_ACK ) ) return;
+              break;
+            }
 	    if ( macDebug ) {
 	      Serial.printf("RX_DATA from %04X: calling MCPS_data_indication\n", sourceAddress);
 	    }
- 	    neighbors[i].sqn.data = sequenceNumber;
-            //MCPS_data_indication ( rxFrame, sourceAddress ); no NWK layer. Simply prepare gloabal vars to recv payload
-
-            macLastPayload = rxFrame->data+headerLength;
-            macLastPayloadLen = rxFrame->length - headerLength;
-            macLastSourceAddressReceived = sourceAddress;
-            macFrameReceived = true;
+            if ( i != NEIGHB_NEIGHBOR_NOT_FOUND ) neighbRecordData ( i, sequenceNumber );
+            if ( decodeUint16 ( &rxFrame->data[0] ) & FRAME_ROUTED ) routeRecordOrigin ( rxFrame->data+MAC_DATA_FRAME_HEADER_LENGTH );
           }
 
           break;
 
         case FRAME_TYPE_MAC_COMMAND:
-   
+
+          // All the commands have one parameter at least
+          if ( rxFrame->length < MAC_DATA_FRAME_HEADER_LENGTH + 2 ) break;
+
+          if ( rxFrame->data[MAC_DATA_FRAME_HEADER_LENGTH] == MAC_COMMAND_TIME_SYNC ) {
+#ifdef PHY_TIMESTAMPS_AT_TX
+            syncIndication ( sourceAddress, rxFrame->data+MAC_DATA_FRAME_HEADER_LENGTH, rxFrame->length-MAC_DATA_FRAME_HEADER_LENGTH,
+                             rxFrame->timestamp, rxFrame->txTimestamp, rxFrame->length );
+#endif
+            break;
+          }
+
+          if ( ( rxFrame->data[MAC_DATA_FRAME_HEADER_LENGTH] >= MAC_COMMAND_ROUTE_BEACON ) && ( rxFrame->data[MAC_DATA_FRAME_HEADER_LENGTH] <= MAC_COMMAND_ROUTE_REPLY ) ) {
+            routeCommandIndication ( sourceAddress, rxFrame->data+MAC_DATA_FRAME_HEADER_LENGTH, rxFrame->length-MAC_DATA_FRAME_HEADER_LENGTH );
+            break;
+          }
+
+          if ( rxFrame->data[MAC_DATA_FRAME_HEADER_LENGTH] == MAC_COMMAND_CHANNEL_MAP ) {
+            chanIndication ( sourceAddress, rxFrame->data+MAC_DATA_FRAME_HEADER_LENGTH, rxFrame->length-MAC_DATA_FRAME_HEADER_LENGTH );
+            break;
+          }
+
+          if ( rxFrame->data[MAC_DATA_FRAME_HEADER_LENGTH] == MAC_COMMAND_GTS_REQUEST ) {
+            // Coordinator: the answer is in the next beacons
+            if ( macBeaconInterval && ( destinationAddress == nodeShortAddress ) ) macAllocateGts ( sourceAddress, rxFrame->data[MAC_DATA_FRAME_HEADER_LENGTH+1] );
+            break;
+          }
+
+          if ( rxFrame->data[MAC_DATA_FRAME_HEADER_LENGTH] != MAC_COMMAND_RATE_SWITCH ) break;
+          // Rate switch, accepted if the radio is free for the whole exchange. Not ACKed else:
+          // the source sends its frame with the profile of the network
+          if ( ( destinationAddress != nodeShortAddress ) || !ackRequest || ( rxFrame->data[MAC_DATA_FRAME_HEADER_LENGTH+1] >= PHY_MODEM_PROFILES )
+               || ( macRateSwitchState != MAC_RATE_SWITCH_IDLE ) || ( macCsma_CaState == MAC_CSMA_CA_TX_FRAME_STATE )
+               || ( macCsma_CaState == MAC_CSMA_CA_WAIT_TX_DONE_STATE ) || ( macCsma_CaState == MAC_CSMA_CA_WAIT_ACK_STATE ) )
+            return;
+          macRateSwitchState = MAC_RATE_SWITCH_ACCEPTED;
+          macRateSwitchSource = sourceAddress;
+          macRateSwitchProfile = rxFrame->data[MAC_DATA_FRAME_HEADER_LENGTH+1];
+
+          break;
+
+        case FRAME_TYPE_BLOCK_ACK:
+
+          // For the window being sent?
+          if ( ( rxFrame->length == MAC_BLOCK_ACK_FRAME_LENGTH ) && macWindowCount && ( macCsma_CaState == MAC_CSMA_CA_WAIT_ACK_STATE )
+               && ( sourceAddress == decodeUint16 ( &currentTxFrame->data[5] ) ) )
+            macReceiveBlockAck ( sequenceNumber, decodeUint32 ( &rxFrame->data[MAC_DATA_FRAME_HEADER_LENGTH] ) );
+
           break;
 
         default:
    
           break;
       }
+
+      // the hardware does not manage ACK. Schedule it if required: macEngine sends it after the turnaround time
+      if ( ackRequest && ( destinationAddress != BROADCAST_ADDRESS ) ) {
+        macAckType = FRAME_TYPE_ACK;
+        macAckSequenceNumber = sequenceNumber;
+        if ( decodeUint16 ( &rxFrame->data[0] ) & FRAME_BLOCK_ACK ) {
+          // Window: one block ACK after its last frame, with the data window of the source
+          if ( rxFrame->data[1] & FRAME_PENDING ) return;
+          macAckType = FRAME_TYPE_BLOCK_ACK;
+          macAckDestination = sourceAddress;
+          macAckBitmap = 0;
+          if ( ( i != NEIGHB_NEIGHBOR_NOT_FOUND ) && neighbors[i].sqn.dataWindow ) {
+            macAckSequenceNumber = neighbors[i].sqn.data;
+            macAckBitmap = neighbors[i].sqn.dataWindow;
+          }
+        }
+        macAckPending = true;
+        macAckTime = rxFrame->timestamp + MAC_WAIT_BEFORE_SEND_ACK;
+        // Last frame of a rate switch exchange: back to the profile of the network after its ACK
+        if ( ( macRateSwitchState == MAC_RATE_SWITCH_RECEIVING ) && ( sourceAddress == macRateSwitchSource ) && !( rxFrame->data[1] & FRAME_PENDING ) )
+          macRateSwitchState = MAC_RATE_SWITCH_ENDING;
+      }
     } else {
 
       // This frame is not for me. Ignore it
@@ -410,16 +1527,78 @@ void macDecodeReceivedFrame ( struct rxFrame_t *rxFrame ) {
 }
 
 
+uint8_t macCheckAggregate ( struct rxFrame_t *rxFrame, uint8_t headerLength ) {
+
+  uint16_t offset; // a length byte may point past 255
+
+  if ( rxFrame->length <= headerLength ) return false;
+  for ( offset=headerLength; offset<rxFrame->length; offset+=1+rxFrame->data[offset] ) ;
+  return offset == rxFrame->length;
+}
+
+
+struct rxFrame_t* macGetReceivedPayload ( uint16_t* sourceAddress, uint8_t** payload, uint8_t* payloadLength ) {
+
+  struct rxFrame_t *rxFrame;
+  uint8_t frameType, ackRequest, intraPan, sequenceNumber, headerLength;
+  uint16_t panId, destinationAddress;
+
+  rxFrame = phyRxQueueFront();
+  if ( rxFrame == NULL ) return NULL;
+
+  headerLength = macDecodeMacHeader (&frameType,&ackRequest,&intraPan,&panId,
+                                     &destinationAddress,sourceAddress,
+                                     &sequenceNumber,rxFrame->data);
+  if ( rxFrame->data[1] & FRAME_AGGREGATED ) {
+    // One payload at a time, checked by macCheckAggregate on reception
+    if ( macRxAggregateOffset == 0 ) macRxAggregateOffset = headerLength;
+    *payload = rxFrame->data+macRxAggregateOffset+1;
+    *payloadLength = rxFrame->data[macRxAggregateOffset];
+    return rxFrame;
+  }
+  if ( decodeUint16 ( &rxFrame->data[0] ) & FRAME_ROUTED ) {
+    // Through other nodes: the source is the origin of the network header
+    *sourceAddress = decodeUint16 ( &rxFrame->data[headerLength+ROUTE_HEADER_ORIGIN] );
+    headerLength += ROUTE_HEADER_LENGTH;
+  }
+  *payload = rxFrame->data+headerLength;
+  *payloadLength = rxFrame->length - headerLength;
+  return rxFrame;
+}
+
+
+void macFreeReceivedPayload ( void ) {
+
+  struct rxFrame_t *rxFrame;
+
+  rxFrame = phyRxQueueFront();
+  if ( rxFrame == NULL ) return;
+  if ( rxFrame->data[1] & FRAME_AGGREGATED ) {
+    if ( macRxAggregateOffset == 0 ) macRxAggregateOffset = MAC_DATA_FRAME_HEADER_LENGTH;
+    macRxAggregateOffset += 1 + rxFrame->data[macRxAggregateOffset];
+    if ( macRxAggregateOffset < rxFrame->length ) return;
+    macRxAggregateOffset = 0;
+  }
+  phyRxQueuePop();
+}
+
+
 void macSendCbrFrame() {
 
 #ifdef MAC_CBR_ACTIVE
   uint8_t data[CBR_TX_LENGTH];
 
   makeRandomBytes(data, CBR_TX_LENGTH);
+  // Generation time first: the receiver can measure the end-to-end latency
+  if ( CBR_TX_LENGTH >= 4 ) encodeUint32(micros(), data);
+  macStats.cbrGenerated++;
 
-  if ( MCPS_data_request ( MAC_CBR_ACK_REQUESTED, true, nodePanId, MAC_CBR_DESTINATION_SHORT_ADDRESS, data, CBR_TX_LENGTH ) != MCPS_DATA_REQUEST_SUCCESS ) {
+  if ( MCPS_data_request ( MAC_CBR_ACK_REQUESTED, true, nodePanId, MAC_CBR_DESTINATION_SHORT_ADDRESS, data, CBR_TX_LENGTH, NULL ) != MCPS_DATA_REQUEST_SUCCESS ) {
 
-    Serial.printf("MAC_CBR_DEBUG congestion at MAC layer\n");
+    macStats.cbrRejected++;
+    if ( macDebug ) {
+      Serial.printf("MAC_CBR_DEBUG congestion at MAC layer\n");
+    }
   }
 #endif
 }
@@ -462,41 +1641,110 @@ void neighbFreeNeighborTable ( void ) {
  
   uint8_t i;
   
-  for ( i=0; i<NEIGHB_TABLE_MAX_NEIGHBORS_COUNT; i++ ) {
+  for ( i=0; i<NEIGHB_TABLE_LENGTH; i++ ) {
     neighbors[i].address = NEIGHB_TABLE_ADDRESS_NEIGHBOR_EMPTY;
     neighbors[i].sqn.beacon = 255;
-    neighbors[i].sqn.data = 255;
+    neighbors[i].sqn.data = 0;
+    neighbors[i].sqn.dataWindow = 0;
     neighbors[i].sqn.mac_command = 255;
   }
     
   neighborsCount = 0;
+  neighbEngineCursor = 0;
+  neighbSweepOldestAddress = NEIGHB_TABLE_ADDRESS_NEIGHBOR_EMPTY;
+  neighbLruAddress = NEIGHB_TABLE_ADDRESS_NEIGHBOR_EMPTY;
+}
+
+
+void neighbEngine ( void ) {
+
+  uint8_t n;
+  uint32_t now;
+  struct neighbor_t *neighbor;
+
+  // Incremental sweep: a bounded number of slots per call, never a latency spike
+  now = micros();
+  for ( n=0; n<NEIGHB_ENGINE_SLOTS_PER_CALL; n++ ) {
+
+    neighbor = &neighbors[neighbEngineCursor];
+    if ( neighbor->address != NEIGHB_TABLE_ADDRESS_NEIGHBOR_EMPTY ) {
+      // Signed differences: right across the micros() rollover
+      if ( (int32_t)( now - neighbor->lastUpdate ) > NEIGHB_NEIGHBOR_TIMEOUT ) {
+        if ( macDebug ) {
+          Serial.printf("NEIGHB_DEBUG 0x%04X expired\n", neighbor->address);
+        }
+        macStats.neighborsExpired++;
+        // The removal may move a following neighbor in this slot: check it again, without moving the cursor
+        neighbRemoveNeighborIndex ( neighbEngineCursor );
+        continue;
+      }
+      if ( ( neighbSweepOldestAddress == NEIGHB_TABLE_ADDRESS_NEIGHBOR_EMPTY ) || (int32_t)( neighbSweepOldestUpdate - neighbor->lastUpdate ) > 0 ) {
+        neighbSweepOldestAddress = neighbor->address;
+        neighbSweepOldestUpdate = neighbor->lastUpdate;
+      }
+    }
+
+    neighbEngineCursor = ( neighbEngineCursor + 1 ) & ( NEIGHB_TABLE_LENGTH - 1 );
+    if ( neighbEngineCursor == 0 ) {
+      // End of the sweep
+      neighbLruAddress = neighbSweepOldestAddress;
+      neighbSweepOldestAddress = NEIGHB_TABLE_ADDRESS_NEIGHBOR_EMPTY;
+    }
+  }
+}
+
+
+uint8_t neighbHash ( uint16_t nodeAddress ) {
+
+  // Fibonacci hashing: the top bits of the product, consecutive addresses are spread over the table
+  return (uint16_t)( nodeAddress * 40503u ) >> ( 16 - NEIGHB_TABLE_BITS );
 }
 
 
 uint8_t neighbAddNeighbor ( uint16_t nodeAddress, uint32_t lastUpdate, uint8_t RSSI ) {
 
-  uint8_t i,j;
-  i = 0; j = 0;
+  uint8_t i;
 
-  // Is this node in the table yet? j is the number of time
-  for ( i=0; i<NEIGHB_TABLE_MAX_NEIGHBORS_COUNT; i++ )
-    if ( neighbors[i].address == nodeAddress ) j++;
-    
-  if ( j != 0 ) return j;
-  else {
-    // No neighbor with address=nodeAddress found on the table.
-    // Now if table is full, return -1
-    if ( neighborsCount == NEIGHB_TABLE_MAX_NEIGHBORS_COUNT ) return -1;
-    // Searching for a empty place in the neighbor table
-    for ( i=0; neighbors[i].address != NEIGHB_TABLE_ADDRESS_NEIGHBOR_EMPTY; i++ ); // table must be initialized with NEIGHB_TABLE_ADDRESS_NEIGHBOR_EMPTY
-
-    neighbSetElementOfNeighborTable ( i, nodeAddress, lastUpdate, RSSI );
+  // Is this node in the table yet? The probe sequence stops on it or on the first empty slot,
+  // where it is added. The table is never full of entries: the probe always ends
+  for ( i=neighbHash(nodeAddress); neighbors[i].address != NEIGHB_TABLE_ADDRESS_NEIGHBOR_EMPTY; i=(i+1)&(NEIGHB_TABLE_LENGTH-1) )
+    if ( neighbors[i].address == nodeAddress ) return i;
+
+  // Now if table is full, replace the least recently heard neighbor, if neighbEngine found it yet
+  if ( neighborsCount == NEIGHB_TABLE_MAX_NEIGHBORS_COUNT ) {
+    i = neighbGetNeighborIndex ( neighbLruAddress );
+    if ( i == NEIGHB_NEIGHBOR_NOT_FOUND ) return NEIGHB_NEIGHBOR_NOT_FOUND;
     if ( macDebug ) {
-      Serial.printf("NEIGHB_DEBUG 0x%04X added in NT\n", nodeAddress);
+      Serial.printf("NEIGHB_DEBUG 0x%04X replaced\n", neighbLruAddress);
     }
-    neighborsCount++;
-    return 0;
+    macStats.neighborsReplaced++;
+    neighbLruAddress = NEIGHB_TABLE_ADDRESS_NEIGHBOR_EMPTY;
+    neighbRemoveNeighborIndex ( i );
+    // Entries may have moved: probe again, there is room now
+    return neighbAddNeighbor ( nodeAddress, lastUpdate, RSSI );
   }
+
+  neighbSetElementOfNeighborTable ( i, nodeAddress, lastUpdate, RSSI );
+  neighbors[i].rssiAverage = RSSI << 8;
+  neighbors[i].prr = 65535;
+  neighbors[i].etx = 0;
+  neighbors[i].lqSqnValid = false;
+  neighbors[i].profile = phyModemProfile;
+  neighbors[i].rateSuccesses = 0;
+  neighbors[i].channelMap = 0;
+  neighbors[i].channel = CHAN_NONE;
+#ifdef PHY_TIMESTAMPS_AT_TX
+  neighbors[i].clockPairs = 0;
+#endif
+  neighbors[i].sqn.beacon = 255;
+  neighbors[i].sqn.data = 0;
+  neighbors[i].sqn.dataWindow = 0;
+  neighbors[i].sqn.mac_command = 255;
+  if ( macDebug ) {
+    Serial.printf("NEIGHB_DEBUG 0x%04X added in NT\n", nodeAddress);
+  }
+  neighborsCount++;
+  return i;
 }
 
 
@@ -504,7 +1752,8 @@ uint8_t neighbGetNeighborIndex ( uint16_t nodeAddress ) {
 
   uint8_t i;
 
-  for ( i=0; i<NEIGHB_TABLE_MAX_NEIGHBORS_COUNT; i++ )
+  if ( nodeAddress == NEIGHB_TABLE_ADDRESS_NEIGHBOR_EMPTY ) return NEIGHB_NEIGHBOR_NOT_FOUND;
+  for ( i=neighbHash(nodeAddress); neighbors[i].address != NEIGHB_TABLE_ADDRESS_NEIGHBOR_EMPTY; i=(i+1)&(NEIGHB_TABLE_LENGTH-1) )
     if ( neighbors[i].address == nodeAddress )
       return i;
 
@@ -512,6 +1761,26 @@ uint8_t neighbGetNeighborIndex ( uint16_t nodeAddress ) {
 }
 
 
+void neighbRemoveNeighborIndex ( uint8_t elementIndex ) {
+
+  uint8_t i, j, home;
+
+  if ( neighbors[elementIndex].address == NEIGHB_TABLE_ADDRESS_NEIGHBOR_EMPTY ) return;
+
+  // Backward shift: an entry after the hole moves into it unless its home slot lies in (hole, entry]
+  i = elementIndex;
+  for ( j=(i+1)&(NEIGHB_TABLE_LENGTH-1); neighbors[j].address != NEIGHB_TABLE_ADDRESS_NEIGHBOR_EMPTY; j=(j+1)&(NEIGHB_TABLE_LENGTH-1) ) {
+    home = neighbHash(neighbors[j].address);
+    if ( ( ( j - home ) & ( NEIGHB_TABLE_LENGTH - 1 ) ) >= ( ( j - i ) & ( NEIGHB_TABLE_LENGTH - 1 ) ) ) {
+      neighbors[i] = neighbors[j];
+      i = j;
+    }
+  }
+  neighbors[i].address = NEIGHB_TABLE_ADDRESS_NEIGHBOR_EMPTY;
+  neighborsCount--;
+}
+
+
 uint8_t neighbUpdateNeighbor ( uint16_t nodeAddress, uint32_t lastUpdate, uint8_t RSSI ) {
 
   uint8_t neighborIndex;
@@ -524,6 +1793,122 @@ uint8_t neighbUpdateNeighbor ( uint16_t nodeAddress, uint32_t lastUpdate, uint8_
 }
 
 
+uint8_t neighbIsDuplicateData ( uint8_t elementIndex, uint8_t sequenceNumber ) {
+
+  struct sqn_t *sqn = &neighbors[elementIndex].sqn;
+  uint8_t age;
+
+  // Nothing received yet, or newer than anything received: not a duplicate
+  if ( sqn->dataWindow == 0 ) return false;
+  if ( cmpUi8GreaterWithRollover ( sequenceNumber, sqn->data ) ) return false;
+
+  age = sqn->data - sequenceNumber;
+  if ( age >= NEIGHB_DUPLICATE_WINDOW ) return false;
+  return ( sqn->dataWindow >> age ) & 1;
+}
+
+
+void neighbRecordData ( uint8_t elementIndex, uint8_t sequenceNumber ) {
+
+  struct sqn_t *sqn = &neighbors[elementIndex].sqn;
+  uint8_t shift, age;
+
+  if ( sqn->dataWindow == 0 ) {
+    sqn->data = sequenceNumber;
+    sqn->dataWindow = 1;
+  } else if ( cmpUi8GreaterWithRollover ( sequenceNumber, sqn->data ) ) {
+    // Slide the window up to the new number
+    shift = sequenceNumber - sqn->data;
+    sqn->dataWindow = shift >= NEIGHB_DUPLICATE_WINDOW ? 1 : ( sqn->dataWindow << shift ) | 1;
+    sqn->data = sequenceNumber;
+  } else {
+    age = sqn->data - sequenceNumber;
+    if ( age < NEIGHB_DUPLICATE_WINDOW ) {
+      // Late frame, inside the window
+      sqn->dataWindow |= (uint32_t)1 << age;
+    } else {
+      sqn->data = sequenceNumber;
+      sqn->dataWindow = 1;
+    }
+  }
+}
+
+
+void neighbUpdateLinkQuality ( uint8_t elementIndex, uint8_t RSSI, uint8_t numbered, uint8_t sequenceNumber ) {
+
+  struct neighbor_t *neighbor = &neighbors[elementIndex];
+  uint8_t gap;
+
+  neighbor->rssiAverage += ( (int32_t)( RSSI << 8 ) - neighbor->rssiAverage ) >> NEIGHB_LQ_SHIFT;
+
+  // The source numbers its data frames and commands whatever their destination: every gap is a frame missed here.
+  // Retries keep their number and don't count
+  if ( !numbered ) return;
+  gap = sequenceNumber - neighbor->lqSqn;
+  if ( neighbor->lqSqnValid && ( gap != 0 ) && ( gap <= NEIGHB_LQ_MAX_GAP ) ) {
+    while ( --gap ) neighbor->prr -= neighbor->prr >> NEIGHB_LQ_SHIFT;
+    neighbor->prr += ( 65535 - neighbor->prr ) >> NEIGHB_LQ_SHIFT;
+  }
+  neighbor->lqSqn = sequenceNumber;
+  neighbor->lqSqnValid = true;
+}
+
+
+void neighbUpdateEtx ( uint16_t nodeAddress, uint8_t transmissions, uint8_t acked ) {
+
+  uint8_t i;
+  uint16_t sample;
+
+  // A received ACK proves the link: a destination that never ACKed is not added
+  if ( acked ) i = neighbAddNeighbor ( nodeAddress, micros(), lastAckRssi );
+  else i = neighbGetNeighborIndex ( nodeAddress );
+  if ( i == NEIGHB_NEIGHBOR_NOT_FOUND ) return;
+
+  sample = ( acked ? transmissions : NEIGHB_ETX_FAILURE ) << 4;
+  if ( neighbors[i].etx == 0 ) neighbors[i].etx = sample;
+  else neighbors[i].etx += ( (int16_t)( sample - neighbors[i].etx ) ) >> NEIGHB_LQ_SHIFT;
+  if ( acked ) neighbors[i].lastUpdate = micros();
+}
+
+
+#ifdef PHY_TIMESTAMPS_AT_TX
+void neighbUpdateClock ( uint8_t elementIndex, uint32_t rxTimestamp, uint32_t txTimestamp, uint8_t length ) {
+
+  struct neighbor_t *neighbor = &neighbors[elementIndex];
+  uint32_t elapsed;
+  int32_t offset;
+  float skew;
+
+  // Its clock when this frame was read from the driver
+  offset = (int32_t)( txTimestamp + phyTimestampDelay ( length ) - rxTimestamp );
+  elapsed = rxTimestamp - neighbor->clockReference;
+
+  if ( neighbor->clockPairs && ( elapsed > NEIGHB_CLOCK_MAX_INTERVAL ) ) neighbor->clockPairs = 0;
+  if ( neighbor->clockPairs == 0 ) {
+    neighbor->clockSkew = 0;
+  } else {
+    // The skew is measured over NEIGHB_CLOCK_SKEW_INTERVAL at least
+    if ( elapsed < NEIGHB_CLOCK_SKEW_INTERVAL ) return;
+    skew = (float)( offset - neighbor->clockOffset ) / elapsed;
+    if ( neighbor->clockPairs == 1 ) neighbor->clockSkew = skew;
+    else neighbor->clockSkew += ( skew - neighbor->clockSkew ) / ( 1 << NEIGHB_LQ_SHIFT );
+  }
+  neighbor->clockReference = rxTimestamp;
+  neighbor->clockOffset = offset;
+  if ( neighbor->clockPairs < 255 ) neighbor->clockPairs++;
+}
+
+
+int32_t neighbClockOffset ( uint8_t elementIndex, uint32_t localTime ) {
+
+  struct neighbor_t *neighbor = &neighbors[elementIndex];
+
+  if ( neighbor->clockPairs == 0 ) return 0;
+  return neighbor->clockOffset + (int32_t)( neighbor->clockSkew * (int32_t)( localTime - neighbor->clockReference ) );
+}
+#endif
+
+
 void neighbSetElementOfNeighborTable ( uint8_t elementIndex, uint16_t nodeAddress, uint32_t lastUpdate, uint8_t RSSI ) {
 
   neighbors[elementIndex].address = nodeAddress;
@@ -538,6 +1923,19 @@ uint8_t neighbGetNeighborsCount ( void ) {
 }
 
 
+uint8_t neighbGetNeighbors ( uint16_t* list ) {
+
+  uint8_t i, count;
+
+  count = 0;
+  for ( i=0; i<NEIGHB_TABLE_LENGTH; i++ )
+    if ( neighbors[i].address != NEIGHB_TABLE_ADDRESS_NEIGHBOR_EMPTY )
+      list[count++] = neighbors[i].address;
+
+  return count;
+}
+
+
 void neighbPrintNeighbors ( void ) {
 
   uint8_t i;
@@ -545,7 +1943,7 @@ void neighbPrintNeighbors ( void ) {
   Serial.printf(">>> Neighbor table\n#neighbs: %d\n", neighborsCount);
   if ( neighborsCount != 0 ) {
     Serial.print(">@\tdate\t\tlstRssi\n");
-    for ( i=0; i<NEIGHB_TABLE_MAX_NEIGHBORS_COUNT; i++ )
+    for ( i=0; i<NEIGHB_TABLE_LENGTH; i++ )
       if ( neighbors[i].address != NEIGHB_TABLE_ADDRESS_NEIGHBOR_EMPTY )
         Serial.printf("%04x\t%010ld\t%d\n", neighbors[i].address, neighbors[i].lastUpdate, neighbors[i].lastRssi);
   }
@@ -12,52 +12,213 @@
 
 #define MAC_BACKOFF_SLOT_DURATION 640 // us
 #define MAC_MIN_BE 3
+#define MAC_MAX_BE 7 // 2^BE backoff slots must fit a uint8_t
 #define MAC_MAX_CSMA_CA_BACKOFF 4
 #define MAC_MAX_FRAME_RETRIES 3
 #define MAC_ACK_WAIT_DURATION 10000 // us
-#define MAC_WAIT_BEFORE_SEND_ACK 640 // us
+#ifndef MAC_WAIT_BEFORE_SEND_ACK
+#define MAC_WAIT_BEFORE_SEND_ACK 640 // us, from the reception of a frame to its ACK
+#endif
+#define MAC_ACK_SPIN_MAX 40 // us, macEngine waits in place for the ACK time if it is that close
 #define MAC_INTERFRAME_DELAY 2000 // us
 #define MAC_ACK_FRAME_LENGTH 3 // bytes
+#define MAC_DATA_FRAME_HEADER_LENGTH 9 // bytes, 16 bits addresses
+#define MAC_BLOCK_ACK_FRAME_LENGTH ( MAC_DATA_FRAME_HEADER_LENGTH + 4 ) // header and bitmap of the data sequence numbers received
+#define MAC_BLOCK_ACK_WINDOW MAC_TX_QUEUE_LENGTH // frames in flight with MAC_BLOCK_ACK: the whole TX queue
+#define MAC_RATE_SWITCH_FRAME_LENGTH ( MAC_DATA_FRAME_HEADER_LENGTH + 2 ) // header, MAC_COMMAND_RATE_SWITCH and the profile
+
+// Rate adaptation (MAC_RATE_ADAPTATION parameter)
+#define MAC_RATE_MARGIN 12 // RSSI units (0.5dB) a link keeps over the sensitivity of its profile
+#define MAC_RATE_UP_SUCCESSES 8 // exchanges ACKed in a row before a faster profile is tried
+#define MAC_RATE_SWITCH_GUARD 2000 // us the destination of a rate switch waits for the next frame, after its time on air
+
+// Beacon-enabled mode (MAC_BEACON_INTERVAL parameter)
+#define MAC_SUPERFRAME_SLOTS 16 // slots between two beacons: the CAP, then the GTS
+#define MAC_MIN_CAP_SLOTS 8 // slots never given as GTS
+#define MAC_GTS_MAX 7 // GTS descriptors in a beacon
+#define MAC_GTS_EXPIRATION 8 // beacons without a frame from its device before a GTS is freed, and between two requests of a device without its GTS
+#define MAC_BEACON_LOST_COUNT 4 // beacons missed in a row before a device stops following its coordinator
+#define MAC_BEACON_GUARD 1000 // us a device waits for a beacon after its expected end before it counts it missed
+#define MAC_BEACON_HEADER_LENGTH 4 // interval (ms), final CAP slot, GTS count
+#define MAC_GTS_DESCRIPTOR_LENGTH 4 // device address, first slot, slots
+#define MAC_COORDINATOR_NONE 0xFFFF // never a source address (broadcast)
+
+// Low-power listening (MAC_LPL_INTERVAL parameter)
+#define MAC_LPL_DEFAULT_HOLD 20 // ms the radio stays on after a frame sent or received
+#define MAC_LPL_SAMPLE_PERIOD 250 // us between two energy samples of a wake-up
+#define MAC_LPL_ACK_GUARD 500 // us over the turnaround and the time on air of the ACK of a strobed copy
+#define MAC_LPL_WAKE_MARGIN 6 // energy over the sensitivity of the profile (RSSI units, 0.5dB) that keeps a sampling radio on
+
+// MAC commands (first byte of the payload of a FRAME_TYPE_MAC_COMMAND frame)
+#define MAC_COMMAND_RATE_SWITCH		0x01 // profile: once ACKed, the destination receives with it until the last frame of the exchange
+#define MAC_COMMAND_GTS_REQUEST		0x02 // slots: GTS of the source in the next beacons of the coordinator, 0 frees it
+#define MAC_COMMAND_TIME_SYNC		0x03 // broadcast, global time of the source: see kernel/sync.h
+#define MAC_COMMAND_ROUTE_BEACON	0x04 // broadcast, path of the source to its sink: see kernel/route.h
+#define MAC_COMMAND_ROUTE_REQUEST	0x05 // broadcast, flooded to find a route
+#define MAC_COMMAND_ROUTE_REPLY		0x06 // sent back along the route request, hop by hop
+#define MAC_COMMAND_CHANNEL_MAP		0x07 // broadcast, channels the source listens on: see kernel/chan.h
+
+#define MAC_RATE_SWITCH_IDLE		0
+#define MAC_RATE_SWITCH_ACCEPTED	1 // ACK of the command not sent yet
+#define MAC_RATE_SWITCH_RECEIVING	2 // the radio uses the profile of the source
+#define MAC_RATE_SWITCH_ENDING		3 // ACK of the last frame not sent yet
+
+// Adaptive CSMA/CA (MAC_ADAPTIVE_CSMA parameter)
+#define MAC_ADAPT_SHIFT 4 // channel load EWMA weight is 1/2^MAC_ADAPT_SHIFT
+#define MAC_ADAPT_PERIOD 8 // CCA and ACK results between two adjustments
+#define MAC_ADAPT_MIN_BE_LOWEST 1
+#define MAC_ADAPT_MIN_BE_HIGHEST 6
+#define MAC_ADAPT_BUSY_HIGH 32768 // CCA busy ratio (65535 is 1) over which the load is high
+#define MAC_ADAPT_BUSY_LOW 6554
+#define MAC_ADAPT_FAILURE_HIGH 13107 // ACK timeout ratio (65535 is 1) over which the load is high
+#define MAC_ADAPT_FAILURE_LOW 3277
+#define MAC_CCA_MARGIN 24 // initial CCA threshold above the noise floor (RSSI units, 0.5dB)
+#define MAC_CCA_MARGIN_MIN 8
+#define MAC_CCA_MARGIN_MAX 96
+#define MAC_NOISE_FLOOR_PERIOD 1000000 // us between two noise samples when the MAC is idle
 #define NO_ACK_REQUESTED false
 #define ACK_REQUESTED true
 #define MAX_MAC_HEADER_SIZE 16
 
-#define NEIGHB_TABLE_MAX_NEIGHBORS_COUNT 16
-#define NEIGHB_TABLE_ADDRESS_NEIGHBOR_EMPTY 0xFFFF
+#ifndef MAC_TX_QUEUE_LENGTH
+#define MAC_TX_QUEUE_LENGTH 4 // frames waiting for CSMA/CA, must be a power of 2
+#endif
+#define MAC_TX_CONFIRM_HISTORY_LENGTH 16 // confirm status kept for the last 16 handles
+
+#if ( MAC_TX_QUEUE_LENGTH & ( MAC_TX_QUEUE_LENGTH - 1 ) ) || ( MAC_TX_QUEUE_LENGTH > MAC_TX_CONFIRM_HISTORY_LENGTH )
+#error "MAC_TX_QUEUE_LENGTH must be a power of 2 and <= MAC_TX_CONFIRM_HISTORY_LENGTH"
+#endif
+
+#ifndef MAC_TRACE_LENGTH
+#define MAC_TRACE_LENGTH 128 // events kept when MAC_TRACE is defined, must be a power of 2
+#endif
+
+#if ( MAC_BLOCK_ACK_WINDOW > 16 )
+#error "MAC_BLOCK_ACK_WINDOW must fit macWindowAcked"
+#endif
+
+#if ( MAC_TRACE_LENGTH & ( MAC_TRACE_LENGTH - 1 ) )
+#error "MAC_TRACE_LENGTH must be a power of 2"
+#endif
+
+// Trace events: value and arg of each event
+#define MAC_TRACE_STATE			1 // new macCsma_CaState, previous state
+#define MAC_TRACE_BACKOFF		2 // backoff drawn (slots), BE
+#define MAC_TRACE_CCA			3 // energy read, NB
+#define MAC_TRACE_TX_START		4 // sequence number, frame length
+#define MAC_TRACE_TX_END		5 // sequence number, frame type
+#define MAC_TRACE_ACK_RX		6 // sequence number, true if it matches the frame waiting for its ACK
+#define MAC_TRACE_ACK_TX		7 // sequence number, 0 (ACK) or 1 (block ACK)
+#define MAC_TRACE_RX			8 // sequence number, frame length
+#define MAC_TRACE_CONFIRM		9 // MCPS_data_confirm status, sequence number
+#define MAC_TRACE_BLOCK_ACK_RX		10 // sequence number, frames of the window ACKed (bit k for the frame k)
+
+#ifdef MAC_TRACE
+#define MAC_TRACE_EVENT(event, value, arg) macTraceRecord(event, value, arg)
+#else
+#define MAC_TRACE_EVENT(event, value, arg)
+#endif
+
+#ifndef NEIGHB_TABLE_LENGTH
+#define NEIGHB_TABLE_LENGTH 64 // slots of the neighbor hash table, must be a power of 2
+#endif
+#define NEIGHB_TABLE_MAX_NEIGHBORS_COUNT ( NEIGHB_TABLE_LENGTH * 3 / 4 ) // keeps probe sequences short
+#define NEIGHB_TABLE_ADDRESS_NEIGHBOR_EMPTY 0xFFFF // never a source address (broadcast)
+#ifndef NEIGHB_NEIGHBOR_TIMEOUT
+#define NEIGHB_NEIGHBOR_TIMEOUT 60000000 // us without any frame before a neighbor is removed (< 35 minutes, micros() rollover)
+#endif
+#define NEIGHB_ENGINE_SLOTS_PER_CALL 4 // slots checked by each neighbEngine call
+#define NEIGHB_DUPLICATE_WINDOW 32 // data sequence numbers remembered per neighbor (bits of sqn_t.dataWindow)
+#define NEIGHB_LQ_SHIFT 3 // link estimator EWMA weight is 1/2^NEIGHB_LQ_SHIFT
+#define NEIGHB_LQ_MAX_GAP 16 // larger sequence number gaps are a reboot or a long absence: PRR not updated
+#define NEIGHB_ETX_FAILURE ( 2 * ( MAC_MAX_FRAME_RETRIES + 1 ) ) // ETX sample of a frame never ACKed
 #define NEIGHB_NEIGHBOR_NOT_FOUND 0xFF
+#define NEIGHB_CLOCK_SKEW_INTERVAL 10000000 // us between the two timestamp pairs of a skew sample: the RX timestamp jitter is divided by it
+#define NEIGHB_CLOCK_MAX_INTERVAL 120000000 // us: a neighbor not heard for longer starts a new clock estimate
+
+#if ( NEIGHB_TABLE_LENGTH & ( NEIGHB_TABLE_LENGTH - 1 ) ) || ( NEIGHB_TABLE_LENGTH < 4 ) || ( NEIGHB_TABLE_LENGTH > 128 )
+#error "NEIGHB_TABLE_LENGTH must be a power of 2 between 4 and 128"
+#endif
+// log2(NEIGHB_TABLE_LENGTH): the neighbHash bits
+#if NEIGHB_TABLE_LENGTH == 4
+#define NEIGHB_TABLE_BITS 2
+#elif NEIGHB_TABLE_LENGTH == 8
+#define NEIGHB_TABLE_BITS 3
+#elif NEIGHB_TABLE_LENGTH == 16
+#define NEIGHB_TABLE_BITS 4
+#elif NEIGHB_TABLE_LENGTH == 32
+#define NEIGHB_TABLE_BITS 5
+#elif NEIGHB_TABLE_LENGTH == 64
+#define NEIGHB_TABLE_BITS 6
+#else
+#define NEIGHB_TABLE_BITS 7
+#endif
 
 struct sqn_t {
  /**
   * @brief Contains the sequence numbers received for each neighbor.
   */
   uint8_t beacon;/**< @brief The last received beacon's sequence number.*/
-  uint8_t data;/**< @brief The last received data's sequence number.*/
+  uint8_t data;/**< @brief The most recent received data's sequence number.*/
+  uint32_t dataWindow;/**< @brief Bit k set if data's sequence number (data - k) has been received. 0 if no data received yet.*/
   uint8_t mac_command;/**< @brief The last received mac_command's sequence number.*/
 
 }; // sqn_t
 
+struct gts_t {
+
+  uint16_t address; // device sending in the GTS
+  uint8_t slots;
+  uint8_t lastUsed; // sequence number of the beacon before its last frame
+
+}; // gts_t
+
 struct neighbor_t {
 
   uint16_t address;
   uint32_t lastUpdate;
   uint8_t lastRssi;
   struct sqn_t sqn;
+  uint16_t rssiAverage; // RSSI EWMA, 1/256 units
+  uint16_t prr; // packet reception ratio EWMA, 65535 is 1
+  uint16_t etx; // expected transmissions EWMA, 1/16 units, 0 if never sent to
+  uint8_t lqSqn; // last data sequence number heard, for the PRR
+  uint8_t lqSqnValid;
+  uint8_t profile; // modem profile of the data frames sent to it, phyModemProfile or faster (MAC_RATE_ADAPTATION)
+  uint8_t rateSuccesses; // exchanges ACKed in a row with this profile
+  uint32_t channelMap; // channels of its hop sequence (CHANNEL_HOPPING), 0 if it does not hop or is not known
+  uint8_t channel; // channel it listens on when it does not hop, CHAN_NONE if not known
+#ifdef PHY_TIMESTAMPS_AT_TX
+  uint32_t clockReference; // local time of the last timestamp pair kept
+  int32_t clockOffset; // us, its clock minus the local clock at clockReference
+  float clockSkew; // its clock rate over the local clock rate, minus 1
+  uint8_t clockPairs; // timestamp pairs kept, 0 if its clock is not known yet
+#endif
 
 }; // neighbor_struct
 
 // Global vars
-struct neighbor_t neighbors [NEIGHB_TABLE_MAX_NEIGHBORS_COUNT];
+struct neighbor_t neighbors [NEIGHB_TABLE_LENGTH]; // Open addressing hash table on the address, linear probing
 uint8_t neighborsCount;
+uint8_t neighbEngineCursor; // Next slot checked by neighbEngine
+uint16_t neighbSweepOldestAddress; // Least recently heard neighbor found so far by the current sweep of neighbEngine
+uint32_t neighbSweepOldestUpdate; // Its lastUpdate
+uint16_t neighbLruAddress; // Least recently heard neighbor found by the last complete sweep: replaced when the table is full
 
-#define FRAME_TYPE_MASK           0x03
+#define FRAME_TYPE_MASK           0x07
 #define FRAME_TYPE_BEACON         0x00
 #define FRAME_TYPE_DATA           0x01
 #define FRAME_TYPE_ACK            0x02
 #define FRAME_TYPE_MAC_COMMAND    0x03
+#define FRAME_TYPE_BLOCK_ACK      0x04 // reserved type: data header and bitmap of the data sequence numbers received
 #define SECURITY_ENABLED          0x08
 #define FRAME_PENDING             0x10
 #define ACK_REQUEST               0x20
 #define INTRA_PAN                 0x40
+#define FRAME_AGGREGATED          0x80 // reserved bit: the payload is a sequence of (length byte, payload)
+#define FRAME_FRAGMENT            0x100 // reserved bit: the payload is for the fragmentation layer (kernel/frag.h)
+#define FRAME_BLOCK_ACK           0x200 // reserved bit: with ACK_REQUEST, ACKed by a block ACK once FRAME_PENDING is clear
+#define FRAME_ROUTED              0x1000 // frame version bit: the payload begins with a network header (kernel/route.h)
 #define DEST_ADDR_MODE_16BITS     0x800
 #define SRC_ADDR_MODE_16BITS      0x8000
 
@@ -70,37 +231,113 @@ uint8_t neighborsCount;
 #define MAC_CSMA_CA_TX_FRAME_STATE			7
 #define MAC_CSMA_CA_WAIT_ACK_STATE			8
 #define MAC_CSMA_CA_WAIT_INTERFRAME_STATE       	9
+#define MAC_CSMA_CA_WAIT_TX_DONE_STATE			10
 
 #define MCPS_DATA_REQUEST_SUCCESS			0
 #define MCPS_DATA_REQUEST_MAC_TX_BUSY			1
+#define MCPS_DATA_REQUEST_FRAME_TOO_LONG		2
+#define MCPS_DATA_REQUEST_NO_FRAME			3
 #define MCPS_DATA_CONFIRM_STATUS_SUCCESS		0
 #define MCPS_DATA_CONFIRM_STATUS_NO_ACK			1
 #define MCPS_DATA_CONFIRM_STATUS_CHANNEL_ACCESS_FAILURE	2
+#define MCPS_DATA_CONFIRM_STATUS_PENDING		3
+#define MCPS_DATA_CONFIRM_STATUS_UNKNOWN		4
 
 //#define CONSOLE_CMD_HANDLE_STATE_MAC_DEBUG 10
 
+struct txConfirm_t {
+
+  uint8_t handle;
+  uint8_t status;
+
+}; // txConfirm_t
+
 // Global variables
 rxFrame_t macCurrentRxFrame; // No queue for reception
-txFrame_t macCurrentTxFrame; // No queue for transmission
+txFrame_t macAckTxFrame; // ACK being sent
+txFrame_t macTxQueue[MAC_TX_QUEUE_LENGTH]; // Frames waiting for the CSMA/CA engine
+uint8_t macTxQueueHead; // Index of the frame in (or next to enter) the CSMA/CA engine (free running)
+uint8_t macTxQueueTail; // Index of the next free slot (free running)
+struct txConfirm_t macTxConfirmHistory[MAC_TX_CONFIRM_HISTORY_LENGTH];
+uint8_t macOpenFrameHeaderLength; // Header length of the frame being built in the TX queue, 0 if none
+uint16_t macAggregationHold; // us a queued data frame waits for more payloads to the same destination, 0 disables aggregation
+uint8_t macAggregateOpen; // The last frame of the TX queue still takes payloads
+uint32_t macAggregateDeadline; // When the CSMA/CA engine takes it anyway
+uint8_t macRxAggregateOffset; // Offset of the next payload in the aggregated frame at the front of the reception queue, 0 if not started
 uint32_t macCbrNextTimeToSend, macCsmaCaBackoffDurationTimeout, macInterframeDurationTimeout;
-uint8_t macFrameToSend;
-uint8_t macFrameReceived;
-uint16_t macLastSourceAddressReceived;
-uint8_t* macLastPayload;
-uint8_t macLastPayloadLen;
+struct macStats_t macStats;
+#ifdef MAC_TRACE
+struct macTraceEvent_t macTraceRing[MAC_TRACE_LENGTH]; // Oldest events are overwritten
+uint16_t macTraceTail; // Index of the next event to write (free running)
+#endif
 
 struct sqn_t mac_sqn;
 uint8_t lastAckReceived;
+uint8_t lastAckRssi;
+uint8_t macAckPending; // An ACK is scheduled
+uint8_t macAckSequenceNumber;
+uint32_t macAckTime; // When to send it
+uint8_t macAckType; // FRAME_TYPE_ACK or FRAME_TYPE_BLOCK_ACK
+uint16_t macAckDestination; // Block ACK: source of the data frames
+uint32_t macAckBitmap; // Block ACK: bit k set if data sequence number (macAckSequenceNumber - k) has been received
+uint8_t macBlockAck; // Send the unicast frames by windows ACKed by a block ACK
+uint8_t macWindowCount; // Frames of the window, from the head of the TX queue. 0 if no window
+uint8_t macWindowCurrent; // Frame of the window being sent
+uint16_t macWindowAcked; // Bit k set if frame k of the window has been ACKed
+uint8_t macBlockAckReceived; // A block ACK for the window has been received since the last frame of the round
+uint8_t macWindowProgress; // It ACKed frames not ACKed before
+uint8_t macRateAdaptation; // Send the data frames of good links with a faster profile than phyModemProfile
+txFrame_t macCommandTxFrame; // MAC command sent by the CSMA/CA engine before the exchange of a data frame
+struct txFrame_t* macRateSwitchFrame; // Data frame waiting for the ACK of the rate switch command, NULL if none
+uint8_t macRateSwitchSkip; // The destination did not accept the rate switch: the frame goes with phyModemProfile
+uint8_t macRateSwitchState; // Destination side of a rate switch
+uint16_t macRateSwitchSource;
+uint8_t macRateSwitchProfile;
+uint32_t macRateSwitchTimeout; // Back to phyModemProfile if no frame from the source by then
+uint16_t macBeaconInterval; // ms between two beacons sent by this node, 0 if it is not a coordinator
+txFrame_t macBeaconTxFrame;
+struct gts_t macGtsTable[MAC_GTS_MAX]; // Coordinator: GTS of the next beacon, the first one at the end of the superframe
+uint8_t macGtsCount;
+uint16_t macCoordinatorAddress; // Device: coordinator whose beacons are followed, MAC_COORDINATOR_NONE if none
+uint32_t macSuperframeStart; // Beginning of the current superframe (beacon on air)
+uint32_t macSuperframeDuration; // us between two beacons
+uint32_t macBeaconAirTime; // Time on air of the last beacon: the CAP begins after it
+uint8_t macFinalCapSlot;
+uint8_t macBeaconsMissed; // Device: beacons missed in a row
+uint8_t macGtsFirstSlot; // Device: GTS given by the last beacon
+uint8_t macGtsSlots; // 0 if none
+uint8_t macGtsRequested; // Device: slots asked by MAC_GTS_REQUEST
+uint8_t macGtsRequestPending; // The GTS request command is not queued yet
+uint16_t macLplInterval; // ms between two wake-ups of the radio, 0 if it never sleeps
+uint16_t macLplHold; // ms the radio stays on after a frame sent or received
+uint32_t macLplNextWakeUp;
+uint32_t macLplSampleEnd; // End of the energy samples of the current wake-up
+uint32_t macLplNextSample;
+uint32_t macLplAwakeUntil; // The radio does not sleep before
+uint8_t macLplStrobing; // currentTxFrame is sent again until ACKed or macLplStrobeEnd
+uint8_t macLplCcaRunning; // The CCA samples the channel for a gap between two strobed copies, until macLplCcaEnd
+uint32_t macLplCcaEnd;
+uint32_t macLplStrobeEnd;
 struct txFrame_t* currentTxFrame;
+uint8_t macTxDone;
 uint8_t macCsma_CaState;
 uint32_t currentTxFrameAckTimeoutOnLclk;
 uint32_t currentTxFrameBackoff;
 int8_t currentTxFrameRetries;
 uint32_t macEndOfTxPeriod;
 uint8_t macFrameInCsma_CaEngine;
-uint8_t macFrameInGtsEngine;
+uint8_t macFrameInGtsEngine; // The frame goes in the GTS of this device, without CSMA/CA
 uint8_t macCsma_CaNb;
 uint8_t macCsma_CaBe;
+uint8_t macAdaptiveCsma; // Adapt macMinBe and macCcaThreshold to the channel load
+uint8_t macMinBe; // MAC_MIN_BE unless adaptive
+uint8_t macCcaThreshold; // MAC_CCA_MEDIUM_BUSY unless adaptive
+uint8_t macCcaMargin;
+uint16_t macNoiseFloor; // Energy of the idle channel, 1/256 RSSI units
+uint16_t macCcaBusyRatio; // EWMA of CCA results, 65535 is always busy
+uint16_t macTxFailureRatio; // EWMA of ACK results, 65535 is never ACKed
+uint8_t macAdaptSamples; // Samples since the last adjustment
+uint32_t macNoiseFloorNextSample;
 
 
 // Prototypes
@@ -122,12 +359,250 @@ void macInit ( void );
 void macEngine ( void );
 
 /**
-* @brief Called by upper layer, prepare and send a MAC-level data frame with given parameters and payload.
-* @return Return the length of the frame
+* @brief Enable or disable the adaptive CSMA/CA. Disabled, the MAC uses MAC_MIN_BE and MAC_CCA_MEDIUM_BUSY
+* @return No return
+* @date 20261017
+*/
+void macSetAdaptiveCsma ( uint8_t enable );
+
+/**
+* @brief Add a CCA (busy) or ACK (failure) result to the channel load estimates, and adjust the minimum backoff exponent and the CCA threshold every MAC_ADAPT_PERIOD results
+* @return No return
+* @date 20261017
+*/
+void macAdaptCsma ( uint16_t *ratio, uint8_t sample );
+
+/**
+* @brief Add an energy sample of the idle channel to the noise floor estimate, and move the CCA threshold with it
+* @return No return
+* @date 20261017
+*/
+void macNoiseFloorSample ( uint8_t energy );
+
+/**
+* @brief Get the time to wait for an ACK after the end of a frame. MAC_ACK_WAIT_DURATION is for the fastest profile: a slower radio profile adds the longer time on air of the block ACK
+* @return the duration in us
+* @date 20261017
+*/
+uint32_t macAckWaitDuration ( void );
+
+/**
+* @brief Get the modem profile of the data frames to nodeAddress
+* @return its profile if MAC_RATE_ADAPTATION is enabled and it is a neighbor, phyModemProfile else
+* @date 20261017
+*/
+uint8_t macLinkProfile ( uint16_t nodeAddress );
+
+/**
+* @brief Update the profile of the link to nodeAddress with the result of an exchange: a loss with a faster profile than phyModemProfile moves it to a slower one at once, MAC_RATE_UP_SUCCESSES exchanges ACKed in a row move it to a faster one if its RSSI allows it. rssi is the RSSI of the ACK, 0 if none
+* @return No return
+* @date 20261017
+*/
+void macAdaptRate ( uint16_t nodeAddress, uint8_t acked, uint8_t rssi );
+
+/**
+* @brief Make the rate switch command of currentTxFrame in macCommandTxFrame if its link has a faster profile than phyModemProfile. The CSMA/CA engine then sends the command, and the frame right after its ACK
+* @return No return
+* @date 20261017
+*/
+void macPrepareRateSwitch ( void );
+
+/**
+* @brief Destination side of a rate switch: move the radio to the profile of the source once the ACK of its command is sent, and back to phyModemProfile after the ACK of its last frame or on timeout
+* @return true if the CSMA/CA engine may run, false while the radio serves the source
+* @date 20261017
+*/
+uint8_t macRateSwitchEngine ( void );
+
+/**
+* @brief Start (interval in ms) or stop (0) sending beacons as the coordinator of the PAN. A coordinator does not follow the beacons of another one
+* @return No return
+* @date 20261017
+*/
+void macSetBeaconInterval ( uint16_t interval );
+
+/**
+* @brief Tell if the MAC runs in superframes: the node is a coordinator, or follows the beacons of one
+* @return true in beacon-enabled mode
+* @date 20261017
+*/
+uint8_t macSuperframeActive ( void );
+
+/**
+* @brief Superframe engine: the coordinator sends its beacon on time, a device counts the beacons it missed, stops following its coordinator after MAC_BEACON_LOST_COUNT of them, and queues its GTS request
+* @return No return
+* @date 20261017
+*/
+void macBeaconEngine ( void );
+
+/**
+* @brief Send the beacon of a new superframe, with the GTS of macGtsTable. The GTS not used for MAC_GTS_EXPIRATION beacons are freed first
+* @return No return
+* @date 20261017
+*/
+void macSendBeacon ( void );
+
+/**
+* @brief Follow the superframe described by a beacon received from sourceAddress, if it is the coordinator of this device or the first one heard
+* @return No return
+* @date 20261017
+*/
+void macReceiveBeacon ( struct rxFrame_t *rxFrame, uint16_t sourceAddress, uint8_t sequenceNumber, uint8_t elementIndex );
+
+/**
+* @brief Coordinator: give slots to nodeAddress in the next beacons, in place of its previous GTS. Denied if the CAP would be left with less than MAC_MIN_CAP_SLOTS or if there are already MAC_GTS_MAX of them
+* @return true if the GTS is given (or freed, slots is 0)
+* @date 20261017
+*/
+uint8_t macAllocateGts ( uint16_t nodeAddress, uint8_t slots );
+
+/**
+* @brief Find the GTS of nodeAddress in macGtsTable
+* @return its index, macGtsCount if none
+* @date 20261017
+*/
+uint8_t macGetGts ( uint16_t nodeAddress );
+
+/**
+* @brief Get the time the exchange of currentTxFrame (or of the window) takes on air, from its first frame to the end of its ACK
+* @return the duration in us
+* @date 20261017
+*/
+uint32_t macExchangeDuration ( void );
+
+/**
+* @brief Tell if the exchange of currentTxFrame can begin now and end before the end of a period of the superframe (us from its beginning), see macFitExchange. A frame too long for the whole period goes anyway
+* @return true if it fits
+* @date 20261017
+*/
+uint8_t macInPeriod ( uint32_t start, uint32_t end );
+
+/**
+* @brief Tell if the exchange of currentTxFrame fits in duration (us). A window too long loses its last frames first
+* @return true if it fits
+* @date 20261017
+*/
+uint8_t macFitExchange ( uint32_t duration );
+
+/**
+* @brief Queue a MAC command to destinationAddress like a data frame
+* @return MCPS_DATA_REQUEST_SUCCESS, MCPS_DATA_REQUEST_MAC_TX_BUSY if the TX queue is full or MCPS_DATA_REQUEST_FRAME_TOO_LONG
+* @date 20261017
+*/
+uint8_t macQueueCommand ( uint8_t ackRequest, uint16_t destinationAddress, uint8_t* payload, uint8_t payloadLength );
+
+/**
+* @brief Start (interval in ms) or stop (0) the low-power listening: the radio sleeps, and wakes up every interval to sample the channel. All the nodes of the PAN must use the same interval
+* @return No return
+* @date 20261017
+*/
+void macSetLplInterval ( uint16_t interval );
+
+/**
+* @brief Tell if the low-power listening runs. It does not in beacon-enabled mode
+* @return true if the radio may sleep
+* @date 20261017
+*/
+uint8_t macLplActive ( void );
+
+/**
+* @brief Get the time to wait for the ACK of a strobed copy, before the next copy
+* @return the duration in us
+* @date 20261017
+*/
+uint32_t macLplAckWait ( void );
+
+/**
+* @brief Get the energy over which a wake-up sample finds a frame on air: the CCA threshold, or less if it is over the sensitivity of the profile, as a frame heard there would be missed
+* @return the energy, RSSI units
+* @date 20261017
+*/
+uint8_t macLplWakeThreshold ( void );
+
+/**
+* @brief Keep the radio on for duration us at least
+* @return No return
+* @date 20261017
+*/
+void macLplStayAwake ( uint32_t duration );
+
+/**
+* @brief Low-power listening engine: keeps the radio on while the MAC has frames to send or ACK, wakes it up every macLplInterval to sample the channel, keeps it on for the next strobed copy if a sample finds energy, and puts it to sleep else
+* @return No return
+* @date 20261017
+*/
+void macLplEngine ( void );
+
+/**
+* @brief Called by upper layer, prepare and queue a MAC-level data frame with given parameters and payload. The handle (may be NULL) receives the frame's sequence number
+* @return MCPS_DATA_REQUEST_SUCCESS, MCPS_DATA_REQUEST_MAC_TX_BUSY if the TX queue is full or MCPS_DATA_REQUEST_FRAME_TOO_LONG
 * @author Adrien van den Bossche <bossche@irit.fr>
 * @date 20111118
 */
-uint8_t MCPS_data_request ( uint8_t ackRequest, uint8_t intraPan, uint16_t panId, uint8_t mode, uint16_t destinationAddress, struct txFrame_t *txFrame );
+uint8_t MCPS_data_request ( uint8_t ackRequest, uint8_t intraPan, uint16_t panId, uint16_t destinationAddress, uint8_t* payload, uint8_t payloadLength, uint8_t* handle );
+
+/**
+* @brief Make the MAC header of a data frame directly in the next free slot of the TX queue, with frameFlags added to its frame control field. The caller writes the payload at the returned address, then calls macCommitDataFrame
+* @return the address of the payload in the frame (up to maxPayloadLength bytes), NULL if the TX queue is full or a frame is begun already
+* @date 20261017
+*/
+uint8_t* macBeginDataFrame ( uint8_t ackRequest, uint8_t intraPan, uint16_t panId, uint16_t destinationAddress, uint8_t* maxPayloadLength, uint16_t frameFlags );
+
+/**
+* @brief Queue the frame prepared with macBeginDataFrame, with a payload of payloadLength bytes, or drop it if it is too long. The handle (may be NULL) receives the frame's sequence number
+* @return MCPS_DATA_REQUEST_SUCCESS, MCPS_DATA_REQUEST_FRAME_TOO_LONG or MCPS_DATA_REQUEST_NO_FRAME if no frame has been begun
+* @date 20261017
+*/
+uint8_t macCommitDataFrame ( uint8_t payloadLength, uint8_t* handle );
+
+/**
+* @brief Append a payload to the last frame of the TX queue if it is still open (MAC_AGGREGATION_HOLD), goes to the same destination and has room left. The handle (may be NULL) receives the frame's sequence number
+* @return true if the payload has been appended, false if it needs its own frame
+* @date 20261017
+*/
+uint8_t macAggregatePayload ( uint8_t ackRequest, uint8_t intraPan, uint16_t panId, uint16_t destinationAddress, uint8_t* payload, uint8_t payloadLength, uint8_t* handle );
+
+/**
+* @brief Check that the payload lengths of an aggregated frame add up to the frame length
+* @return true if the frame is well-formed
+* @date 20261017
+*/
+uint8_t macCheckAggregate ( struct rxFrame_t *rxFrame, uint8_t headerLength );
+
+/**
+* @brief Get the status of a frame queued with MCPS_data_request
+* @return MCPS_DATA_CONFIRM_STATUS_PENDING while the frame is queued, its MCPS_data_confirm status once done, MCPS_DATA_CONFIRM_STATUS_UNKNOWN if the handle is too old
+* @date 20261017
+*/
+uint8_t macGetTxStatus ( uint8_t handle );
+
+/**
+* @brief Gets the number of frames in the TX queue, including the one in the CSMA/CA engine
+* @return the number of frames
+* @date 20261017
+*/
+uint8_t macTxQueueCount ( void );
+
+/**
+* @brief Record an event in the trace ring. Only a few stores: it can be called from the CSMA/CA engine without changing its timings
+* @return No return
+* @date 20261017
+*/
+void macTraceRecord ( uint8_t event, uint8_t value, uint16_t arg );
+
+/**
+* @brief Copy the traced events, oldest first, to events (up to maxCount)
+* @return the number of events copied, 0 if MAC_TRACE is not defined
+* @date 20261017
+*/
+uint16_t macTraceGet ( struct macTraceEvent_t* events, uint16_t maxCount );
+
+/**
+* @brief Print the traced events on console, oldest first, one "TRACE timestamp event value arg" line per event, and empty the trace
+* @return No return
+* @date 20261017
+*/
+void macTraceDump ( void );
 
 /**
 * @brief Give received data from physical layer
@@ -137,6 +612,13 @@ uint8_t MCPS_data_request ( uint8_t ackRequest, uint8_t intraPan, uint16_t panId
 */
 void PD_data_indication ( struct rxFrame_t *rxFrame );
 
+/**
+* @brief Called by PHY layer when the transmission of a frame is over
+* @return No return
+* @date 20261017
+*/
+void PD_data_confirm ( struct txFrame_t *txFrame );
+
 /**
 * @brief Make a frame control field with given parameters
 * @return Return the frame control field
@@ -170,6 +652,55 @@ uint8_t macDecodeMacHeader ( uint8_t *frameType, uint8_t *ackRequest, uint8_t *i
 */
 void macSendAck ( uint8_t sqn );
 
+/**
+* @brief Send a block ACK to destinationAddress: sqn is its last data sequence number received, and bit k of bitmap is set if (sqn - k) has been received
+* @return No return
+* @date 20261017
+*/
+void macSendBlockAck ( uint16_t destinationAddress, uint8_t sqn, uint32_t bitmap );
+
+/**
+* @brief Open a window on the frames at the head of the TX queue that go to the same destination with FRAME_BLOCK_ACK, up to MAC_BLOCK_ACK_WINDOW
+* @return No return
+* @date 20261017
+*/
+void macOpenWindow ( void );
+
+/**
+* @brief Get frame k of the window
+* @return the frame, in the TX queue
+* @date 20261017
+*/
+struct txFrame_t* macWindowFrame ( uint8_t k );
+
+/**
+* @brief Find the first frame of the window not ACKed yet, from frame k
+* @return its index in the window, macWindowCount if none
+* @date 20261017
+*/
+uint8_t macWindowNextFrame ( uint8_t k );
+
+/**
+* @brief Confirm the frames ACKed at the beginning of the window, or all of them with status for those not ACKed if all is true
+* @return No return
+* @date 20261017
+*/
+void macConfirmWindow ( uint8_t all, uint8_t status );
+
+/**
+* @brief Mark the frames of the window ACKed by a received block ACK
+* @return No return
+* @date 20261017
+*/
+void macReceiveBlockAck ( uint8_t sqn, uint32_t bitmap );
+
+/**
+* @brief Send the ACK scheduled by macDecodeReceivedFrame if its time has come, waiting in place if it is MAC_ACK_SPIN_MAX us away or less
+* @return true if the ACK has been sent (or dropped because too late), false if it is still pending
+* @date 20261017
+*/
+uint8_t macSendScheduledAck ( void );
+
 /**
 * @brief Decode a received frame on radio
 * @return No return
@@ -178,6 +709,20 @@ void macSendAck ( uint8_t sqn );
 */
 void macDecodeReceivedFrame ( struct rxFrame_t *rxFrame );
 
+/**
+* @brief Get the oldest received payload kept in the reception queue, without removing it nor copying it. The payloads of an aggregated frame are given one by one
+* @return the received frame holding the payload, NULL if no payload is available
+* @date 20261017
+*/
+struct rxFrame_t* macGetReceivedPayload ( uint16_t* sourceAddress, uint8_t** payload, uint8_t* payloadLength );
+
+/**
+* @brief Remove the oldest received payload from the reception queue. An aggregated frame is freed with its last payload
+* @return No return
+* @date 20261017
+*/
+void macFreeReceivedPayload ( void );
+
 /**
 * @brief Initialize the neighbour table and tools
 * @date 20131102
@@ -187,10 +732,10 @@ void macDecodeReceivedFrame ( struct rxFrame_t *rxFrame );
 void neighbInit ( void );
 
 /**
-* @brief Process neighbour engine. Must be called regularly.
+* @brief Process neighbour engine. Must be called regularly. Checks NEIGHB_ENGINE_SLOTS_PER_CALL slots of the table per call: removes neighbors not heard for NEIGHB_NEIGHBOR_TIMEOUT and looks for the least recently heard one
 * @return No return
 * @author Adrien van den Bossche <bossche@irit.fr>
-* @date 20140720
+* @date 20261017
 */
 void neighbEngine ( void );
 
@@ -203,21 +748,35 @@ void neighbEngine ( void );
 void neighbFreeNeighborTable ( void );
 
 /**
-* @brief adds a node in the neighbor table if it is not present yet
-* @return returns the number of times of nodeAdress is seen in the neighbor table before adding or -1 if neighbor table is full
+* @brief adds a node in the neighbor table if it is not present yet. The lookup and the insertion share one probe sequence. If the table is full, the least recently heard neighbor found by neighbEngine is replaced
+* @return returns the index of nodeAddress in the neighbor table (new or not), or NEIGHB_NEIGHBOR_NOT_FOUND if neighbor table is full and no neighbor can be replaced yet
 * @author Adrien van den Bossche <bossche@irit.fr>
-* @date 20110607
+* @date 20261017
 */
 uint8_t neighbAddNeighbor ( uint16_t nodeAddress, uint32_t lastUpdate, uint8_t RSSI );
 
 /**
 * @brief get neighbor index
-* @return returns the index of the first nodeAddress found in the neighbor table or NEIGHB_TABLE_NEIGHBOR_NOT_FOUND if not present
+* @return returns the index of nodeAddress in the neighbor table or NEIGHB_NEIGHBOR_NOT_FOUND if not present
 * @author Adrien van den Bossche <bossche@irit.fr>
-* @date 20110607
+* @date 20261017
 */
 uint8_t neighbGetNeighborIndex ( uint16_t nodeAddress );
 
+/**
+* @brief removes the neighbor at elementIndex. The following entries of its probe sequence are moved back, so lookups never need tombstones
+* @return no return
+* @date 20261017
+*/
+void neighbRemoveNeighborIndex ( uint8_t elementIndex );
+
+/**
+* @brief first slot of the probe sequence of nodeAddress (internal usage)
+* @return the slot index
+* @date 20261017
+*/
+uint8_t neighbHash ( uint16_t nodeAddress );
+
 /**
 * @brief update a node in the neighbor table 
 * @return returns TRUE if update succefull or FALSE otherwise
@@ -226,6 +785,50 @@ uint8_t neighbGetNeighborIndex ( uint16_t nodeAddress );
 */
 uint8_t neighbUpdateNeighbor ( uint16_t nodeAddress, uint32_t lastUpdate, uint8_t RSSI );
 
+/**
+* @brief tells if a data frame with sequenceNumber has already been received from the neighbor at elementIndex, in the last NEIGHB_DUPLICATE_WINDOW sequence numbers
+* @return true if the frame is a duplicate
+* @date 20261017
+*/
+uint8_t neighbIsDuplicateData ( uint8_t elementIndex, uint8_t sequenceNumber );
+
+/**
+* @brief records sequenceNumber in the data window of the neighbor at elementIndex. A number older than the window restarts it (the neighbor rebooted)
+* @return no return
+* @date 20261017
+*/
+void neighbRecordData ( uint8_t elementIndex, uint8_t sequenceNumber );
+
+/**
+* @brief update the RSSI average of a neighbor, and its PRR from the gaps between the sequence numbers of its data frames and commands (numbered: sequenceNumber is from mac_sqn.data of the source). Called for each frame received from it
+* @return no return
+* @date 20261017
+*/
+void neighbUpdateLinkQuality ( uint8_t elementIndex, uint8_t RSSI, uint8_t numbered, uint8_t sequenceNumber );
+
+/**
+* @brief update the ETX of the link to nodeAddress with the result of a frame that requested an ACK. The neighbor is added if it is not present yet (its ACK proves the link)
+* @return no return
+* @date 20261017
+*/
+void neighbUpdateEtx ( uint16_t nodeAddress, uint8_t transmissions, uint8_t acked );
+
+#ifdef PHY_TIMESTAMPS_AT_TX
+/**
+* @brief update the clock offset and skew of a neighbor with the TX and RX timestamps of a frame received from it (length without the trailer). A pair is kept every NEIGHB_CLOCK_SKEW_INTERVAL
+* @return no return
+* @date 20261017
+*/
+void neighbUpdateClock ( uint8_t elementIndex, uint32_t rxTimestamp, uint32_t txTimestamp, uint8_t length );
+
+/**
+* @brief get the clock of a neighbor minus the local clock, at localTime
+* @return the offset in us, 0 if its clock is not known yet
+* @date 20261017
+*/
+int32_t neighbClockOffset ( uint8_t elementIndex, uint32_t localTime );
+#endif
+
 /**
 * @brief set data of the #elementIndex of the neighbor table (internal usage)
 * @return no return
@@ -259,7 +862,7 @@ uint8_t neighbGetNeighbors ( uint16_t* list );
 void neighbPrintNeighbors ( void );
 
 /**
-* @brief send a CBR frame 
+* @brief send a CBR frame. The payload begins with the generation time (micros()) if CBR_TX_LENGTH >= 4
 * @return no return
 * @author Adrien van den Bossche <bossche@irit.fr>
 * @date 01032015
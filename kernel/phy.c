@@ -10,6 +10,10 @@
 
 extern RH_RF22 rf22;
 
+#ifdef PHY_RX_ISR
+IntervalTimer phyRxTimer;
+#endif
+
 
 void phyInit ( void ) {
 
@@ -21,8 +25,28 @@ void phyInit ( void ) {
 
   //rf22.setFrequency(433.1 + DEFAULT_RF22_CHANNEL*0.1, 0.05);
   //rf22.setTxPower(DEFAULT_RF22_TXPOWER);
-  rf22.setModemConfig(RH_RF22::GFSK_Rb125Fd125);
+  phyModemProfile = phyRadioProfile = MODEM_PROFILE_125K;
+  rf22.setModemConfig(phyModemConfigs[phyRadioProfile]);
+  // rf22.init() tunes the radio to 434.0MHz
+  phyChannel = DEFAULT_RF22_CHANNEL;
   phyCbrNextTimeToSend = 0;
+  phyTxFrame = NULL;
+
+  phyRxFreeRing.head = phyRxFreeRing.tail = 0;
+  phyRxReceivedRing.head = phyRxReceivedRing.tail = 0;
+  phyRxQueue.head = phyRxQueue.tail = 0;
+  for ( uint8_t i=0; i<PHY_RX_POOL_LENGTH; i++ )
+    phyRxRingPush(&phyRxFreeRing, i);
+  memset(&phyStats, 0, sizeof(phyStats));
+  phyRxOverruns = 0;
+  phyRadioLocked = false;
+  phyRadioAsleep = false;
+  phyRadioOnSince = micros();
+  phyRadioOnMicros = 0;
+
+#ifdef PHY_RX_ISR
+  phyRxTimer.begin(phyRxIsr, PHY_RX_ISR_PERIOD);
+#endif
 }
 
 
@@ -37,27 +61,271 @@ void phyEngine ( void ) {
   }
 #endif
 
+  // End of transmission: the driver goes back to idle by itself on packet sent
+  if ( ( phyTxFrame != NULL ) && ( rf22.mode() != RHGenericDriver::RHModeTx ) ) {
+    struct txFrame_t *txf = phyTxFrame;
+    phyTxFrame = NULL;
+    PD_data_confirm(txf);
+  }
+
+  phyUpdateRadioOnTime();
+
+#ifndef PHY_RX_ISR
+  // The driver would wake the radio to listen
+  if ( !phyRadioAsleep ) phyRxReceive();
+#endif
+
+  // Give received frames to the upper layer. Frames it does not keep are freed
+  uint8_t i;
+  while ( ( i = phyRxRingPop(&phyRxReceivedRing) ) != PHY_RX_RING_EMPTY ) {
+    phyStats.rxFrames++;
+    phyRxFrameKept = false;
+    PD_data_indication(&phyRxPool[i]);
+    if ( !phyRxFrameKept ) phyRxRingPush(&phyRxFreeRing, i);
+  }
+}
+
+
+void phyRxReceive ( void ) {
+
+  // Move a received packet from the driver to phyRxReceivedRing.
+  // Called by phyEngine, or by phyRxIsr if PHY_RX_ISR is defined
+  uint8_t i;
+  uint32_t timestamp;
+  struct rxFrame_t *rxf;
+
   if (rf22.available()) {
     // Should be a message for us now
-    uint8_t buf[RH_RF22_MAX_MESSAGE_LEN];
-    uint8_t len = sizeof(buf);
-    if (rf22.recv(buf, &len)) {
-      phyCurrentRxFrame.timestamp=micros();
-      phyCurrentRxFrame.rssi=rf22.lastRssi();
-      phyCurrentRxFrame.length=len;
+    timestamp=micros();
+
+    i = phyRxRingFront(&phyRxFreeRing);
+    if ( i == PHY_RX_RING_EMPTY ) {
+      // phyEngine is late: no free frame. Read 0 byte to free the driver anyway
+      uint8_t len = 0;
+      rf22.recv(&len, &len);
+      phyRxOverruns++;
+      return;
+    }
+
+    // The driver copies the packet straight into the reception frame
+    rxf = &phyRxPool[i];
+    uint8_t len = sizeof(rxf->data);
+    if (rf22.recv(rxf->data, &len)) {
+      rxf->timestamp=timestamp;
+      rxf->rssi=rf22.lastRssi();
+      rxf->length=len;
 #ifdef PHY_TIMESTAMPS_AT_TX
-      phyCurrentRxFrame.txTimestamp = decodeUint32(&buf[len-sizeof(phyCurrentRxFrame.txTimestamp)]);
-      phyCurrentRxFrame.length-=sizeof(phyCurrentRxFrame.txTimestamp);
+      rxf->txTimestamp = decodeUint32(&rxf->data[len-sizeof(rxf->txTimestamp)]);
+      rxf->length-=sizeof(rxf->txTimestamp);
 #endif
-      for (int i=0; i<len; i++) {
-        phyCurrentRxFrame.data[i]=buf[i];
-      }
-      PD_data_indication(&phyCurrentRxFrame);
+      phyRxRingPop(&phyRxFreeRing);
+      phyRxRingPush(&phyRxReceivedRing, i);
     }
   }
 }
 
 
+void phyRxIsr ( void ) {
+
+  // The RF22 interrupt line is owned by RadioHead, whose handler already unloads the FIFO
+  // when a packet is received. This periodic interrupt only moves the packet to the
+  // reception ring, so the timestamp and the RX latency no longer depend on loop() duration
+  if ( !phyRadioLocked && !phyRadioAsleep ) phyRxReceive();
+}
+
+
+void phyLockRadio ( void ) {
+
+  phyRadioLocked = true;
+  PHY_MEMORY_BARRIER();
+}
+
+
+void phyUnlockRadio ( void ) {
+
+  PHY_MEMORY_BARRIER();
+  phyRadioLocked = false;
+}
+
+
+void phySetModemProfile ( uint8_t profile ) {
+
+  // All the nodes of the network must use the same one
+  phyModemProfile = profile;
+  phySetRadioProfile(profile);
+}
+
+
+void phySetRadioProfile ( uint8_t profile ) {
+
+  if ( profile == phyRadioProfile ) return;
+
+  // A new modem configuration would cut the frame on air
+  if ( phyTxFrame != NULL ) {
+    struct txFrame_t *previousTxf = phyTxFrame;
+    rf22.waitPacketSent();
+    phyTxFrame = NULL;
+    PD_data_confirm(previousTxf);
+  }
+
+  phyLockRadio();
+  rf22.setModemConfig(phyModemConfigs[profile]);
+  phyUnlockRadio();
+  phyRadioProfile = profile;
+}
+
+
+void phySetChannel ( uint8_t channel ) {
+
+  if ( channel == phyChannel ) return;
+
+  // A new frequency would cut the frame on air
+  if ( phyTxFrame != NULL ) {
+    struct txFrame_t *previousTxf = phyTxFrame;
+    rf22.waitPacketSent();
+    phyTxFrame = NULL;
+    PD_data_confirm(previousTxf);
+  }
+
+  phyLockRadio();
+  rf22.setFrequency(PHY_CHANNEL_BASE + channel*PHY_CHANNEL_SPACING, 0.05);
+  phyUnlockRadio();
+  phyChannel = channel;
+  delayMicroseconds(PHY_CHANNEL_SETTLE);
+}
+
+
+uint32_t phyAirTime ( uint8_t profile, uint8_t length ) {
+
+  return (uint32_t)( length + PHY_PACKET_OVERHEAD ) * phyByteDurations[profile];
+}
+
+
+uint32_t phyTimestampDelay ( uint8_t length ) {
+
+  // From the TX timestamp of a frame received now (length without the trailer) to its RX timestamp.
+  // The time the receiver takes to read it from the driver is not known: the same for all the frames
+  return PHY_TX_STARTUP + phyAirTime ( phyRadioProfile, length+PHY_TRAILER_LENGTH );
+}
+
+
+void phySleep ( void ) {
+
+  if ( phyRadioAsleep || ( phyTxFrame != NULL ) ) return;
+
+  phyUpdateRadioOnTime();
+  phyLockRadio();
+  rf22.sleep();
+  phyRadioAsleep = true;
+  phyUnlockRadio();
+}
+
+
+void phyWakeUp ( void ) {
+
+  if ( !phyRadioAsleep ) return;
+
+  // Idle until the next rf22.available() moves it to RX
+  phyLockRadio();
+  rf22.setModeIdle();
+  phyRadioAsleep = false;
+  phyUnlockRadio();
+  phyRadioOnSince = micros();
+}
+
+
+void phyUpdateRadioOnTime ( void ) {
+
+  uint32_t now;
+
+  if ( phyRadioAsleep ) return;
+  now = micros();
+  // Counted in ms: the us would wrap in 71 minutes
+  phyRadioOnMicros += now - phyRadioOnSince;
+  phyRadioOnSince = now;
+  phyStats.radioOnTime += phyRadioOnMicros / 1000;
+  phyRadioOnMicros %= 1000;
+}
+
+
+uint8_t phyRxRingCount ( struct rxRing_t *ring ) {
+
+  return (uint8_t)(ring->tail - ring->head);
+}
+
+
+void phyRxRingPush ( struct rxRing_t *ring, uint8_t i ) {
+
+  // Producer side. The ring is sized to hold every frame of the pool: it can't be full
+  ring->index[ring->tail % PHY_RX_RING_LENGTH] = i;
+  PHY_MEMORY_BARRIER();
+  ring->tail++;
+}
+
+
+uint8_t phyRxRingFront ( struct rxRing_t *ring ) {
+
+  if ( ring->head == ring->tail ) return PHY_RX_RING_EMPTY;
+  PHY_MEMORY_BARRIER();
+  return ring->index[ring->head % PHY_RX_RING_LENGTH];
+}
+
+
+uint8_t phyRxRingPop ( struct rxRing_t *ring ) {
+
+  // Consumer side
+  uint8_t i;
+
+  i = phyRxRingFront(ring);
+  if ( i == PHY_RX_RING_EMPTY ) return i;
+  PHY_MEMORY_BARRIER();
+  ring->head++;
+  return i;
+}
+
+
+uint8_t phyRxQueueCommit ( struct rxFrame_t *rxf ) {
+
+  // Called by upper layer from PD_data_indication to keep the frame until recv
+  if ( phyRxRingCount(&phyRxQueue) == PHY_RX_QUEUE_LENGTH ) {
+    phyStats.rxQueueOverflows++;
+    if ( phyDebug ) {
+      Serial.printf("PHY_DEBUG RX queue full, frame dropped\n");
+    }
+    return false;
+  }
+
+  phyRxRingPush(&phyRxQueue, rxf - phyRxPool);
+  phyRxFrameKept = true;
+  return true;
+}
+
+
+struct rxFrame_t* phyRxQueueFront ( void ) {
+
+  uint8_t i;
+
+  i = phyRxRingFront(&phyRxQueue);
+  if ( i == PHY_RX_RING_EMPTY ) return NULL;
+  return &phyRxPool[i];
+}
+
+
+void phyRxQueuePop ( void ) {
+
+  uint8_t i;
+
+  i = phyRxRingPop(&phyRxQueue);
+  if ( i != PHY_RX_RING_EMPTY ) phyRxRingPush(&phyRxFreeRing, i);
+}
+
+
+uint8_t phyRxQueueCount ( void ) {
+
+  return phyRxRingCount(&phyRxQueue);
+}
+
+
 /* Now in mac.c (upper layer)
 void PD_data_indication ( struct rxFrame_t *rxf ) {
 
@@ -78,13 +346,25 @@ void PD_data_request ( struct txFrame_t *txf ) {
   Serial.print("| ...");
 */
 
+  // Only one frame on air: if the previous one is not sent yet, wait for it and confirm it
+  if ( phyTxFrame != NULL ) {
+    struct txFrame_t *previousTxf = phyTxFrame;
+    rf22.waitPacketSent();
+    phyTxFrame = NULL;
+    PD_data_confirm(previousTxf);
+  }
+
 #ifdef PHY_TIMESTAMPS_AT_TX
   encodeUint32(micros(), &txf->data[txf->length]);
   txf->length+=4;
 #endif
 
+  // Start the transmission and return. phyEngine calls PD_data_confirm when done
+  phyLockRadio();
   rf22.send(txf->data, txf->length);
-  rf22.waitPacketSent();
+  phyTxFrame = txf;
+  phyUnlockRadio();
+  phyStats.txFrames++;
   //Serial.print(" Sent.\n");
 
 #ifdef PHY_TIMESTAMPS_AT_TX
@@ -95,24 +375,42 @@ void PD_data_request ( struct txFrame_t *txf ) {
 }
 
 
-void phySendRandomFrame ( uint8_t length ) {
+uint8_t phyTxBusy ( void ) {
+
+  return phyTxFrame != NULL;
+}
 
-  txFrame_t txf;
 
-  makeRandomBytes(txf.data, length); 
-  txf.length = length;
-  PD_data_request(&txf);
+void phySendRandomFrame ( uint8_t length ) {
+
+  phyWaitCurrentTxFrame();
+  makeRandomBytes(phyCurrentTxFrame.data, length); 
+  phyCurrentTxFrame.length = length;
+  PD_data_request(&phyCurrentTxFrame);
 }
 
 
 void phySendStringFrame ( char* str ) {
 
-  txFrame_t txf;
-  
-  for (unsigned int i=0; i<strlen(str); i++)
-    txf.data[i]=str[i];
-  txf.length = strlen(str);
-  PD_data_request(&txf);
+  size_t length;
+
+  phyWaitCurrentTxFrame();
+  length = strlen(str);
+  if ( length > MAX_FRAME_LENGTH ) length = MAX_FRAME_LENGTH;
+  memcpy(phyCurrentTxFrame.data, str, length);
+  phyCurrentTxFrame.length = length;
+  PD_data_request(&phyCurrentTxFrame);
+}
+
+
+void phyWaitCurrentTxFrame ( void ) {
+
+  // PD_data_request returns before the end of the transmission: the buffer is still on air
+  if ( phyTxFrame == &phyCurrentTxFrame ) {
+    rf22.waitPacketSent();
+    phyTxFrame = NULL;
+    PD_data_confirm(&phyCurrentTxFrame);
+  }
 }
 
 
@@ -120,11 +418,13 @@ uint8_t phyEdRequest ( void ) {
 
   uint8_t rssi[3];
 
+  phyLockRadio();
   rf22.setModeRx();
   rssi[0] = rf22.rssiRead();
   rssi[1] = rf22.rssiRead();
   rssi[2] = rf22.rssiRead();
   rf22.setModeIdle();
+  phyUnlockRadio();
 
   if ( rssi[0] == rssi[1] ) return rssi[1];
   if ( rssi[1] == rssi[2] ) return rssi[2];
@@ -5,15 +5,93 @@
  * @date 20130901
  */
 
-rxFrame_t phyCurrentRxFrame; // No queue for reception
-txFrame_t phyCurrentTxFrame; // No queue for transmission
+#ifndef PHY_RX_QUEUE_LENGTH
+#define PHY_RX_QUEUE_LENGTH 8 // received frames kept for upper layers, must be a power of 2
+#endif
+#define PHY_RX_SPARE_FRAMES 2 // frames still available for reception (ACKs) when upper layers keep PHY_RX_QUEUE_LENGTH frames
+#define PHY_RX_POOL_LENGTH ( PHY_RX_QUEUE_LENGTH + PHY_RX_SPARE_FRAMES )
+#define PHY_RX_RING_LENGTH ( 2 * PHY_RX_QUEUE_LENGTH ) // power of 2 >= PHY_RX_POOL_LENGTH
+#define PHY_RX_RING_EMPTY 0xFF
+#define PHY_RX_ISR_PERIOD 100 // us, RX service interrupt period when PHY_RX_ISR is defined
+#define PHY_MODEM_PROFILES 4 // MODEM_PROFILE_* in SimpleWiNo.h
+#define PHY_PACKET_OVERHEAD 13 // bytes sent by the RF22 with each frame: preamble 4, sync 2, RadioHead header 4, length 1, CRC 2
+#define PHY_CHANNELS 18 // NODE_CHANNEL: PHY_CHANNEL_BASE + PHY_CHANNEL_SPACING * channel
+#define PHY_CHANNEL_BASE 433.0 // MHz
+#define PHY_CHANNEL_SPACING 0.1 // MHz
+#define PHY_CHANNEL_SETTLE 200 // us for the synthesizer to lock on a new channel, before a RSSI reading or a transmission
+#ifndef PHY_TX_STARTUP
+#define PHY_TX_STARTUP 100 // us from the TX timestamp (PHY_TIMESTAMPS_AT_TX) to the first bit on air
+#endif
+
+#if ( PHY_RX_QUEUE_LENGTH & ( PHY_RX_QUEUE_LENGTH - 1 ) ) || ( PHY_RX_QUEUE_LENGTH < 2 ) || ( PHY_RX_QUEUE_LENGTH > 64 )
+#error "PHY_RX_QUEUE_LENGTH must be a power of 2 between 2 and 64"
+#endif
+
+// Compiler barrier: keeps frame accesses ordered with ring index updates shared with the RX interrupt
+#define PHY_MEMORY_BARRIER() __asm__ __volatile__ ( "" ::: "memory" )
+
+struct rxRing_t {
+ /**
+  * @brief Lock-free single-producer/single-consumer ring of phyRxPool indexes
+  */
+  volatile uint8_t head;/**< @brief Next index to read, written by the consumer only (free running).*/
+  volatile uint8_t tail;/**< @brief Next index to write, written by the producer only (free running).*/
+  uint8_t index[PHY_RX_RING_LENGTH];
+
+}; // rxRing_t
+
+rxFrame_t phyRxPool[PHY_RX_POOL_LENGTH]; // Reception frames, never copied: only their indexes move between rings
+struct rxRing_t phyRxFreeRing; // Free frames, from phyEngine/recv to the reception
+struct rxRing_t phyRxReceivedRing; // Received frames, from the reception (phyEngine or phyRxIsr) to phyEngine
+struct rxRing_t phyRxQueue; // Frames kept by upper layers until recv
+uint8_t phyRxFrameKept; // Set by phyRxQueueCommit during PD_data_indication
+struct phyStats_t phyStats; // Main context counters
+volatile uint32_t phyRxOverruns; // Packets dropped by the reception because no frame was free (phyEngine late). Apart from phyStats: written by the RX interrupt
+volatile uint8_t phyRadioLocked; // The main context is using the radio: the RX interrupt must not touch it
+txFrame_t phyCurrentTxFrame; // Frame of phySendRandomFrame and phySendStringFrame, on air after they return
+struct txFrame_t *phyTxFrame; // Frame being transmitted, NULL if the transmitter is free
 uint32_t phyCbrNextTimeToSend;
+uint8_t phyModemProfile; // Profile of the network: broadcasts, CSMA/CA and idle listening
+uint8_t phyRadioProfile; // Profile of the radio now: phyModemProfile, or a faster one for a rate switch exchange
+uint8_t phyChannel; // Channel the radio is tuned to now: NODE_CHANNEL, or another one (kernel/chan.h)
+volatile uint8_t phyRadioAsleep; // The RF22 sleeps (MAC_LPL_INTERVAL): nothing is received, the RX interrupt must not wake it
+uint32_t phyRadioOnSince; // Radio on time counted in phyStats.radioOnTime up to then
+uint32_t phyRadioOnMicros; // Radio on time not counted yet, < 1000 us after each update
+
+// Modem profiles, fastest first: RF22 modem configuration, time on air of one byte (us) and
+// weakest RSSI received (RSSI units, 0.5dB, from the Si4432 sensitivity: 1dB lost per dB of bit rate)
+const RH_RF22::ModemConfigChoice phyModemConfigs[PHY_MODEM_PROFILES] = { RH_RF22::GFSK_Rb125Fd125, RH_RF22::GFSK_Rb57_6Fd28_8, RH_RF22::GFSK_Rb19_2Fd9_6, RH_RF22::GFSK_Rb4_8Fd45 };
+const uint16_t phyByteDurations[PHY_MODEM_PROFILES] = { 64, 139, 417, 1667 };
+const uint8_t phyModemSensitivities[PHY_MODEM_PROFILES] = { 38, 30, 20, 8 };
 
 void phyInit ( void );
 void phyEngine ( void );
 void PD_data_indication ( struct rxFrame_t *rxf );
 void PD_data_request ( struct txFrame_t *txf );
+void PD_data_confirm ( struct txFrame_t *txf );
+uint8_t phyTxBusy ( void );
 uint8_t phyEdRequest ( void );
 void phySendRandomFrame ( uint8_t length );
 void phySendStringFrame ( char* str );
+void phyWaitCurrentTxFrame ( void );
+uint8_t phyRxQueueCommit ( struct rxFrame_t *rxf );
+struct rxFrame_t* phyRxQueueFront ( void );
+void phyRxQueuePop ( void );
+uint8_t phyRxQueueCount ( void );
+void phyRxReceive ( void );
+void phyRxIsr ( void );
+uint8_t phyRxRingCount ( struct rxRing_t *ring );
+void phyRxRingPush ( struct rxRing_t *ring, uint8_t i );
+uint8_t phyRxRingFront ( struct rxRing_t *ring );
+uint8_t phyRxRingPop ( struct rxRing_t *ring );
+void phyLockRadio ( void );
+void phyUnlockRadio ( void );
+void phySetModemProfile ( uint8_t profile );
+void phySetRadioProfile ( uint8_t profile );
+void phySetChannel ( uint8_t channel );
+uint32_t phyAirTime ( uint8_t profile, uint8_t length );
+uint32_t phyTimestampDelay ( uint8_t length );
+void phySleep ( void );
+void phyWakeUp ( void );
+void phyUpdateRadioOnTime ( void );
 
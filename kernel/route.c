@@ -0,0 +1,593 @@
+/**
+ * @file route.c
+ * @brief Multi-hop routing between the MAC and the send/recv API: a collection tree toward the sinks, and on-demand point-to-point routes
+ * @date 20261017
+ */
+
+#include "route.h"
+
+extern uint16_t nodeShortAddress;
+extern uint16_t nodePanId;
+
+
+void routeInit ( void ) {
+
+  uint8_t i;
+
+  routeInterval = 0;
+  routeSink = false;
+  routeSinkAddress = ROUTE_ADDRESS_NONE;
+  routeParent = ROUTE_ADDRESS_NONE;
+  routePathMetric = ROUTE_METRIC_NONE;
+  routeFeasibleMetric = ROUTE_METRIC_NONE;
+  for ( i=0; i<ROUTE_CANDIDATES; i++ )
+    routeCandidates[i].address = ROUTE_ADDRESS_NONE;
+  for ( i=0; i<ROUTE_TABLE_LENGTH; i++ )
+    routeTable[i].destination = ROUTE_ADDRESS_NONE;
+  for ( i=0; i<ROUTE_REQUEST_CACHE; i++ )
+    routeRequestOrigins[i] = ROUTE_ADDRESS_NONE;
+  routeRequestNext = 0;
+  for ( i=0; i<ROUTE_ORIGINS; i++ )
+    routeOrigins[i].address = ROUTE_ADDRESS_NONE;
+  routeDiscoveryTarget = ROUTE_ADDRESS_NONE;
+  for ( i=0; i<ROUTE_FORWARD_QUEUE_LENGTH; i++ )
+    routeQueue[i].state = ROUTE_ENTRY_FREE;
+}
+
+
+void routeSetInterval ( uint16_t interval ) {
+
+  routeInterval = interval;
+  if ( interval == 0 ) return;
+  routeNextBeacon = micros() + random( (uint32_t)interval * 1000 );
+  // After a reboot, the neighbors may still remember the last route requests, beacons and frames of this node
+  routeRequestId = random(256);
+  routeSequence = random(256);
+  routeDataSequence = random(256);
+}
+
+
+void routeSetSink ( uint8_t sink ) {
+
+  routeSink = sink;
+  routeParent = ROUTE_ADDRESS_NONE;
+  routeSinkAddress = sink ? nodeShortAddress : ROUTE_ADDRESS_NONE;
+  routePathMetric = sink ? 0 : ROUTE_METRIC_NONE;
+}
+
+
+void routeEngine ( void ) {
+
+  struct routeQueueEntry_t *entry;
+  uint32_t interval, latency;
+  uint16_t nextHop;
+  uint8_t *payload;
+  uint8_t maxPayloadLength, status, i;
+
+  if ( routeInterval == 0 ) return;
+  interval = (uint32_t)routeInterval * 1000;
+
+  if ( cmpUi32GreaterOrEqualWithRollover ( micros(), routeNextBeacon ) ) {
+    // Jitter: the beacons are broadcast without ACK, they must not collide at each interval
+    routeNextBeacon = micros() + interval - interval / 4 + random( interval / 2 );
+    // Drops the candidates not heard anymore. Nodes out of any tree stay silent
+    routeSelectParent();
+    if ( routeSink ) routeSequence++;
+    if ( routeSink || ( routeParent != ROUTE_ADDRESS_NONE ) ) routeSendBeacon();
+  }
+
+  if ( ( routeDiscoveryTarget != ROUTE_ADDRESS_NONE ) && (int32_t)( micros() - routeDiscoveryTime ) > ROUTE_DISCOVERY_TIMEOUT )
+    routeDiscoveryTarget = ROUTE_ADDRESS_NONE;
+
+  for ( i=0; i<ROUTE_FORWARD_QUEUE_LENGTH; i++ ) {
+    entry = &routeQueue[i];
+
+    if ( entry->state == ROUTE_ENTRY_SENDING ) {
+      status = macGetTxStatus ( entry->handle );
+      if ( status == MCPS_DATA_CONFIRM_STATUS_PENDING ) continue;
+      if ( status == MCPS_DATA_CONFIRM_STATUS_SUCCESS ) {
+        latency = micros() - entry->arrival;
+        routeStats.forwarded++;
+        routeStats.hopLatencyTotal += latency;
+        if ( latency > routeStats.hopLatencyMax ) routeStats.hopLatencyMax = latency;
+        entry->state = ROUTE_ENTRY_FREE;
+        continue;
+      }
+      if ( status == MCPS_DATA_CONFIRM_STATUS_UNKNOWN ) {
+        // Confirm history overwritten: its fate is not known
+        entry->state = ROUTE_ENTRY_FREE;
+        continue;
+      }
+      // Not ACKed: another next hop, or the same one later
+      routeLinkFailed ( entry->nextHop );
+      if ( entry->attempts >= ROUTE_MAX_ATTEMPTS ) {
+        routeStats.forwardFailures++;
+        if ( macDebug ) {
+          Serial.printf("ROUTE_DEBUG frame to %04X dropped, %04X did not ACK it\n", decodeUint16 ( &entry->data[ROUTE_HEADER_DESTINATION] ), entry->nextHop);
+        }
+        entry->state = ROUTE_ENTRY_FREE;
+        continue;
+      }
+      entry->state = ROUTE_ENTRY_WAITING;
+      entry->waiting = micros();
+    }
+
+    if ( entry->state != ROUTE_ENTRY_WAITING ) continue;
+
+    nextHop = routeNextHop ( decodeUint16 ( &entry->data[ROUTE_HEADER_DESTINATION] ) );
+    if ( nextHop == ROUTE_ADDRESS_NONE ) {
+      if ( (int32_t)( micros() - entry->waiting ) > ROUTE_DISCOVERY_TIMEOUT ) {
+        routeStats.noRoute++;
+        entry->state = ROUTE_ENTRY_FREE;
+      } else routeDiscover ( decodeUint16 ( &entry->data[ROUTE_HEADER_DESTINATION] ) );
+      continue;
+    }
+
+    // The network header is kept up to the final destination: it gives the origin to recv
+    payload = macBeginDataFrame ( true, true, nodePanId, nextHop, &maxPayloadLength, FRAME_ROUTED );
+    if ( payload == NULL ) break;
+    memcpy(payload, entry->data, entry->length);
+    if ( macCommitDataFrame ( entry->length, &entry->handle ) != MCPS_DATA_REQUEST_SUCCESS ) break;
+    entry->nextHop = nextHop;
+    entry->attempts++;
+    entry->state = ROUTE_ENTRY_SENDING;
+  }
+}
+
+
+uint8_t routeDataRequest ( uint16_t destinationAddress, uint8_t* payload, uint8_t payloadLength, uint8_t* handle ) {
+
+  uint8_t *framePayload;
+  uint8_t maxPayloadLength;
+  uint16_t nextHop;
+
+  nextHop = routeNextHop ( destinationAddress );
+  if ( nextHop == ROUTE_ADDRESS_NONE ) {
+    routeStats.noRoute++;
+    routeDiscover ( destinationAddress );
+    return ROUTE_DATA_REQUEST_NO_ROUTE;
+  }
+  // In reach: a plain data frame, that may be aggregated
+  if ( nextHop == destinationAddress )
+    return MCPS_data_request ( true, true, nodePanId, destinationAddress, payload, payloadLength, handle );
+
+  framePayload = macBeginDataFrame ( true, true, nodePanId, nextHop, &maxPayloadLength, FRAME_ROUTED );
+  if ( framePayload == NULL )
+    return MCPS_DATA_REQUEST_MAC_TX_BUSY;
+  if ( payloadLength > maxPayloadLength - ROUTE_HEADER_LENGTH ) {
+    macOpenFrameHeaderLength = 0;
+    return MCPS_DATA_REQUEST_FRAME_TOO_LONG;
+  }
+  encodeUint16 ( nodeShortAddress, &framePayload[ROUTE_HEADER_ORIGIN] );
+  encodeUint16 ( destinationAddress, &framePayload[ROUTE_HEADER_DESTINATION] );
+  framePayload[ROUTE_HEADER_HOPS] = 0;
+  framePayload[ROUTE_HEADER_SEQUENCE] = ++routeDataSequence;
+  memcpy(&framePayload[ROUTE_HEADER_LENGTH], payload, payloadLength);
+  return macCommitDataFrame ( ROUTE_HEADER_LENGTH + payloadLength, handle );
+}
+
+
+uint8_t routeIndication ( uint16_t sourceAddress, uint8_t* payload, uint8_t payloadLength ) {
+
+  struct routeQueueEntry_t *entry;
+  uint16_t origin, destination;
+  uint8_t i, count;
+
+  if ( payloadLength < ROUTE_HEADER_LENGTH ) {
+    macStats.malformedFrames++;
+    return ROUTE_INDICATION_FORWARDED;
+  }
+  origin = decodeUint16 ( &payload[ROUTE_HEADER_ORIGIN] );
+  destination = decodeUint16 ( &payload[ROUTE_HEADER_DESTINATION] );
+  // Taken already, but its ACK was lost: the previous hop sent it again, maybe through another node
+  if ( routeIsDuplicate ( payload ) ) {
+    routeStats.duplicates++;
+    if ( macDebug ) {
+      Serial.printf("ROUTE_DEBUG duplicate %d from %04X dropped\n", payload[ROUTE_HEADER_SEQUENCE], origin);
+    }
+    return ROUTE_INDICATION_FORWARDED;
+  }
+  if ( destination == nodeShortAddress ) {
+    if ( routeInterval ) routeUpdate ( origin, sourceAddress, ROUTE_METRIC_LEARNED );
+    return ROUTE_INDICATION_DELIVER;
+  }
+  if ( routeInterval == 0 ) return ROUTE_INDICATION_FORWARDED;
+
+  if ( ( origin == nodeShortAddress ) || ( payload[ROUTE_HEADER_HOPS] + 1 >= ROUTE_MAX_HOPS ) ) {
+    routeStats.loops++;
+    if ( macDebug ) {
+      Serial.printf("ROUTE_DEBUG loop: frame from %04X to %04X dropped\n", origin, destination);
+    }
+    return ROUTE_INDICATION_FORWARDED;
+  }
+  // The way back to the origin
+  routeUpdate ( origin, sourceAddress, ROUTE_METRIC_LEARNED );
+
+  entry = NULL;
+  count = 0;
+  for ( i=0; i<ROUTE_FORWARD_QUEUE_LENGTH; i++ ) {
+    if ( routeQueue[i].state != ROUTE_ENTRY_FREE ) count++;
+    else if ( entry == NULL ) entry = &routeQueue[i];
+  }
+  if ( entry == NULL ) {
+    routeStats.queueFull++;
+    return ROUTE_INDICATION_QUEUE_FULL;
+  }
+  routeStats.queued++;
+  routeStats.queueOccupancyTotal += count;
+  if ( count >= routeStats.queueMax ) routeStats.queueMax = count + 1;
+
+  routeRecordOrigin ( payload );
+  memcpy(entry->data, payload, payloadLength);
+  entry->data[ROUTE_HEADER_HOPS]++;
+  entry->length = payloadLength;
+  entry->attempts = 0;
+  entry->arrival = entry->waiting = micros();
+  entry->state = ROUTE_ENTRY_WAITING;
+  return ROUTE_INDICATION_FORWARDED;
+}
+
+
+void routeCommandIndication ( uint16_t sourceAddress, uint8_t* payload, uint8_t payloadLength ) {
+
+  struct routeCandidate_t *candidate, *worst;
+  uint16_t origin, target, metric, nextHop;
+  uint32_t sum;
+  uint8_t i;
+
+  if ( routeInterval == 0 ) return;
+
+  switch ( payload[0] ) {
+
+    case MAC_COMMAND_ROUTE_BEACON:
+
+      if ( ( payloadLength < ROUTE_BEACON_LENGTH ) || routeSink ) return;
+      metric = decodeUint16 ( &payload[5] );
+      candidate = NULL;
+      worst = NULL;
+      for ( i=0; i<ROUTE_CANDIDATES; i++ ) {
+        if ( routeCandidates[i].address == sourceAddress ) candidate = &routeCandidates[i];
+        // Free entry, or else the worst path but the parent
+        else if ( ( worst == NULL ) || ( ( worst->address != ROUTE_ADDRESS_NONE )
+                  && ( ( routeCandidates[i].address == ROUTE_ADDRESS_NONE ) || ( routeCandidates[i].metric > worst->metric ) ) ) ) {
+          if ( ( routeCandidates[i].address == ROUTE_ADDRESS_NONE ) || ( routeCandidates[i].address != routeParent ) ) worst = &routeCandidates[i];
+        }
+      }
+      // A child of this node is never its parent
+      if ( decodeUint16 ( &payload[3] ) == nodeShortAddress ) {
+        if ( candidate != NULL ) candidate->address = ROUTE_ADDRESS_NONE;
+        if ( sourceAddress == routeParent ) routeSelectParent();
+        return;
+      }
+      if ( candidate == NULL ) {
+        // Table full: a better path only replaces the worst one
+        if ( ( worst == NULL ) || ( ( worst->address != ROUTE_ADDRESS_NONE ) && ( metric >= worst->metric ) ) ) return;
+        candidate = worst;
+        candidate->address = sourceAddress;
+      }
+      candidate->sink = decodeUint16 ( &payload[1] );
+      candidate->metric = metric;
+      candidate->sequence = payload[7];
+      candidate->lastHeard = micros();
+      routeSelectParent();
+      break;
+
+    case MAC_COMMAND_ROUTE_REQUEST:
+
+      if ( payloadLength < ROUTE_REQUEST_LENGTH ) return;
+      origin = decodeUint16 ( &payload[1] );
+      target = decodeUint16 ( &payload[3] );
+      if ( ( origin == nodeShortAddress ) || routeRequestSeen ( origin, payload[5] ) ) return;
+      // Only the first copy is flooded: the reverse path is the fastest one, not always the best
+      metric = routeLinkMetric ( sourceAddress );
+      if ( metric == ROUTE_METRIC_NONE ) return;
+      sum = (uint32_t)decodeUint16 ( &payload[6] ) + metric;
+      metric = sum < ROUTE_METRIC_LEARNED ? sum : ROUTE_METRIC_LEARNED - 1;
+      routeUpdate ( origin, sourceAddress, metric );
+      if ( target == nodeShortAddress ) {
+        // The reply takes the reverse path, hop by hop with ACKs
+        payload[0] = MAC_COMMAND_ROUTE_REPLY;
+        encodeUint16 ( 0, &payload[5] );
+        macQueueCommand ( ACK_REQUESTED, sourceAddress, payload, ROUTE_REPLY_LENGTH );
+        return;
+      }
+      encodeUint16 ( metric, &payload[6] );
+      macQueueCommand ( NO_ACK_REQUESTED, BROADCAST_ADDRESS, payload, ROUTE_REQUEST_LENGTH );
+      break;
+
+    case MAC_COMMAND_ROUTE_REPLY:
+
+      if ( payloadLength < ROUTE_REPLY_LENGTH ) return;
+      origin = decodeUint16 ( &payload[1] );
+      target = decodeUint16 ( &payload[3] );
+      metric = routeLinkMetric ( sourceAddress );
+      if ( metric == ROUTE_METRIC_NONE ) metric = NEIGHB_ETX_FAILURE << 4;
+      sum = (uint32_t)decodeUint16 ( &payload[5] ) + metric;
+      metric = sum < ROUTE_METRIC_LEARNED ? sum : ROUTE_METRIC_LEARNED - 1;
+      routeUpdate ( target, sourceAddress, metric );
+      if ( origin == nodeShortAddress ) {
+        if ( macDebug ) {
+          Serial.printf("ROUTE_DEBUG route to %04X through %04X\n", target, sourceAddress);
+        }
+        if ( routeDiscoveryTarget == target ) routeDiscoveryTarget = ROUTE_ADDRESS_NONE;
+        return;
+      }
+      nextHop = routeNextHop ( origin );
+      if ( nextHop == ROUTE_ADDRESS_NONE ) return;
+      encodeUint16 ( metric, &payload[5] );
+      // Lost if the TX queue is full: the origin sends a new request after ROUTE_DISCOVERY_TIMEOUT
+      macQueueCommand ( ACK_REQUESTED, nextHop, payload, ROUTE_REPLY_LENGTH );
+      break;
+
+    default:
+
+      break;
+  }
+}
+
+
+uint16_t routeNextHop ( uint16_t destinationAddress ) {
+
+  uint8_t i;
+
+  if ( ( destinationAddress == routeSinkAddress ) && ( routeParent != ROUTE_ADDRESS_NONE ) ) return routeParent;
+  if ( routeLinkMetric ( destinationAddress ) <= ROUTE_DIRECT_METRIC ) return destinationAddress;
+
+  for ( i=0; i<ROUTE_TABLE_LENGTH; i++ ) {
+    if ( routeTable[i].destination != destinationAddress ) continue;
+    if ( (int32_t)( micros() - routeTable[i].lastUsed ) > ROUTE_LIFETIME ) {
+      routeTable[i].destination = ROUTE_ADDRESS_NONE;
+      break;
+    }
+    routeTable[i].lastUsed = micros();
+    return routeTable[i].nextHop;
+  }
+  return ROUTE_ADDRESS_NONE;
+}
+
+
+uint16_t routeLinkMetric ( uint16_t address ) {
+
+  uint8_t i;
+
+  i = neighbGetNeighborIndex ( address );
+  if ( ( i == NEIGHB_NEIGHBOR_NOT_FOUND ) || ( neighbors[i].prr < ROUTE_MIN_PRR ) ) return ROUTE_METRIC_NONE;
+  if ( neighbors[i].etx ) return neighbors[i].etx;
+  // Never sent to: the reception ratio of its frames is the best guess
+  return ( (uint32_t)16 * 65535 ) / neighbors[i].prr;
+}
+
+
+void routeSelectParent ( void ) {
+
+  struct routeCandidate_t *best, *parent;
+  uint32_t metric, bestMetric, parentMetric, timeout;
+  uint16_t link;
+  uint8_t i;
+
+  if ( routeSink || ( routeInterval == 0 ) ) return;
+  timeout = ROUTE_PARENT_TIMEOUT * (uint32_t)routeInterval * 1000;
+
+  best = NULL;
+  parent = NULL;
+  bestMetric = ROUTE_METRIC_NONE;
+  parentMetric = ROUTE_METRIC_NONE;
+  for ( i=0; i<ROUTE_CANDIDATES; i++ ) {
+    if ( routeCandidates[i].address == ROUTE_ADDRESS_NONE ) continue;
+    if ( micros() - routeCandidates[i].lastHeard > timeout ) {
+      routeCandidates[i].address = ROUTE_ADDRESS_NONE;
+      continue;
+    }
+    link = routeLinkMetric ( routeCandidates[i].address );
+    if ( link == ROUTE_METRIC_NONE ) continue;
+    metric = (uint32_t)routeCandidates[i].metric + link;
+    if ( metric >= ROUTE_METRIC_LEARNED ) continue;
+    if ( routeCandidates[i].address == routeParent ) {
+      parent = &routeCandidates[i];
+      parentMetric = metric;
+    } else if ( ( routeCandidates[i].sink == routeSinkAddress ) && !cmpUi8GreaterWithRollover ( routeCandidates[i].sequence, routeSequence )
+                && ( routeCandidates[i].metric >= routeFeasibleMetric ) ) {
+      // Not feasible: its path may go through this node
+      continue;
+    }
+    if ( metric < bestMetric ) {
+      bestMetric = metric;
+      best = &routeCandidates[i];
+    }
+  }
+
+  if ( best == NULL ) {
+    // The sink is kept: the descendants still advertise it, they are not feasible until its next beacon
+    if ( ( routeParent != ROUTE_ADDRESS_NONE ) && macDebug ) {
+      Serial.printf("ROUTE_DEBUG parent %04X lost\n", routeParent);
+    }
+    if ( routeParent != ROUTE_ADDRESS_NONE ) routeStats.parentChanges++;
+    routeParent = ROUTE_ADDRESS_NONE;
+    routePathMetric = ROUTE_METRIC_NONE;
+    return;
+  }
+  if ( ( parent != NULL ) && ( parentMetric <= bestMetric + ROUTE_SWITCH_THRESHOLD ) ) {
+    best = parent;
+    bestMetric = parentMetric;
+  }
+
+  if ( best != parent ) {
+    if ( routeParent == ROUTE_ADDRESS_NONE ) {
+      // Joining a tree: tell the neighbors soon
+      routeNextBeacon = micros() + random( (uint32_t)routeInterval * 1000 / 8 );
+    } else routeStats.parentChanges++;
+    if ( macDebug ) {
+      Serial.printf("ROUTE_DEBUG parent %04X, path ETX %d/16 to sink %04X\n", best->address, bestMetric, best->sink);
+    }
+  }
+  if ( ( best->sink != routeSinkAddress ) || cmpUi8GreaterWithRollover ( best->sequence, routeSequence ) ) {
+    routeSequence = best->sequence;
+    routeFeasibleMetric = ROUTE_METRIC_NONE;
+  }
+  routeParent = best->address;
+  routeSinkAddress = best->sink;
+  routePathMetric = bestMetric;
+  if ( bestMetric < routeFeasibleMetric ) routeFeasibleMetric = bestMetric;
+}
+
+
+void routeUpdate ( uint16_t destinationAddress, uint16_t nextHop, uint16_t metric ) {
+
+  struct routeEntry_t *entry;
+  uint8_t i;
+
+  if ( destinationAddress == nodeShortAddress ) return;
+  entry = NULL;
+  for ( i=0; i<ROUTE_TABLE_LENGTH; i++ ) {
+    if ( routeTable[i].destination == destinationAddress ) {
+      entry = &routeTable[i];
+      if ( entry->nextHop == nextHop ) {
+        if ( metric != ROUTE_METRIC_LEARNED ) entry->metric = metric;
+        entry->lastUsed = micros();
+        return;
+      }
+      if ( ( metric != ROUTE_METRIC_LEARNED ) && ( metric >= entry->metric ) && (int32_t)( micros() - entry->lastUsed ) <= ROUTE_LIFETIME ) return;
+      break;
+    }
+  }
+  if ( entry == NULL ) {
+    // Free entry, or else the least recently used one
+    entry = &routeTable[0];
+    for ( i=0; i<ROUTE_TABLE_LENGTH && entry->destination != ROUTE_ADDRESS_NONE; i++ )
+      if ( ( routeTable[i].destination == ROUTE_ADDRESS_NONE ) || (int32_t)( routeTable[i].lastUsed - entry->lastUsed ) < 0 )
+        entry = &routeTable[i];
+  }
+  entry->destination = destinationAddress;
+  entry->nextHop = nextHop;
+  entry->metric = metric;
+  entry->lastUsed = micros();
+}
+
+
+void routeLinkFailed ( uint16_t nextHop ) {
+
+  uint8_t i;
+
+  for ( i=0; i<ROUTE_TABLE_LENGTH; i++ )
+    if ( routeTable[i].nextHop == nextHop ) routeTable[i].destination = ROUTE_ADDRESS_NONE;
+  // The MAC counted the frame lost in the ETX of the parent: a better path may replace it
+  if ( nextHop == routeParent ) routeSelectParent();
+}
+
+
+void routeDiscover ( uint16_t destinationAddress ) {
+
+  uint8_t payload[ROUTE_REQUEST_LENGTH];
+
+  // One request at a time: the others wait for its reply or its timeout
+  if ( ( routeDiscoveryTarget != ROUTE_ADDRESS_NONE ) || ( destinationAddress == BROADCAST_ADDRESS ) ) return;
+  payload[0] = MAC_COMMAND_ROUTE_REQUEST;
+  encodeUint16 ( nodeShortAddress, &payload[1] );
+  encodeUint16 ( destinationAddress, &payload[3] );
+  payload[5] = routeRequestId + 1;
+  encodeUint16 ( 0, &payload[6] );
+  if ( macQueueCommand ( NO_ACK_REQUESTED, BROADCAST_ADDRESS, payload, sizeof(payload) ) != MCPS_DATA_REQUEST_SUCCESS ) return;
+  routeRequestId++;
+  routeDiscoveryTarget = destinationAddress;
+  routeDiscoveryTime = micros();
+  routeStats.discoveries++;
+  if ( macDebug ) {
+    Serial.printf("ROUTE_DEBUG route request %d for %04X\n", routeRequestId, destinationAddress);
+  }
+}
+
+
+uint8_t routeRequestSeen ( uint16_t origin, uint8_t requestId ) {
+
+  uint8_t i;
+
+  for ( i=0; i<ROUTE_REQUEST_CACHE; i++ )
+    if ( ( routeRequestOrigins[i] == origin ) && ( routeRequestIds[i] == requestId ) ) return true;
+  routeRequestOrigins[routeRequestNext] = origin;
+  routeRequestIds[routeRequestNext] = requestId;
+  routeRequestNext = ( routeRequestNext + 1 ) % ROUTE_REQUEST_CACHE;
+  return false;
+}
+
+
+uint8_t routeIsDuplicate ( uint8_t* header ) {
+
+  struct routeOrigin_t *origin;
+  uint16_t address;
+  uint8_t i, sequence, age;
+
+  address = decodeUint16 ( &header[ROUTE_HEADER_ORIGIN] );
+  sequence = header[ROUTE_HEADER_SEQUENCE];
+  for ( i=0; i<ROUTE_ORIGINS; i++ ) {
+    origin = &routeOrigins[i];
+    if ( origin->address != address ) continue;
+    // Same window as the MAC sequence numbers of a neighbor (neighbIsDuplicateData)
+    if ( cmpUi8GreaterWithRollover ( sequence, origin->sequence ) ) return false;
+    age = origin->sequence - sequence;
+    if ( age >= NEIGHB_DUPLICATE_WINDOW ) return false;
+    return ( origin->window >> age ) & 1;
+  }
+  return false;
+}
+
+
+void routeRecordOrigin ( uint8_t* header ) {
+
+  struct routeOrigin_t *origin, *oldest;
+  uint16_t address;
+  uint8_t i, sequence, shift, age;
+
+  address = decodeUint16 ( &header[ROUTE_HEADER_ORIGIN] );
+  sequence = header[ROUTE_HEADER_SEQUENCE];
+  origin = NULL;
+  oldest = &routeOrigins[0];
+  for ( i=0; i<ROUTE_ORIGINS; i++ ) {
+    if ( routeOrigins[i].address == address ) {
+      origin = &routeOrigins[i];
+      break;
+    }
+    if ( ( routeOrigins[i].address == ROUTE_ADDRESS_NONE ) || ( ( oldest->address != ROUTE_ADDRESS_NONE )
+         && cmpUi32GreaterWithRollover ( oldest->lastHeard, routeOrigins[i].lastHeard ) ) ) oldest = &routeOrigins[i];
+  }
+
+  if ( origin == NULL ) {
+    origin = oldest;
+    origin->address = address;
+    origin->sequence = sequence;
+    origin->window = 1;
+  } else if ( cmpUi8GreaterWithRollover ( sequence, origin->sequence ) ) {
+    // Slide the window up to the new number
+    shift = sequence - origin->sequence;
+    origin->window = shift >= NEIGHB_DUPLICATE_WINDOW ? 1 : ( origin->window << shift ) | 1;
+    origin->sequence = sequence;
+  } else {
+    age = origin->sequence - sequence;
+    if ( age < NEIGHB_DUPLICATE_WINDOW ) origin->window |= (uint32_t)1 << age;
+  }
+  origin->lastHeard = micros();
+}
+
+
+uint8_t routeQueueCount ( void ) {
+
+  uint8_t i, count;
+
+  count = 0;
+  for ( i=0; i<ROUTE_FORWARD_QUEUE_LENGTH; i++ )
+    if ( routeQueue[i].state != ROUTE_ENTRY_FREE ) count++;
+  return count;
+}
+
+
+void routeSendBeacon ( void ) {
+
+  uint8_t payload[ROUTE_BEACON_LENGTH];
+
+  payload[0] = MAC_COMMAND_ROUTE_BEACON;
+  encodeUint16 ( routeSinkAddress, &payload[1] );
+  encodeUint16 ( routeParent, &payload[3] );
+  encodeUint16 ( routePathMetric, &payload[5] );
+  payload[7] = routeSequence;
+  // Lost if the TX queue is full: the next one is in an interval
+  macQueueCommand ( NO_ACK_REQUESTED, BROADCAST_ADDRESS, payload, sizeof(payload) );
+}
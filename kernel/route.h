@@ -0,0 +1,259 @@
+/**
+ * @file route.h
+ * @brief Multi-hop routing between the MAC and the send/recv API: a collection tree toward the sinks, and on-demand point-to-point routes
+ * @date 20261017
+ */
+
+#ifndef ROUTE_H
+#define ROUTE_H
+
+#include "mac.h"
+
+#ifndef ROUTE_FORWARD_QUEUE_LENGTH
+#define ROUTE_FORWARD_QUEUE_LENGTH 4 // frames of other nodes waiting for their next hop
+#endif
+#ifndef ROUTE_TABLE_LENGTH
+#define ROUTE_TABLE_LENGTH 16 // point-to-point routes
+#endif
+#ifndef ROUTE_ORIGINS
+#define ROUTE_ORIGINS 16 // origins whose last sequence numbers are kept to drop the duplicates
+#endif
+#define ROUTE_CANDIDATES 8 // neighbors whose tree beacons are kept to choose the parent
+#define ROUTE_REQUEST_CACHE 8 // route requests already flooded
+#define ROUTE_HEADER_LENGTH 6 // origin, final destination, hops, sequence number of the origin
+#define ROUTE_MAX_HOPS 16 // hops before a frame is dropped: routing loop
+#define ROUTE_MAX_ATTEMPTS 3 // transmissions to a next hop (MAC retries included each) before a forwarded frame is dropped
+#define ROUTE_PARENT_TIMEOUT 4 // intervals without a tree beacon of a candidate before it is forgotten
+#define ROUTE_SWITCH_THRESHOLD 24 // 1/16 units: a parent is replaced by a path 1.5 transmission better only (hysteresis)
+#define ROUTE_DIRECT_METRIC 24 // 1/16 units: a destination with a link this good is sent to directly
+#define ROUTE_MIN_PRR 16384 // 1/4: links heard less are not used
+#define ROUTE_LIFETIME 60000000 // us a point-to-point route is kept without a frame through it
+#define ROUTE_DISCOVERY_TIMEOUT 1000000 // us a route request waits for its reply, and a forwarded frame for a route
+#define ROUTE_METRIC_NONE 0xFFFF // no path
+#define ROUTE_METRIC_LEARNED 0xFFFE // path learned from a frame of the destination: replaced by any discovered one
+#define ROUTE_ADDRESS_NONE 0xFFFF // never a source address (broadcast)
+
+// Network header, at the beginning of the payload of a FRAME_ROUTED data frame
+#define ROUTE_HEADER_ORIGIN 0
+#define ROUTE_HEADER_DESTINATION 2
+#define ROUTE_HEADER_HOPS 4
+#define ROUTE_HEADER_SEQUENCE 5 // end to end: a frame sent again to a next hop has a new MAC sequence number
+
+// MAC commands of the routing layer (see MAC_COMMAND_* in mac.h)
+#define ROUTE_BEACON_LENGTH 8 // MAC_COMMAND_ROUTE_BEACON, sink, parent, path metric, sequence number of the sink
+#define ROUTE_REQUEST_LENGTH 8 // MAC_COMMAND_ROUTE_REQUEST, origin, target, request id, path metric
+#define ROUTE_REPLY_LENGTH 7 // MAC_COMMAND_ROUTE_REPLY, origin, target, path metric
+
+// routeIndication results
+#define ROUTE_INDICATION_DELIVER 0 // for this node: the frame stays in the PHY queue until recv
+#define ROUTE_INDICATION_FORWARDED 1 // copied in the forwarding queue, or dropped: the frame is freed and ACKed
+#define ROUTE_INDICATION_QUEUE_FULL 2 // not ACKed: the previous hop will retry later
+
+// routeDataRequest results, after the MCPS_DATA_REQUEST_* ones
+#define ROUTE_DATA_REQUEST_NO_ROUTE 4 // a route request is sent: try again later
+
+#define ROUTE_ENTRY_FREE 0
+#define ROUTE_ENTRY_WAITING 1 // waiting for a next hop and room in the MAC TX queue
+#define ROUTE_ENTRY_SENDING 2 // in the MAC TX queue
+
+struct routeEntry_t {
+ /**
+  * @brief Point-to-point route
+  */
+  uint16_t destination;
+  uint16_t nextHop;
+  uint16_t metric;/**< @brief Path ETX to the destination, 1/16 units.*/
+  uint32_t lastUsed;
+
+}; // routeEntry_t
+
+struct routeCandidate_t {
+ /**
+  * @brief Neighbor heard with a tree beacon: a possible parent
+  */
+  uint16_t address;
+  uint16_t sink;
+  uint16_t metric;/**< @brief Its path ETX to the sink, 1/16 units.*/
+  uint8_t sequence;/**< @brief Beacon of the sink its path is from.*/
+  uint32_t lastHeard;
+
+}; // routeCandidate_t
+
+struct routeOrigin_t {
+ /**
+  * @brief Origin of frames with a network header, received or forwarded
+  */
+  uint16_t address;
+  uint8_t sequence;/**< @brief Newest sequence number received.*/
+  uint32_t window;/**< @brief Bit n: sequence - n received, over NEIGHB_DUPLICATE_WINDOW numbers.*/
+  uint32_t lastHeard;
+
+}; // routeOrigin_t
+
+struct routeQueueEntry_t {
+ /**
+  * @brief Frame of another node waiting in the forwarding queue
+  */
+  uint8_t state;
+  uint8_t length;/**< @brief Network header and payload.*/
+  uint8_t data[MAX_FRAME_LENGTH - MAC_DATA_FRAME_HEADER_LENGTH];
+  uint16_t nextHop;
+  uint8_t handle;/**< @brief MAC handle while ROUTE_ENTRY_SENDING.*/
+  uint8_t attempts;
+  uint32_t arrival;/**< @brief Reception, for the per-hop latency.*/
+  uint32_t waiting;/**< @brief Since when it waits for a next hop.*/
+
+}; // routeQueueEntry_t
+
+// Global vars
+uint16_t routeInterval; // ms between two tree beacons of a node, 0 if the routing is off
+uint8_t routeSink; // This node is a sink: the root of a collection tree
+uint16_t routeSinkAddress; // Sink of the tree this node is in
+uint16_t routeParent; // Next hop to routeSinkAddress
+uint16_t routePathMetric; // Path ETX to routeSinkAddress, 1/16 units
+uint8_t routeSequence; // Beacon of the sink the path is from. The sink numbers its beacons
+uint16_t routeFeasibleMetric; // Smallest routePathMetric with routeSequence: a candidate with a larger one may be a descendant
+uint32_t routeNextBeacon;
+struct routeCandidate_t routeCandidates[ROUTE_CANDIDATES];
+struct routeEntry_t routeTable[ROUTE_TABLE_LENGTH];
+uint8_t routeRequestId; // of the last route request of this node
+uint16_t routeRequestOrigins[ROUTE_REQUEST_CACHE];
+uint8_t routeRequestIds[ROUTE_REQUEST_CACHE];
+uint8_t routeRequestNext; // Next cache entry replaced
+uint8_t routeDataSequence; // of the last frame of this node with a network header
+struct routeOrigin_t routeOrigins[ROUTE_ORIGINS];
+uint16_t routeDiscoveryTarget; // Route request of this node waiting for its reply
+uint32_t routeDiscoveryTime;
+struct routeQueueEntry_t routeQueue[ROUTE_FORWARD_QUEUE_LENGTH]; // Slots: a frame waiting for a route does not hold the others
+struct routeStats_t routeStats;
+
+
+// Prototypes
+
+/**
+* @brief Initialize the routing layer
+* @return No return
+* @date 20261017
+*/
+void routeInit ( void );
+
+/**
+* @brief Start (interval in ms between two tree beacons) or stop (0) the routing. All the nodes of the network should use the same interval
+* @return No return
+* @date 20261017
+*/
+void routeSetInterval ( uint16_t interval );
+
+/**
+* @brief Make this node a sink (root of a collection tree), or a plain node
+* @return No return
+* @date 20261017
+*/
+void routeSetSink ( uint8_t sink );
+
+/**
+* @brief Process engine of the routing layer: tree beacons, parent timeouts, and the forwarding queue to the MAC TX queue
+* @return No return
+* @date 20261017
+*/
+void routeEngine ( void );
+
+/**
+* @brief Queue a payload for a destination that may be several hops away. Sent as a plain data frame to a destination in reach
+* @return MCPS_DATA_REQUEST_* as MCPS_data_request, or ROUTE_DATA_REQUEST_NO_ROUTE: a route request is sent, try again later
+* @date 20261017
+*/
+uint8_t routeDataRequest ( uint16_t destinationAddress, uint8_t* payload, uint8_t payloadLength, uint8_t* handle );
+
+/**
+* @brief Called by MAC layer with the payload of a received FRAME_ROUTED data frame: network header and payload
+* @return ROUTE_INDICATION_DELIVER, ROUTE_INDICATION_FORWARDED or ROUTE_INDICATION_QUEUE_FULL
+* @date 20261017
+*/
+uint8_t routeIndication ( uint16_t sourceAddress, uint8_t* payload, uint8_t payloadLength );
+
+/**
+* @brief Called by MAC layer with the payload of a received MAC_COMMAND_ROUTE_* command
+* @return No return
+* @date 20261017
+*/
+void routeCommandIndication ( uint16_t sourceAddress, uint8_t* payload, uint8_t payloadLength );
+
+/**
+* @brief Get the next hop to a destination: the parent for the sink, a direct good link, or a point-to-point route
+* @return the next hop, or ROUTE_ADDRESS_NONE
+* @date 20261017
+*/
+uint16_t routeNextHop ( uint16_t destinationAddress );
+
+/**
+* @brief ETX of the link to a neighbor: measured on the frames sent to it, estimated from the reception ratio else
+* @return the ETX in 1/16 units, or ROUTE_METRIC_NONE if the neighbor is not known or heard too little
+* @date 20261017
+*/
+uint16_t routeLinkMetric ( uint16_t address );
+
+/**
+* @brief Choose the parent among the feasible candidates (newer beacon of the sink, or better path than routeFeasibleMetric: no loop), with ROUTE_SWITCH_THRESHOLD hysteresis
+* @return No return
+* @date 20261017
+*/
+void routeSelectParent ( void );
+
+/**
+* @brief Add or update a point-to-point route. A learned route always replaces the previous one, a discovered one if it is better
+* @return No return
+* @date 20261017
+*/
+void routeUpdate ( uint16_t destinationAddress, uint16_t nextHop, uint16_t metric );
+
+/**
+* @brief Forget the point-to-point routes through a next hop that did not ACK a frame, and check the parent
+* @return No return
+* @date 20261017
+*/
+void routeLinkFailed ( uint16_t nextHop );
+
+/**
+* @brief Flood a route request for a destination, unless one is waiting for its reply
+* @return No return
+* @date 20261017
+*/
+void routeDiscover ( uint16_t destinationAddress );
+
+/**
+* @brief Tell if a route request was flooded already, and remember it else
+* @return true if it was
+* @date 20261017
+*/
+uint8_t routeRequestSeen ( uint16_t origin, uint8_t requestId );
+
+/**
+* @brief Tell if a frame with a network header was already received or forwarded: same origin and sequence number
+* @return true if it was
+* @date 20261017
+*/
+uint8_t routeIsDuplicate ( uint8_t* header );
+
+/**
+* @brief Remember the origin and the sequence number of a frame with a network header, once it is taken. The least recently heard origin is replaced
+* @return No return
+* @date 20261017
+*/
+void routeRecordOrigin ( uint8_t* header );
+
+/**
+* @brief Number of frames in the forwarding queue
+* @return the count
+* @date 20261017
+*/
+uint8_t routeQueueCount ( void );
+
+/**
+* @brief Queue a tree beacon with the path of this node
+* @return No return
+* @date 20261017
+*/
+void routeSendBeacon ( void );
+
+#endif
@@ -0,0 +1,178 @@
+/**
+ * @file sync.c
+ * @brief Network-wide time synchronization (FTSP-like), built on the TX timestamps of the PHY (PHY_TIMESTAMPS_AT_TX)
+ * @date 20261017
+ */
+
+#include "sync.h"
+
+extern uint16_t nodeShortAddress;
+
+
+void syncInit ( void ) {
+
+  syncInterval = 0;
+  syncRootAddress = SYNC_ROOT_NONE;
+  syncSequence = 0;
+  syncClearTable();
+}
+
+
+uint8_t syncSetInterval ( uint16_t interval ) {
+
+#ifndef PHY_TIMESTAMPS_AT_TX
+  // No timestamp pair without the TX timestamps
+  if ( interval ) return false;
+#endif
+  syncInterval = interval;
+  syncLastUpdate = micros();
+  syncNextTx = micros() + random( (uint32_t)interval * 1000 );
+  return true;
+}
+
+
+uint8_t syncIsSynchronized ( void ) {
+
+  return syncInterval && ( ( syncRootAddress == nodeShortAddress ) || syncEntriesCount );
+}
+
+
+uint32_t syncGlobalTime ( uint32_t localTime ) {
+
+  // The root has no regression: its clock is the global time
+  return localTime + syncOffsetAverage + (int32_t)( syncSkew * (int32_t)( localTime - syncLocalAverage ) );
+}
+
+
+void syncEngine ( void ) {
+
+  uint32_t interval;
+
+  if ( syncInterval == 0 ) return;
+  interval = (uint32_t)syncInterval * 1000;
+
+  // The root is lost, or none was ever heard: the nodes that time out first compete, the smallest address wins
+  if ( ( syncRootAddress != nodeShortAddress ) && ( micros() - syncLastUpdate > SYNC_ROOT_TIMEOUT * interval ) ) {
+    if ( macDebug ) {
+      Serial.printf("SYNC_DEBUG no sync frame from root %04X, becoming the root\n", syncRootAddress);
+    }
+    syncRootAddress = nodeShortAddress;
+    // After a reboot, the neighbors may still forward the last sequence numbers of this node
+    syncSequence = random(256);
+    syncClearTable();
+    syncLastUpdate = micros();
+  }
+
+  if ( !cmpUi32GreaterOrEqualWithRollover ( micros(), syncNextTx ) ) return;
+  // Jitter: the sync frames of neighbors are broadcast without ACK, they must not collide at each interval
+  syncNextTx = micros() + interval - interval / 4 + random( interval / 2 );
+
+  if ( syncRootAddress == nodeShortAddress ) {
+    syncSequence++;
+    syncSendFrame();
+  } else if ( syncEntriesCount >= SYNC_MIN_ENTRIES ) {
+    syncSendFrame();
+  }
+}
+
+
+void syncSendFrame ( void ) {
+
+  uint8_t payload[SYNC_FRAME_LENGTH];
+
+  // The global time of this node at the TX timestamp of the frame is computed by the receivers
+  payload[0] = MAC_COMMAND_TIME_SYNC;
+  encodeUint16 ( syncRootAddress, &payload[1] );
+  payload[3] = syncSequence;
+  encodeUint32 ( syncLocalAverage, &payload[4] );
+  encodeUint32 ( syncOffsetAverage, &payload[8] );
+  encodeFloat ( syncSkew, &payload[12] );
+  // Lost if the TX queue is full: the next one is in an interval
+  macQueueCommand ( NO_ACK_REQUESTED, BROADCAST_ADDRESS, payload, sizeof(payload) );
+}
+
+
+void syncIndication ( uint16_t sourceAddress, uint8_t* payload, uint8_t payloadLength, uint32_t rxTimestamp, uint32_t txTimestamp, uint8_t length ) {
+
+  uint16_t rootAddress;
+  uint8_t sequence;
+  uint32_t global;
+  int32_t error;
+
+  if ( ( syncInterval == 0 ) || ( payloadLength < SYNC_FRAME_LENGTH ) ) return;
+  rootAddress = decodeUint16 ( &payload[1] );
+  sequence = payload[3];
+
+  // Only the news of the smallest root: each sync frame of the root is taken once, from the first neighbor heard
+  if ( ( rootAddress == nodeShortAddress ) || ( rootAddress > syncRootAddress ) ) return;
+  if ( ( rootAddress == syncRootAddress ) && !cmpUi8GreaterWithRollover ( sequence, syncSequence ) ) return;
+  if ( rootAddress < syncRootAddress ) {
+    if ( macDebug ) {
+      Serial.printf("SYNC_DEBUG new root %04X, from %04X\n", rootAddress, sourceAddress);
+    }
+    syncRootAddress = rootAddress;
+    syncClearTable();
+  }
+  syncSequence = sequence;
+  syncLastUpdate = micros();
+
+  // Global time of the source at the TX timestamp, then when the frame was read from the driver
+  global = txTimestamp + decodeUint32 ( &payload[8] ) + (int32_t)( decodeFloat ( &payload[12] ) * (int32_t)( txTimestamp - decodeUint32 ( &payload[4] ) ) );
+  global += phyTimestampDelay ( length );
+
+  if ( syncEntriesCount >= SYNC_MIN_ENTRIES ) {
+    error = (int32_t)( global - syncGlobalTime ( rxTimestamp ) );
+    if ( ( error > SYNC_MAX_ERROR ) || ( error < -SYNC_MAX_ERROR ) ) {
+      // A few outliers are dropped. More in a row: the regression is wrong, start it again
+      if ( ++syncOutliers < SYNC_MAX_OUTLIERS ) return;
+      syncClearTable();
+    }
+  }
+  syncOutliers = 0;
+  syncAddEntry ( rxTimestamp, (int32_t)( global - rxTimestamp ) );
+}
+
+
+void syncClearTable ( void ) {
+
+  syncEntriesCount = 0;
+  syncNextEntry = 0;
+  syncOutliers = 0;
+  syncLocalAverage = 0;
+  syncOffsetAverage = 0;
+  syncSkew = 0;
+}
+
+
+void syncAddEntry ( uint32_t local, int32_t offset ) {
+
+  int64_t localSum, offsetSum;
+  float covariance, variance;
+  int32_t localDelta;
+  uint8_t i;
+
+  syncTable[syncNextEntry].local = local;
+  syncTable[syncNextEntry].offset = offset;
+  syncNextEntry = ( syncNextEntry + 1 ) % SYNC_TABLE_LENGTH;
+  if ( syncEntriesCount < SYNC_TABLE_LENGTH ) syncEntriesCount++;
+
+  // Averages from the first entry: the sums of the differences don't overflow
+  localSum = 0;
+  offsetSum = 0;
+  for ( i=0; i<syncEntriesCount; i++ ) {
+    localSum += (int32_t)( syncTable[i].local - syncTable[0].local );
+    offsetSum += (int32_t)( syncTable[i].offset - syncTable[0].offset );
+  }
+  syncLocalAverage = syncTable[0].local + (int32_t)( localSum / syncEntriesCount );
+  syncOffsetAverage = syncTable[0].offset + (int32_t)( offsetSum / syncEntriesCount );
+
+  // Least squares slope of the offset over the local time: the skew of the local clock
+  covariance = 0;
+  variance = 0;
+  for ( i=0; i<syncEntriesCount; i++ ) {
+    localDelta = (int32_t)( syncTable[i].local - syncLocalAverage );
+    covariance += (float)localDelta * (int32_t)( syncTable[i].offset - syncOffsetAverage );
+    variance += (float)localDelta * localDelta;
+  }
+  syncSkew = ( variance > 0 ) ? covariance / variance : 0;
+}
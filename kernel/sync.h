@@ -0,0 +1,109 @@
+/**
+ * @file sync.h
+ * @brief Network-wide time synchronization (FTSP-like), built on the TX timestamps of the PHY (PHY_TIMESTAMPS_AT_TX)
+ * @date 20261017
+ */
+
+#ifndef SYNC_H
+#define SYNC_H
+
+#include "mac.h"
+
+#define SYNC_TABLE_LENGTH 8 // timestamp pairs of the linear regression of the global time on the local clock
+#define SYNC_MIN_ENTRIES 3 // pairs before a node sends the global time to its neighbors
+#define SYNC_ROOT_TIMEOUT 4 // intervals without a new sync frame before a node becomes the root
+#define SYNC_MAX_ERROR 1000 // us: a pair this far from the regression is an outlier
+#define SYNC_MAX_OUTLIERS 3 // outliers in a row before the regression is started again
+#define SYNC_FRAME_LENGTH 16 // MAC_COMMAND_TIME_SYNC, root address, sequence number, local average, offset average, skew
+#define SYNC_ROOT_NONE 0xFFFF // never a source address (broadcast)
+
+struct syncEntry_t {
+ /**
+  * @brief Timestamp pair of the regression: the global time was local + offset at local
+  */
+  uint32_t local;
+  int32_t offset;
+
+}; // syncEntry_t
+
+// Global vars
+uint16_t syncInterval; // ms between two sync frames of a node, 0 if the synchronization is off
+uint16_t syncRootAddress; // node whose clock is the global time: the smallest address heard
+uint8_t syncSequence; // sequence number of the last sync frame of the root taken
+struct syncEntry_t syncTable[SYNC_TABLE_LENGTH];
+uint8_t syncEntriesCount;
+uint8_t syncNextEntry; // Next entry replaced once the table is full
+uint8_t syncOutliers; // Outliers in a row
+uint32_t syncLocalAverage; // Regression: global = local + syncOffsetAverage + syncSkew * ( local - syncLocalAverage )
+int32_t syncOffsetAverage;
+float syncSkew;
+uint32_t syncLastUpdate; // Last new sync frame taken, or root election
+uint32_t syncNextTx;
+
+
+// Prototypes
+
+/**
+* @brief Initialize the synchronization layer
+* @return No return
+* @date 20261017
+*/
+void syncInit ( void );
+
+/**
+* @brief Start (interval in ms) or stop (0) the synchronization. All the nodes of the network should use the same interval
+* @return false if the library is built without PHY_TIMESTAMPS_AT_TX
+* @date 20261017
+*/
+uint8_t syncSetInterval ( uint16_t interval );
+
+/**
+* @brief Process engine of the synchronization layer: root election, and a sync frame every syncInterval once synchronized
+* @return No return
+* @date 20261017
+*/
+void syncEngine ( void );
+
+/**
+* @brief Tell if this node is the root, or has a regression of the global time
+* @return true if syncGlobalTime gives the global time
+* @date 20261017
+*/
+uint8_t syncIsSynchronized ( void );
+
+/**
+* @brief Convert a local time (micros()) to the global time
+* @return the global time in us, localTime while the node is not synchronized
+* @date 20261017
+*/
+uint32_t syncGlobalTime ( uint32_t localTime );
+
+/**
+* @brief Called by MAC layer with the payload of a received MAC_COMMAND_TIME_SYNC command and the timestamps of its frame (length without the trailer)
+* @return No return
+* @date 20261017
+*/
+void syncIndication ( uint16_t sourceAddress, uint8_t* payload, uint8_t payloadLength, uint32_t rxTimestamp, uint32_t txTimestamp, uint8_t length );
+
+/**
+* @brief Forget the regression, to follow a new root
+* @return No return
+* @date 20261017
+*/
+void syncClearTable ( void );
+
+/**
+* @brief Add a timestamp pair to the regression and compute it again
+* @return No return
+* @date 20261017
+*/
+void syncAddEntry ( uint32_t local, int32_t offset );
+
+/**
+* @brief Queue a sync frame with the regression of this node
+* @return No return
+* @date 20261017
+*/
+void syncSendFrame ( void );
+
+#endif
@@ -367,91 +367,44 @@ void strTrim ( uint8_t *str ) {
 
 uint8_t cmpUi32GreaterOrEqualWithRollover ( uint32_t a, uint32_t b ) {
 
-  if ( a & 0x80000000 ) {
-
-    if ( (int32_t)a >= (int32_t)b ) return true;
-    else return false;
-
-  } else {
-
-    if ( a >= b ) return true;
-    else return false;
-  }
+  // Serial number arithmetic: a is after b if it is less than half the range ahead
+  if ( (int32_t)( a - b ) >= 0 ) return true;
+  else return false;
 }
 
 
 uint8_t cmpUi16GreaterOrEqualWithRollover ( uint16_t a, uint16_t b ) {
 
-  if ( a & 0x8000 ) {
-
-    if ( (int16_t)a >= (int16_t)b ) return true;
-    else return false;
-
-  } else {
-
-    if ( a >= b ) return true;
-    else return false;
-  }
+  if ( (int16_t)( a - b ) >= 0 ) return true;
+  else return false;
 }
 
 
 uint8_t cmpUi8GreaterOrEqualWithRollover ( uint8_t a, uint8_t b ) {
 
-  if ( a & 0x80 ) {
-
-    if ( (int8_t)a >= (int8_t)b ) return true;
-    else return false;
-
-  } else {
-
-    if ( a >= b ) return true;
-    else return false;
-  }
+  if ( (int8_t)( a - b ) >= 0 ) return true;
+  else return false;
 }
 
 
 uint8_t cmpUi32GreaterWithRollover ( uint32_t a, uint32_t b ) {
 
-  if ( a & 0x80000000 ) {
-
-    if ( (int32_t)a > (int32_t)b ) return true;
-    else return false;
-
-  } else {
-
-    if ( a > b ) return true;
-    else return false;
-  }
+  if ( (int32_t)( a - b ) > 0 ) return true;
+  else return false;
 }
 
 
 uint8_t cmpUi16GreaterWithRollover ( uint16_t a, uint16_t b ) {
 
-  if ( a & 0x8000 ) {
-
-    if ( (int16_t)a > (int16_t)b ) return true;
-    else return false;
-
-  } else {
-
-    if ( a > b ) return true;
-    else return false;
-  }
+  if ( (int16_t)( a - b ) > 0 ) return true;
+  else return false;
 }
 
 
 uint8_t cmpUi8GreaterWithRollover ( uint8_t a, uint8_t b ) {
 
-  if ( a & 0x80 ) {
-
-    if ( (int8_t)a > (int8_t)b ) return true;
-    else return false;
-
-  } else {
-
-    if ( a > b ) return true;
-    else return false;
-  }
+  if ( (int8_t)( a - b ) > 0 ) return true;
+  else return false;
 }
 
 void makeRandomBytes ( uint8_t* bytes, uint8_t len ) {
@@ -38,7 +38,7 @@ uint32_t getUint32HexValue ( uint8_t* data );
 
 
 /**
-* @brief compares two uint32_t with rollover (for example 0x0 > 0x80000000 but 0x0 < 0x7FFFFFFF)
+* @brief compares two uint32_t with rollover (for example 0x0 > 0xFFFFFFF0 but 0x0 < 0x7FFFFFFF)
 * @return true if a >= b, false otherwise
 * @author Adrien van den Bossche <bossche@irit.fr>
 * @date 20140720
@@ -47,7 +47,7 @@ uint8_t cmpUi32GreaterOrEqualWithRollover ( uint32_t a, uint32_t b );
 
 
 /**
-* @brief compares two uint16_t with rollover (for example 0x0 > 0x8000 but 0x0 < 0x7FFF)
+* @brief compares two uint16_t with rollover (for example 0x0 > 0xFFF0 but 0x0 < 0x7FFF)
 * @return true if a >= b, false otherwise
 * @author Adrien van den Bossche <bossche@irit.fr>
 * @date 20140720
@@ -56,7 +56,7 @@ uint8_t cmpUi16GreaterOrEqualWithRollover ( uint16_t a, uint16_t b );
 
 
 /**
-* @brief compares two uint8_t with rollover (for example 0 > 128 but 0 < 127)
+* @brief compares two uint8_t with rollover (for example 0 > 240 but 0 < 127)
 * @return true if a >= b, false otherwise
 * @author Adrien van den Bossche <bossche@irit.fr>
 * @date 20140720
@@ -65,7 +65,7 @@ uint8_t cmpUi8GreaterOrEqualWithRollover ( uint8_t a, uint8_t b );
 
 
 /**
-* @brief compares two uint32_t with rollover (for example 0x0 > 0x80000000 but 0x0 < 0x7FFFFFFF)
+* @brief compares two uint32_t with rollover (for example 0x0 > 0xFFFFFFF0 but 0x0 < 0x7FFFFFFF)
 * @return true if a > b, false otherwise
 * @author Adrien van den Bossche <bossche@irit.fr>
 * @date 20140720
@@ -74,7 +74,7 @@ uint8_t cmpUi32GreaterWithRollover ( uint32_t a, uint32_t b );
 
 
 /**
-* @brief compares two uint16_t with rollover (for example 0x0 > 0x8000 but 0x0 < 0x7FFF)
+* @brief compares two uint16_t with rollover (for example 0x0 > 0xFFF0 but 0x0 < 0x7FFF)
 * @return true if a > b, false otherwise
 * @author Adrien van den Bossche <bossche@irit.fr>
 * @date 20140720
@@ -83,7 +83,7 @@ uint8_t cmpUi16GreaterWithRollover ( uint16_t a, uint16_t b );
 
 
 /**
-* @brief compares two uint8_t with rollover (for example 0 > 128 but 0 < 127)
+* @brief compares two uint8_t with rollover (for example 0 > 240 but 0 < 127)
 * @return true if a > b, false otherwise
 * @author Adrien van den Bossche <bossche@irit.fr>
 * @date 20140720